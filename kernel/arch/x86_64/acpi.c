@@ -0,0 +1,95 @@
+#include "acpi.h"
+#include "multiboot.h"
+#include "vmm.h"
+#include "string.h"
+#include "console.h"
+
+static struct acpi_rsdp* rsdp;
+static struct acpi_sdt_header* root_sdt;
+static int root_is_xsdt;
+
+static int acpi_checksum(const void* ptr, uint64_t len) {
+    const uint8_t* p = (const uint8_t*)ptr;
+    uint8_t sum = 0;
+    for (uint64_t i = 0; i < len; i++) sum += p[i];
+    return sum == 0;
+}
+
+static struct acpi_rsdp* acpi_scan_rsdp(uint64_t start, uint64_t len) {
+    for (uint64_t phys = start; phys < start + len; phys += 16) {
+        struct acpi_rsdp* r = (struct acpi_rsdp*)phys_to_virt(phys);
+        if (!memcmp(r->signature, "RSD PTR ", 8) && acpi_checksum(r, 20)) return r;
+    }
+    return 0;
+}
+
+static struct acpi_rsdp* acpi_find_rsdp(uint64_t multiboot_addr, uint64_t magic) {
+    if (magic == 0x36D76289) {
+        uint8_t* tag_ptr = (uint8_t*)phys_to_virt(multiboot_addr) + 8;
+        uint8_t* end = tag_ptr - 8 + *(uint32_t*)phys_to_virt(multiboot_addr);
+        struct acpi_rsdp* found = 0;
+
+        while (tag_ptr < end) {
+            struct multiboot_tag* tag = (struct multiboot_tag*)tag_ptr;
+            if (tag->type == 0) break;
+            if (tag->type == MULTIBOOT_TAG_TYPE_ACPI_NEW) {
+                return (struct acpi_rsdp*)((struct multiboot_tag_acpi*)tag)->rsdp;
+            }
+            if (tag->type == MULTIBOOT_TAG_TYPE_ACPI_OLD) {
+                found = (struct acpi_rsdp*)((struct multiboot_tag_acpi*)tag)->rsdp;
+            }
+            tag_ptr += (tag->size + 7) & ~7U;
+        }
+        if (found) return found;
+    }
+
+    uint64_t ebda = (uint64_t)(*(uint16_t*)phys_to_virt(0x40E)) << 4;
+    struct acpi_rsdp* r = 0;
+    if (ebda >= 0x80000 && ebda < 0xA0000) r = acpi_scan_rsdp(ebda, 1024);
+    if (!r) r = acpi_scan_rsdp(0xE0000, 0x20000);
+    return r;
+}
+
+int acpi_init(uint64_t multiboot_addr, uint64_t magic) {
+    rsdp = acpi_find_rsdp(multiboot_addr, magic);
+    if (!rsdp) {
+        kprint_str("ACPI: RSDP not found\n");
+        return -1;
+    }
+
+    if (rsdp->revision >= 2 && rsdp->xsdt_address && acpi_checksum(rsdp, rsdp->length)) {
+        root_sdt = (struct acpi_sdt_header*)phys_to_virt(rsdp->xsdt_address);
+        root_is_xsdt = 1;
+    } else {
+        root_sdt = (struct acpi_sdt_header*)phys_to_virt(rsdp->rsdt_address);
+        root_is_xsdt = 0;
+    }
+
+    if (!acpi_checksum(root_sdt, root_sdt->length)) {
+        kprint_str("ACPI: Bad root table checksum\n");
+        root_sdt = 0;
+        return -1;
+    }
+
+    kprint_str("ACPI: ");
+    kprint_str(root_is_xsdt ? "XSDT" : "RSDT");
+    kprint_str(" @ ");
+    kprint_hex(root_is_xsdt ? rsdp->xsdt_address : rsdp->rsdt_address);
+    kprint_newline();
+    return 0;
+}
+
+struct acpi_sdt_header* acpi_find_table(const char* signature) {
+    if (!root_sdt) return 0;
+
+    uint64_t entry_size = root_is_xsdt ? 8 : 4;
+    uint64_t count = (root_sdt->length - sizeof(struct acpi_sdt_header)) / entry_size;
+    uint8_t* entries = (uint8_t*)root_sdt + sizeof(struct acpi_sdt_header);
+
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t phys = root_is_xsdt ? *(uint64_t*)(entries + i * 8) : *(uint32_t*)(entries + i * 4);
+        struct acpi_sdt_header* table = (struct acpi_sdt_header*)phys_to_virt(phys);
+        if (!memcmp(table->signature, signature, 4) && acpi_checksum(table, table->length)) return table;
+    }
+    return 0;
+}
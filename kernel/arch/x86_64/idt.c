@@ -1,9 +1,11 @@
 #include "idt.h"
 #include "drivers/pic.h"
 #include "process.h"
+#include "vmm.h"
 #include "syscall.h"
 #include "console.h"
 #include "mm/swap.h"
+#include "mm/mmap.h"
 
 struct idt_entry idt[256];
 struct idt_ptr idtr;
@@ -89,6 +91,10 @@ void exception_handler(struct interrupt_frame* frame) {
         if (handle_swap_fault(cr2) == 0) {
             return;
         }
+
+        if (current_process && handle_mm_fault(current_process->active_mm, cr2, frame->err_code) == 0) {
+            return;
+        }
     }
 
     volatile uint16_t* vga_buffer = (volatile uint16_t*)0xB8000;
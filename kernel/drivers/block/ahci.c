@@ -80,7 +80,7 @@ static int ahci_read(hba_port_t *port, uint32_t startl, uint32_t starth, uint32_
     struct ahci_tbl *cmdtbl = (struct ahci_tbl*)(adev->port_ctba[port_idx][slot]);
     memset(cmdtbl, 0, sizeof(struct ahci_tbl) + (cmdheader->prdtl-1)*sizeof(struct ahci_prdt_entry));
 
-    uint64_t phys_buf = vmm_get_phys((uint64_t)buf);
+    uint64_t phys_buf = virt_to_phys(buf);
     
     cmdtbl->prdt_entry[0].dba = (uint32_t)(phys_buf & 0xFFFFFFFF);
     cmdtbl->prdt_entry[0].dbau = (uint32_t)((phys_buf >> 32) & 0xFFFFFFFF);
@@ -157,7 +157,7 @@ static int ahci_write(hba_port_t *port, uint32_t startl, uint32_t starth, uint32
     struct ahci_tbl *cmdtbl = (struct ahci_tbl*)(adev->port_ctba[port_idx][slot]);
     memset(cmdtbl, 0, sizeof(struct ahci_tbl));
     
-    uint64_t phys_buf = vmm_get_phys((uint64_t)buf);
+    uint64_t phys_buf = virt_to_phys(buf);
     
     cmdtbl->prdt_entry[0].dba = (uint32_t)(phys_buf & 0xFFFFFFFF);
     cmdtbl->prdt_entry[0].dbau = (uint32_t)((phys_buf >> 32) & 0xFFFFFFFF);
@@ -200,7 +200,7 @@ static int ahci_identify(struct ahci_device *adev, int port_no, uint64_t *capaci
      
     uint16_t *buf = (uint16_t*)kmalloc(512);
     memset(buf, 0, 512);
-    uint64_t phys_buf = vmm_get_phys((uint64_t)buf);
+    uint64_t phys_buf = virt_to_phys(buf);
     
     int slot = 0;  
     
@@ -268,6 +268,26 @@ struct ahci_port_priv {
 };
 
  
+static int ahci_bio_rw(hba_port_t *port, struct bio *bio) {
+    uint64_t sector = bio->sector;
+
+    for (int i = 0; i < bio->vc_cnt; i++) {
+        struct bio_vec *bv = &bio->io_vec[i];
+        uint16_t *buf = (uint16_t*)((char*)bv->page + bv->offset);
+        uint32_t count = bv->len / 512;
+        int ret;
+
+        if (bio->rw == WRITE) {
+            ret = ahci_write(port, (uint32_t)sector, (uint32_t)(sector >> 32), count, buf);
+        } else {
+            ret = ahci_read(port, (uint32_t)sector, (uint32_t)(sector >> 32), count, buf);
+        }
+        if (ret != 0) return -1;
+        sector += count;
+    }
+    return 0;
+}
+
 static void ahci_request(struct request_queue *q) {
     struct request *req;
     while ((req = elv_next_request(q)) != 0) {
@@ -284,21 +304,21 @@ static void ahci_request(struct request_queue *q) {
         
         hba_port_t *port = &adev->abar->ports[port_idx];
         
-        int ret = 0;
-        if (req->flags == WRITE) {
-            ret = ahci_write(port, req->sector, 0, req->nr_sectors, (uint16_t*)req->buffer);
-        } else {
-            ret = ahci_read(port, req->sector, 0, req->nr_sectors, (uint16_t*)req->buffer);
-        }
-        
-         
         spinlock_acquire(&q->lock);
         list_del(&req->queuelist);
         INIT_LIST_HEAD(&req->queuelist);
         spinlock_release(&q->lock);
         
+        struct bio *bio = req->bio;
+        while (bio) {
+            struct bio *next = bio->next;
+            if (ahci_bio_rw(port, bio) == 0) bio->flags |= BIO_UPTODATE;
+            if (bio->end_io) bio->end_io(bio);
+            bio = next;
+        }
+        
          
-        kfree(req); 
+        blk_put_request(req); 
     }
 }
 
@@ -307,7 +327,7 @@ static void port_rebase(hba_port_t *port, int port_no, struct ahci_device *adev)
 
     void *clb_virt = kmalloc(4096);
     adev->port_clb[port_no] = clb_virt;
-    uint64_t clb_phys = vmm_get_phys((uint64_t)clb_virt);
+    uint64_t clb_phys = virt_to_phys(clb_virt);
     
     port->clb = (uint32_t)(clb_phys & 0xFFFFFFFF);
     port->clbu = (uint32_t)(clb_phys >> 32);
@@ -315,7 +335,7 @@ static void port_rebase(hba_port_t *port, int port_no, struct ahci_device *adev)
 
     void *fb_virt = kmalloc(4096);
     adev->port_fb[port_no] = fb_virt;
-    uint64_t fb_phys = vmm_get_phys((uint64_t)fb_virt);
+    uint64_t fb_phys = virt_to_phys(fb_virt);
     
     port->fb = (uint32_t)(fb_phys & 0xFFFFFFFF);
     port->fbu = (uint32_t)(fb_phys >> 32);
@@ -327,7 +347,7 @@ static void port_rebase(hba_port_t *port, int port_no, struct ahci_device *adev)
         
         void *ctba_virt = kmalloc(4096);  
         adev->port_ctba[port_no][i] = ctba_virt;
-        uint64_t ctba_phys = vmm_get_phys((uint64_t)ctba_virt);
+        uint64_t ctba_phys = virt_to_phys(ctba_virt);
         
         hdr[i].ctba = (uint32_t)(ctba_phys & 0xFFFFFFFF);
         hdr[i].ctbau = (uint32_t)(ctba_phys >> 32);
@@ -350,8 +370,12 @@ static int ahci_probe(struct device *dev) {
     memset(adev, 0, sizeof(struct ahci_device));
     adev->pci_dev = pdev;
 
-    uint64_t abar_phys = (uint64_t)pdev->bar[5] & ~0xF;
-    adev->abar = (hba_mem_t*)ioremap(abar_phys, 0x1000); 
+    adev->abar = (hba_mem_t*)pci_iomap(pdev, 5, 0x1000); 
+    if (!adev->abar) {
+        kprint_str("AHCI: Failed to map ABAR\n");
+        kfree(adev);
+        return -1;
+    }
 
     adev->abar->ghc |= AHCI_GHC_AE;
     adev->abar->ghc |= AHCI_GHC_IE;  
@@ -4,12 +4,33 @@
 #include "console.h"
 #include "spinlock.h"
 #include "vfs.h"
+#include "slab.h"
 
 #define MAX_BLKDEV 255
 
 static char *blkdev_names[MAX_BLKDEV];
 static LIST_HEAD(gendisk_head);
 static spinlock_t gendisk_lock;
+static struct kmem_cache *request_cachep;
+static struct kmem_cache *bio_cachep;
+
+void blk_dev_init(void) {
+    spinlock_init(&gendisk_lock);
+    request_cachep = kmem_cache_create("request", sizeof(struct request), 0, SLAB_HWCACHE_ALIGN | SLAB_PANIC, 0);
+    bio_cachep = kmem_cache_create("bio", sizeof(struct bio), 0, SLAB_HWCACHE_ALIGN | SLAB_PANIC, 0);
+}
+
+struct bio *bio_alloc(void) {
+    struct bio *bio = (struct bio*)kmem_cache_alloc(bio_cachep, 0);
+    if (!bio) return 0;
+    memset(bio, 0, sizeof(struct bio));
+    return bio;
+}
+
+void bio_put(struct bio *bio) {
+    if (!bio) return;
+    kmem_cache_free(bio_cachep, bio);
+}
 
 int register_blkdev(unsigned int major, const char *name) {
     if (major >= MAX_BLKDEV) return -1;
@@ -113,7 +134,7 @@ void del_gendisk(struct gendisk *disk) {
 
 static struct request *blk_get_request(struct request_queue *q, int flags) {
     (void)q; (void)flags;
-    struct request *rq = (struct request*)kmalloc(sizeof(struct request));
+    struct request *rq = (struct request*)kmem_cache_alloc(request_cachep, 0);
     if (!rq) return 0;
     memset(rq, 0, sizeof(struct request));
     INIT_LIST_HEAD(&rq->queuelist);
@@ -121,6 +142,11 @@ static struct request *blk_get_request(struct request_queue *q, int flags) {
     return rq;
 }
 
+void blk_put_request(struct request *rq) {
+    if (!rq) return;
+    kmem_cache_free(request_cachep, rq);
+}
+
 static void __make_request(struct request_queue *q, struct bio *bio) {
     struct request *req;
 
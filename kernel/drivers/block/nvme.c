@@ -101,8 +101,8 @@ static int nvme_init_queue(struct nvme_ctrl *ctrl, struct nvme_queue *q, int id,
     memset(q->sq_cmds, 0, sq_size);
     memset(q->cq_es, 0, cq_size);
     
-    q->sq_dma = vmm_get_phys((uint64_t)q->sq_cmds);
-    q->cq_dma = vmm_get_phys((uint64_t)q->cq_es);
+    q->sq_dma = virt_to_phys(q->sq_cmds);
+    q->cq_dma = virt_to_phys(q->cq_es);
     
      
      
@@ -126,11 +126,15 @@ static int nvme_probe(struct pci_device *pdev) {
     ctrl->pdev = pdev;
     
      
-    uint64_t mmio_phys = (uint64_t)pdev->bar[0] & ~0xF;
     uint64_t mmio_len = 8192;  
     
-    ctrl->mmio_base = (uint64_t)ioremap(mmio_phys, mmio_len);
+    ctrl->mmio_base = (uint64_t)pci_iomap(pdev, 0, mmio_len);
     ctrl->mmio_len = mmio_len;
+    if (!ctrl->mmio_base) {
+        kprint_str("NVMe: Failed to map MMIO\n");
+        kfree(ctrl);
+        return -1;
+    }
     
      
     ctrl->cap = nvme_read64(ctrl, NVME_REG_CAP);
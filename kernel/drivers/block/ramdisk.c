@@ -1,6 +1,7 @@
 #include "drivers/ramdisk.h"
 #include "drivers/blockdev.h"
 #include "heap.h"
+#include "vmalloc.h"
 #include "string.h"
 #include "console.h"
 
@@ -47,24 +48,24 @@ static void ramdisk_make_request(struct request_queue *q, struct bio *bio) {
         addr += bv->len;
     }
     
+    bio->flags |= BIO_UPTODATE;
     if (bio->end_io) bio->end_io(bio);
 }
 
 struct gendisk *create_ramdisk(int minor, int size) {
-    char *data = (char*)kmalloc(size);
+    char *data = (char*)vzalloc(size);
     if (!data) return 0;
-    memset(data, 0, size);
     
     struct gendisk *disk = alloc_disk(1);
     if (!disk) {
-        kfree(data);
+        vfree(data);
         return 0;
     }
     
     struct request_queue *q = blk_init_queue(NULL, NULL); 
     if (!q) {
         kfree(disk);
-        kfree(data);
+        vfree(data);
         return 0;
     }
     blk_queue_make_request(q, ramdisk_make_request);
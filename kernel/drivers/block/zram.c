@@ -0,0 +1,326 @@
+#include "drivers/zram.h"
+#include "drivers/blockdev.h"
+#include "mm/zsmalloc.h"
+#include "lz4.h"
+#include "pmm.h"
+#include "heap.h"
+#include "vmalloc.h"
+#include "hrtimer.h"
+#include "string.h"
+#include "spinlock.h"
+#include "console.h"
+
+#define ZRAM_SECTOR_SIZE 512
+#define ZRAM_HUGE_SIZE (PAGE_SIZE * 3 / 4)
+
+#define ZRAM_ZERO 0x1
+#define ZRAM_HUGE 0x2
+
+struct zram_table_entry {
+    uint64_t handle;
+    uint32_t size;
+    uint32_t flags;
+};
+
+struct zram {
+    struct gendisk *disk;
+    struct zs_pool *pool;
+    struct zram_table_entry *table;
+    uint64_t nr_pages;
+    spinlock_t lock;
+    uint8_t *cbuf;
+    uint8_t *pbuf;
+    void *wrkmem;
+    struct zram_stats stats;
+};
+
+static int zram_page_is_zero(const void *buf) {
+    const uint64_t *p = (const uint64_t *)buf;
+    for (uint64_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+        if (p[i]) return 0;
+    }
+    return 1;
+}
+
+static void zram_free_page(struct zram *zram, uint64_t index) {
+    struct zram_table_entry *entry = &zram->table[index];
+
+    if (entry->flags & ZRAM_ZERO) {
+        zram->stats.zero_pages--;
+    } else if (entry->handle) {
+        zs_free(zram->pool, entry->handle);
+        zram->stats.compr_data_size -= entry->size;
+        if (entry->flags & ZRAM_HUGE) zram->stats.huge_pages--;
+    } else {
+        return;
+    }
+
+    zram->stats.pages_stored--;
+    zram->stats.orig_data_size -= PAGE_SIZE;
+    entry->handle = 0;
+    entry->size = 0;
+    entry->flags = 0;
+}
+
+static int zram_read_page(struct zram *zram, uint64_t index, uint8_t *dst) {
+    struct zram_table_entry *entry = &zram->table[index];
+
+    if ((entry->flags & ZRAM_ZERO) || !entry->handle) {
+        memset(dst, 0, PAGE_SIZE);
+        return 0;
+    }
+
+    int ret = 0;
+    uint8_t *src = (uint8_t *)zs_map_object(zram->pool, entry->handle, ZS_MM_RO);
+    if (entry->size == PAGE_SIZE) {
+        memcpy(dst, src, PAGE_SIZE);
+    } else {
+        ktime_t start = ktime_get_ns();
+        if (lz4_decompress(src, (int)entry->size, dst, PAGE_SIZE) != PAGE_SIZE) ret = -1;
+        zram->stats.decompress_ns += ktime_get_ns() - start;
+        zram->stats.decompressed_bytes += PAGE_SIZE;
+    }
+    zs_unmap_object(zram->pool, entry->handle);
+    return ret;
+}
+
+static int zram_write_page(struct zram *zram, uint64_t index, const uint8_t *src) {
+    if (zram_page_is_zero(src)) {
+        zram_free_page(zram, index);
+        zram->table[index].flags = ZRAM_ZERO;
+        zram->stats.zero_pages++;
+        zram->stats.pages_stored++;
+        zram->stats.orig_data_size += PAGE_SIZE;
+        return 0;
+    }
+
+    ktime_t start = ktime_get_ns();
+    int clen = lz4_compress(src, PAGE_SIZE, zram->cbuf, LZ4_COMPRESSBOUND(PAGE_SIZE), zram->wrkmem);
+    zram->stats.compress_ns += ktime_get_ns() - start;
+    zram->stats.compressed_bytes += PAGE_SIZE;
+
+    const uint8_t *data = zram->cbuf;
+    uint32_t flags = 0;
+    if (clen <= 0 || clen > ZRAM_HUGE_SIZE) {
+        clen = PAGE_SIZE;
+        data = src;
+        flags = ZRAM_HUGE;
+    }
+
+    uint64_t handle = zs_malloc(zram->pool, (size_t)clen);
+    if (!handle) return -1;
+
+    uint8_t *dst = (uint8_t *)zs_map_object(zram->pool, handle, ZS_MM_WO);
+    memcpy(dst, data, (size_t)clen);
+    zs_unmap_object(zram->pool, handle);
+
+    zram_free_page(zram, index);
+    struct zram_table_entry *entry = &zram->table[index];
+    entry->handle = handle;
+    entry->size = (uint32_t)clen;
+    entry->flags = flags;
+
+    if (flags & ZRAM_HUGE) zram->stats.huge_pages++;
+    zram->stats.pages_stored++;
+    zram->stats.orig_data_size += PAGE_SIZE;
+    zram->stats.compr_data_size += (uint64_t)clen;
+    return 0;
+}
+
+static int zram_bvec_rw(struct zram *zram, int rw, uint64_t index, uint32_t offset, uint8_t *buf, uint32_t len) {
+    if (rw == WRITE) {
+        zram->stats.num_writes++;
+        if (len == PAGE_SIZE) return zram_write_page(zram, index, buf);
+
+        if (zram_read_page(zram, index, zram->pbuf) != 0) return -1;
+        memcpy(zram->pbuf + offset, buf, len);
+        return zram_write_page(zram, index, zram->pbuf);
+    }
+
+    zram->stats.num_reads++;
+    if (len == PAGE_SIZE) return zram_read_page(zram, index, buf);
+
+    if (zram_read_page(zram, index, zram->pbuf) != 0) return -1;
+    memcpy(buf, zram->pbuf + offset, len);
+    return 0;
+}
+
+static void zram_make_request(struct request_queue *q, struct bio *bio) {
+    (void)q;
+
+    struct gendisk *disk = bio->disk;
+    if (!disk) {
+        if (bio->end_io) bio->end_io(bio);
+        return;
+    }
+
+    struct zram *zram = (struct zram *)disk->private_data;
+    uint64_t pos = bio->sector * ZRAM_SECTOR_SIZE;
+
+    if (pos + bio->size > disk->capacity * ZRAM_SECTOR_SIZE) {
+        zram->stats.invalid_io++;
+        kprint_str("[Zram] Error: Out of bounds\n");
+        if (bio->end_io) bio->end_io(bio);
+        return;
+    }
+
+    int err = 0;
+    spinlock_acquire(&zram->lock);
+    for (int i = 0; i < bio->vc_cnt && !err; i++) {
+        struct bio_vec *bv = &bio->io_vec[i];
+        uint8_t *buf = (uint8_t *)bv->page + bv->offset;
+        uint32_t left = bv->len;
+
+        while (left) {
+            uint64_t index = pos / PAGE_SIZE;
+            uint32_t offset = (uint32_t)(pos % PAGE_SIZE);
+            uint32_t len = PAGE_SIZE - offset;
+            if (len > left) len = left;
+
+            if (zram_bvec_rw(zram, bio->rw, index, offset, buf, len) != 0) {
+                if (bio->rw == WRITE) zram->stats.failed_writes++;
+                else zram->stats.failed_reads++;
+                err = 1;
+                break;
+            }
+
+            pos += len;
+            buf += len;
+            left -= len;
+        }
+    }
+    zram->stats.mem_used = zs_get_total_pages(zram->pool) * PAGE_SIZE;
+    spinlock_release(&zram->lock);
+
+    if (!err) bio->flags |= BIO_UPTODATE;
+    if (bio->end_io) bio->end_io(bio);
+}
+
+static void zram_destroy(struct zram *zram) {
+    if (zram->pool) zs_destroy_pool(zram->pool);
+    if (zram->table) vfree(zram->table);
+    if (zram->cbuf) kfree(zram->cbuf);
+    if (zram->pbuf) kfree(zram->pbuf);
+    if (zram->wrkmem) kfree(zram->wrkmem);
+    kfree(zram);
+}
+
+struct gendisk *create_zram(int minor, uint64_t size) {
+    size &= ~(uint64_t)(PAGE_SIZE - 1);
+    if (!size) return 0;
+
+    struct zram *zram = (struct zram *)kmalloc(sizeof(struct zram));
+    if (!zram) return 0;
+    memset(zram, 0, sizeof(struct zram));
+
+    zram->nr_pages = size / PAGE_SIZE;
+    zram->table = (struct zram_table_entry *)vzalloc(zram->nr_pages * sizeof(struct zram_table_entry));
+    zram->cbuf = (uint8_t *)kmalloc(LZ4_COMPRESSBOUND(PAGE_SIZE));
+    zram->pbuf = (uint8_t *)kmalloc(PAGE_SIZE);
+    zram->wrkmem = kmalloc(LZ4_MEM_COMPRESS);
+    zram->pool = zs_create_pool("zram");
+    if (!zram->table || !zram->cbuf || !zram->pbuf || !zram->wrkmem || !zram->pool) {
+        zram_destroy(zram);
+        return 0;
+    }
+    spinlock_init(&zram->lock);
+
+    struct gendisk *disk = alloc_disk(1);
+    if (!disk) {
+        zram_destroy(zram);
+        return 0;
+    }
+
+    struct request_queue *q = blk_init_queue(NULL, NULL);
+    if (!q) {
+        kfree(disk);
+        zram_destroy(zram);
+        return 0;
+    }
+    blk_queue_make_request(q, zram_make_request);
+
+    disk->major = ZRAM_MAJOR;
+    disk->first_minor = minor;
+    disk->fops = NULL;
+    disk->queue = q;
+    disk->private_data = zram;
+    disk->capacity = size / ZRAM_SECTOR_SIZE;
+    zram->disk = disk;
+
+    const char *prefix = "zram";
+    int i = 0;
+    while (prefix[i]) { disk->disk_name[i] = prefix[i]; i++; }
+    if (minor < 10) disk->disk_name[i++] = '0' + minor;
+    disk->disk_name[i] = 0;
+
+    return disk;
+}
+
+void zram_get_stats(struct gendisk *disk, struct zram_stats *stats) {
+    if (!disk || disk->major != ZRAM_MAJOR || !stats) return;
+
+    struct zram *zram = (struct zram *)disk->private_data;
+    spinlock_acquire(&zram->lock);
+    *stats = zram->stats;
+    stats->mem_used = zs_get_total_pages(zram->pool) * PAGE_SIZE;
+    spinlock_release(&zram->lock);
+}
+
+static uint64_t zram_mbps(uint64_t bytes, uint64_t ns) {
+    return ns ? bytes * 1000 / ns : 0;
+}
+
+void zram_dump_stats(struct gendisk *disk) {
+    struct zram_stats stats;
+    if (!disk || disk->major != ZRAM_MAJOR) return;
+    zram_get_stats(disk, &stats);
+
+    kprint_str("[Zram] ");
+    kprint_str(disk->disk_name);
+    kprint_str(": orig ");
+    kprint_dec(stats.orig_data_size / 1024);
+    kprint_str(" KB compr ");
+    kprint_dec(stats.compr_data_size / 1024);
+    kprint_str(" KB mem ");
+    kprint_dec(stats.mem_used / 1024);
+    kprint_str(" KB ratio ");
+    kprint_dec(stats.mem_used ? stats.orig_data_size * 100 / stats.mem_used : 0);
+    kprint_str("%\n");
+
+    kprint_str("[Zram] pages ");
+    kprint_dec(stats.pages_stored);
+    kprint_str(" zero ");
+    kprint_dec(stats.zero_pages);
+    kprint_str(" huge ");
+    kprint_dec(stats.huge_pages);
+    kprint_str(" reads ");
+    kprint_dec(stats.num_reads);
+    kprint_str(" writes ");
+    kprint_dec(stats.num_writes);
+    kprint_str(" failed ");
+    kprint_dec(stats.failed_reads + stats.failed_writes);
+    kprint_str(" invalid ");
+    kprint_dec(stats.invalid_io);
+    kprint_newline();
+
+    kprint_str("[Zram] compress ");
+    kprint_dec(zram_mbps(stats.compressed_bytes, stats.compress_ns));
+    kprint_str(" MB/s decompress ");
+    kprint_dec(zram_mbps(stats.decompressed_bytes, stats.decompress_ns));
+    kprint_str(" MB/s\n");
+}
+
+void zram_init(void) {
+    if (register_blkdev(ZRAM_MAJOR, "zram") < 0) {
+        kprint_str("[Zram] Failed to register blkdev\n");
+        return;
+    }
+
+    struct gendisk *disk = create_zram(0, ZRAM_DEFAULT_SIZE);
+    if (disk) {
+        add_disk(disk);
+        kprint_str("[Zram] Initialized ");
+        kprint_dec(ZRAM_DEFAULT_SIZE / 1024 / 1024);
+        kprint_str("MB compressed disk\n");
+    }
+}
@@ -2,6 +2,7 @@
 #include "console.h"
 #include "heap.h"
 #include "string.h"
+#include "vmm.h"
 
 static inline void outl(uint16_t port, uint32_t val) {
     __asm__ volatile ( "outl %0, %1" : : "a"(val), "Nd"(port) );
@@ -160,6 +161,27 @@ int pci_enable_device(struct pci_device *dev) {
     return 0;
 }
 
+uint64_t pci_bar_start(struct pci_device *dev, int bar) {
+    if (bar < 0 || bar >= 6) return 0;
+
+    uint32_t val = dev->bar[bar];
+    if (val & PCI_BASE_ADDRESS_SPACE_IO) return 0;
+
+    uint64_t start = val & PCI_BASE_ADDRESS_MEM_MASK;
+    if ((val & PCI_BASE_ADDRESS_MEM_TYPE_MASK) == PCI_BASE_ADDRESS_MEM_TYPE_64 && bar < 5) {
+        start |= (uint64_t)dev->bar[bar + 1] << 32;
+    }
+    return start;
+}
+
+void *pci_iomap(struct pci_device *dev, int bar, uint64_t size) {
+    uint64_t start = pci_bar_start(dev, bar);
+    if (!start) return 0;
+
+    if (dev->bar[bar] & PCI_BASE_ADDRESS_MEM_PREFETCH) return ioremap_wc(start, size);
+    return ioremap(start, size);
+}
+
 void pci_scan_bus() {
     kprint_str("[PCI] Scanning bus...\n");
     for (uint16_t bus = 0; bus < 256; bus++) {
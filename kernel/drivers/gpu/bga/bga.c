@@ -103,9 +103,9 @@ static int bga_load(struct drm_device *dev, unsigned long flags) {
     bga->fb.pitch = 1024 * 4;
     bga->fb.dev = dev;
  
-    bga->fb_phys = (uint64_t)bga->pdev->bar[0] & ~0xF;
+    bga->fb_phys = pci_bar_start(bga->pdev, 0);
     bga->fb_size = 16 * 1024 * 1024;  
-    bga->fb_virt = (uint64_t)ioremap(bga->fb_phys, bga->fb_size);
+    bga->fb_virt = (uint64_t)ioremap_wc(bga->fb_phys, bga->fb_size);
     
     bga->fb.paddr = bga->fb_phys;
     bga->fb.vaddr = (void*)bga->fb_virt;
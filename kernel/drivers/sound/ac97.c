@@ -92,11 +92,11 @@ static int ac97_probe(struct device *dev) {
     
     chip->bdl = (struct ac97_bd*)kmalloc(4096);
     memset(chip->bdl, 0, 4096);
-    chip->bdl_phys = vmm_get_phys((uint64_t)chip->bdl);
+    chip->bdl_phys = virt_to_phys(chip->bdl);
     
     chip->dma_buffer = (void*)kmalloc(65536);
     memset(chip->dma_buffer, 0, 65536);
-    chip->dma_phys = vmm_get_phys((uint64_t)chip->dma_buffer);
+    chip->dma_phys = virt_to_phys(chip->dma_buffer);
     
     struct snd_pcm *pcm;
     snd_pcm_new(card, "AC97 PCM", 0, 1, 0, &pcm);
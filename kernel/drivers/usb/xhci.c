@@ -43,27 +43,27 @@ static void xhci_init_memory(struct xhci_host *xhci) {
      
     xhci->dcbaa = (uint64_t*)kmalloc(2048);  
     memset(xhci->dcbaa, 0, 2048);
-    xhci->dcbaa_phys = vmm_get_phys((uint64_t)xhci->dcbaa);
+    xhci->dcbaa_phys = virt_to_phys(xhci->dcbaa);
     
     xhci_write64(xhci, xhci->op_base + XHCI_DCBAAP, xhci->dcbaa_phys);
     
      
     xhci->cmd_ring = (struct xhci_trb*)kmalloc(4096);
     memset(xhci->cmd_ring, 0, 4096);
-    xhci->cmd_ring_phys = vmm_get_phys((uint64_t)xhci->cmd_ring);
+    xhci->cmd_ring_phys = virt_to_phys(xhci->cmd_ring);
     
     xhci_write64(xhci, xhci->op_base + XHCI_CRCR, xhci->cmd_ring_phys | 1);  
     
      
     xhci->event_ring = (struct xhci_trb*)kmalloc(4096);
     memset(xhci->event_ring, 0, 4096);
-    xhci->event_ring_phys = vmm_get_phys((uint64_t)xhci->event_ring);
+    xhci->event_ring_phys = virt_to_phys(xhci->event_ring);
     
      
     xhci->erst = (struct xhci_erst_entry*)kmalloc(sizeof(struct xhci_erst_entry));
     xhci->erst->base = xhci->event_ring_phys;
     xhci->erst->size = 4096 / 16;  
-    xhci->erst_phys = vmm_get_phys((uint64_t)xhci->erst);
+    xhci->erst_phys = virt_to_phys(xhci->erst);
     
     xhci_write32(xhci, xhci->rt_base + XHCI_ERSTSZ(0), 1);
     xhci_write64(xhci, xhci->rt_base + XHCI_ERSTBA(0), xhci->erst_phys);
@@ -196,8 +196,13 @@ static int xhci_probe(struct device *dev) {
     xhci_host->pdev = pdev;
     
      
-    uint64_t mmio_phys = (uint64_t)pdev->bar[0] & ~0xF;
-    xhci_host->mmio_base = (uint64_t)ioremap(mmio_phys, 0x10000);  
+    xhci_host->mmio_base = (uint64_t)pci_iomap(pdev, 0, 0x10000);  
+    if (!xhci_host->mmio_base) {
+        kprint_str("XHCI: Failed to map MMIO\n");
+        kfree(xhci_host);
+        xhci_host = 0;
+        return -1;
+    }
     
     xhci_host->cap_base = xhci_host->mmio_base;
     xhci_host->cap_len = *((uint8_t*)xhci_host->cap_base);
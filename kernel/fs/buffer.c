@@ -3,6 +3,7 @@
 #include "string.h"
 #include "console.h"
 #include "spinlock.h"
+#include "slab.h"
 
 #define BH_HASH_BITS 10
 #define BH_HASH_SIZE (1 << BH_HASH_BITS)
@@ -12,9 +13,11 @@
 static struct buffer_head *bh_hash[BH_HASH_SIZE];
 static spinlock_t bh_hash_lock;
 static int buffer_cache_count = 0;
+static struct kmem_cache *bh_cachep;
 
 void buffer_init(void) {
     spinlock_init(&bh_hash_lock);
+    bh_cachep = kmem_cache_create("buffer_head", sizeof(struct buffer_head), 0, SLAB_HWCACHE_ALIGN | SLAB_PANIC, 0);
     memset(bh_hash, 0, sizeof(bh_hash));
     kprint_str("[VFS] Buffer Cache Initialized\n");
 }
@@ -45,13 +48,13 @@ static struct buffer_head *__find_get_block(struct gendisk *bdev, uint64_t block
 
  
 static struct buffer_head *alloc_buffer_head(struct gendisk *bdev, uint64_t block, uint32_t size) {
-    struct buffer_head *bh = (struct buffer_head*)kmalloc(sizeof(struct buffer_head));
+    struct buffer_head *bh = (struct buffer_head*)kmem_cache_alloc(bh_cachep, 0);
     if (!bh) return 0;
     
     memset(bh, 0, sizeof(struct buffer_head));
     bh->b_data = (char*)kmalloc(size);
     if (!bh->b_data) {
-        kfree(bh);
+        kmem_cache_free(bh_cachep, bh);
         return 0;
     }
     memset(bh->b_data, 0, size);
@@ -87,7 +90,7 @@ struct buffer_head *getblk(struct gendisk *bdev, uint64_t block, uint32_t size)
             exist->b_count++;
             spinlock_release(&bh_hash_lock);
             kfree(bh->b_data);
-            kfree(bh);
+            kmem_cache_free(bh_cachep, bh);
             return exist;
         }
         exist = exist->b_next_hash;
@@ -116,7 +119,7 @@ void brelse(struct buffer_head *bh) {
             if (bh->b_pprev_hash) *bh->b_pprev_hash = bh->b_next_hash;
             
             kfree(bh->b_data);
-            kfree(bh);
+            kmem_cache_free(bh_cachep, bh);
             buffer_cache_count--;
         }
     }
@@ -126,7 +129,7 @@ void brelse(struct buffer_head *bh) {
 static void end_buffer_io_async(struct bio *bio) {
     struct buffer_head *bh = (struct buffer_head *)bio->private_data;
     
-    if (bio->flags & 1) {  
+    if (bio->flags & BIO_UPTODATE) {  
         set_buffer_uptodate(bh);
     } else {
          
@@ -136,7 +139,7 @@ static void end_buffer_io_async(struct bio *bio) {
     if (bio->io_vec) {
         kfree(bio->io_vec);
     }
-    kfree(bio);  
+    bio_put(bio);  
 }
 
 void ll_rw_block(int rw, int nr, struct buffer_head *bhs[]) {
@@ -149,12 +152,11 @@ void ll_rw_block(int rw, int nr, struct buffer_head *bhs[]) {
         
         lock_buffer(bh);
         
-        struct bio *bio = (struct bio*)kmalloc(sizeof(struct bio));
+        struct bio *bio = bio_alloc();
         if (!bio) {
             unlock_buffer(bh);
             continue;
         }
-        memset(bio, 0, sizeof(struct bio));
         
         bio->sector = bh->b_blocknr * (bh->b_size / 512);  
         bio->size = bh->b_size;
@@ -173,7 +175,7 @@ void ll_rw_block(int rw, int nr, struct buffer_head *bhs[]) {
              bio->idx = 0;
         } else {
               
-             kfree(bio);
+             bio_put(bio);
              unlock_buffer(bh);
              continue;
         }
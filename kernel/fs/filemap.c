@@ -5,6 +5,9 @@
 #include "string.h"
 #include "console.h"
 #include "pmm.h"
+#include "vmm.h"
+#include "radix-tree.h"
+#include "mm/vmscan.h"
 
 int generic_file_read(struct file *filp, char *buf, int count, uint64_t *ppos) {
     struct inode *inode = filp->f_dentry->d_inode;
@@ -23,20 +26,11 @@ int generic_file_read(struct file *filp, char *buf, int count, uint64_t *ppos) {
         
         struct page *page = find_get_page(mapping, page_index);
         if (!page) {
-            void *phys = pmm_alloc_page();
-            if (!phys) return -1;
-            
-            page = (struct page*)kmalloc(sizeof(struct page));
-            if (!page) {
-                pmm_free_page(phys);
-                return -1;
-            }
-            memset(page, 0, sizeof(struct page));
-            page->virtual = (void*)((uint64_t)phys);
+            page = alloc_page(0);
+            if (!page) return -1;
             
             if (add_to_page_cache(page, mapping, page_index, 0) != 0) {
-                kfree(page);
-                pmm_free_page(phys);
+                __free_page(page);
                 page = find_get_page(mapping, page_index);
                 if (!page) return -1;
             } else {
@@ -54,6 +48,7 @@ int generic_file_read(struct file *filp, char *buf, int count, uint64_t *ppos) {
         char *src = (char*)page->virtual + offset;
         memcpy(buf + read, src, bytes);
         
+        mark_page_accessed(page);
         put_page(page);
         
         read += bytes;
@@ -83,20 +78,11 @@ int generic_file_write(struct file *filp, const char *buf, int count, uint64_t *
         
         struct page *page = find_get_page(mapping, page_index);
         if (!page) {
-            void *phys = pmm_alloc_page();
-            if (!phys) return -1;
-            
-            page = (struct page*)kmalloc(sizeof(struct page));
-            if (!page) {
-                pmm_free_page(phys);
-                return -1;
-            }
-            memset(page, 0, sizeof(struct page));
-            page->virtual = (void*)((uint64_t)phys);
+            page = alloc_page(0);
+            if (!page) return -1;
             
             if (add_to_page_cache(page, mapping, page_index, 0) != 0) {
-                kfree(page);
-                pmm_free_page(phys);
+                __free_page(page);
                 page = find_get_page(mapping, page_index);
                 if (!page) return -1;
             } else {
@@ -113,11 +99,12 @@ int generic_file_write(struct file *filp, const char *buf, int count, uint64_t *
         char *dst = (char*)page->virtual + offset;
         memcpy(dst, buf + written, bytes);
         
-        SetPageDirty(page);
+        set_page_dirty(page);
         if (pos + bytes > inode->i_size) {
             inode->i_size = pos + bytes;
         }
         
+        mark_page_accessed(page);
         put_page(page);
         
         written += bytes;
@@ -128,3 +115,79 @@ int generic_file_write(struct file *filp, const char *buf, int count, uint64_t *
     *ppos = pos;
     return written;
 }
+
+struct address_space *filemap_mapping(struct inode *inode) {
+    if (!inode->i_mapping) {
+        struct address_space *mapping = &inode->i_data;
+        mapping->host = inode;
+        radix_tree_init(&mapping->page_tree);
+        spinlock_init(&mapping->lock);
+        mapping->a_ops = 0;
+        mapping->flags = 0;
+        mapping->nrpages = 0;
+        INIT_LIST_HEAD(&mapping->i_mmap);
+        spinlock_init(&mapping->i_mmap_lock);
+        inode->i_mapping = mapping;
+    }
+    return inode->i_mapping;
+}
+
+struct page *filemap_fault(struct file *filp, unsigned long index) {
+    struct inode *inode = filp->f_dentry->d_inode;
+    struct address_space *mapping = filemap_mapping(inode);
+
+    struct page *page = find_get_page(mapping, index);
+    if (page) {
+        mark_page_accessed(page);
+        return page;
+    }
+
+    page = alloc_page(0);
+    if (!page) return 0;
+
+    int ret = 0;
+    if (mapping->a_ops && mapping->a_ops->readpage) {
+        ret = mapping->a_ops->readpage(filp, page);
+    } else if (filp->f_op && filp->f_op->read) {
+        uint64_t pos = (uint64_t)index << 12;
+        ret = filp->f_op->read(filp, (char*)page->virtual, 4096, &pos);
+        if (ret >= 0) {
+            memset((char*)page->virtual + ret, 0, 4096 - ret);
+            ret = 0;
+        }
+    } else {
+        memset(page->virtual, 0, 4096);
+    }
+
+    if (ret != 0) {
+        __free_page(page);
+        return 0;
+    }
+
+    SetPageUptodate(page);
+    if (add_to_page_cache(page, mapping, index, 0) != 0) {
+        __free_page(page);
+        return find_get_page(mapping, index);
+    }
+
+    return page;
+}
+
+int filemap_fdatawrite(struct address_space *mapping) {
+    struct page *pages[PAGEVEC_SIZE];
+    unsigned long index = 0;
+    int ret = 0;
+
+    if (!mapping || !radix_tree_tagged(&mapping->page_tree, PAGECACHE_TAG_DIRTY)) return 0;
+
+    while (1) {
+        unsigned int nr = find_get_pages_tag(mapping, &index, PAGECACHE_TAG_DIRTY, PAGEVEC_SIZE, pages);
+        if (!nr) break;
+
+        for (unsigned int i = 0; i < nr; i++) {
+            if (PageDirty(pages[i]) && write_one_page(pages[i]) != 0) ret = -1;
+            put_page(pages[i]);
+        }
+    }
+    return ret;
+}
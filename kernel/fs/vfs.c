@@ -4,6 +4,7 @@
 #include "console.h"
 #include "process.h"  
 #include "list.h"
+#include "slab.h"
 
 static struct file_system_type *file_systems = 0;
 static LIST_HEAD(super_blocks);
@@ -13,6 +14,7 @@ static spinlock_t super_blocks_lock;
 #define DENTRY_HASH_SIZE 1024
 static struct list_head dentry_hashtable[DENTRY_HASH_SIZE];
 static spinlock_t dcache_lock;
+static struct kmem_cache *dentry_cachep;
 
 struct vfsmount *root_mnt = 0;
 struct dentry *root_dentry = 0;
@@ -54,7 +56,7 @@ static unsigned int d_hash(struct dentry *parent, const char *name) {
 }
 
 struct dentry *alloc_dentry(struct dentry *parent, const char *name) {
-    struct dentry *dentry = (struct dentry *)kmalloc(sizeof(struct dentry));
+    struct dentry *dentry = (struct dentry *)kmem_cache_alloc(dentry_cachep, 0);
     if (!dentry) return 0;
     
     memset(dentry, 0, sizeof(struct dentry));
@@ -64,7 +66,7 @@ struct dentry *alloc_dentry(struct dentry *parent, const char *name) {
     int len = strlen(name);
     char *name_copy = (char *)kmalloc(len + 1);
     if (!name_copy) {
-        kfree(dentry);
+        kmem_cache_free(dentry_cachep, dentry);
         return 0;
     }
     memcpy(name_copy, name, len);
@@ -91,6 +93,17 @@ struct dentry *alloc_dentry(struct dentry *parent, const char *name) {
     return dentry;
 }
 
+static void d_free(struct dentry *dentry) {
+    struct dentry *parent = dentry->d_parent;
+    if (parent) {
+        spinlock_acquire(&parent->d_lock);
+        list_del(&dentry->d_child);
+        spinlock_release(&parent->d_lock);
+    }
+    kfree((void *)dentry->d_name.name);
+    kmem_cache_free(dentry_cachep, dentry);
+}
+
 void d_add(struct dentry *entry, struct inode *inode) {
     if (inode) {
         spinlock_acquire(&inode->i_lock);
@@ -263,7 +276,7 @@ int path_walk(const char *name, struct nameidata *nd) {
             struct dentry *res = dentry->d_inode->i_op->lookup(dentry->d_inode, new_dentry);
             if (res) {
                  
-                kfree(new_dentry);
+                d_free(new_dentry);
                 child = res;
             } else {
                  
@@ -434,24 +447,29 @@ int vfs_close(int fd) {
     if (!f) return -1;
     
     current_process->fd_table[fd] = 0;
-
-    if (f->f_op && f->f_op->release) {
-        f->f_op->release(f->f_dentry->d_inode, f);
-    }
-    
-    f->f_count--;
-    if (f->f_count <= 0) {
-        kprint_str("DEBUG: freeing file ptr=");
-        kprint_hex((uint64_t)f);
-        kprint_str("\n");
-        kfree(f);
-        kprint_str("DEBUG: freed file\n");
-    }
+    fput(f);
     
     kprint_str("DEBUG: vfs_close exit\n");
     return 0;
 }
 
+struct file *fget(int fd) {
+    if (fd < 0 || fd >= MAX_FILES) return 0;
+    struct file *f = current_process->fd_table[fd];
+    if (f) f->f_count++;
+    return f;
+}
+
+void fput(struct file *file) {
+    file->f_count--;
+    if (file->f_count <= 0) {
+        if (file->f_op && file->f_op->release) {
+            file->f_op->release(file->f_dentry ? file->f_dentry->d_inode : 0, file);
+        }
+        kfree(file);
+    }
+}
+
 int vfs_read(int fd, char *buf, int count) {
     if (fd < 0 || fd >= MAX_FILES) return -1;
     struct file *f = current_process->fd_table[fd];
@@ -608,6 +626,8 @@ void vfs_init() {
     spinlock_init(&super_blocks_lock);
     spinlock_init(&dcache_lock);
     spinlock_init(&vfsmount_lock);
+
+    dentry_cachep = kmem_cache_create("dentry", sizeof(struct dentry), 0, SLAB_HWCACHE_ALIGN | SLAB_PANIC, 0);
     
     for(int i=0; i<DENTRY_HASH_SIZE; i++) {
         INIT_LIST_HEAD(&dentry_hashtable[i]);
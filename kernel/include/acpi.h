@@ -0,0 +1,89 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+
+struct acpi_rsdp {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed));
+
+struct acpi_sdt_header {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+#define ACPI_SRAT_TYPE_CPU_AFFINITY 0
+#define ACPI_SRAT_TYPE_MEMORY_AFFINITY 1
+#define ACPI_SRAT_TYPE_X2APIC_CPU_AFFINITY 2
+
+#define ACPI_SRAT_CPU_ENABLED 0x1
+#define ACPI_SRAT_MEM_ENABLED 0x1
+#define ACPI_SRAT_MEM_HOT_PLUGGABLE 0x2
+
+struct acpi_table_srat {
+    struct acpi_sdt_header header;
+    uint32_t table_revision;
+    uint64_t reserved;
+} __attribute__((packed));
+
+struct acpi_subtable_header {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed));
+
+struct acpi_srat_cpu_affinity {
+    struct acpi_subtable_header header;
+    uint8_t proximity_domain_lo;
+    uint8_t apic_id;
+    uint32_t flags;
+    uint8_t local_sapic_eid;
+    uint8_t proximity_domain_hi[3];
+    uint32_t clock_domain;
+} __attribute__((packed));
+
+struct acpi_srat_mem_affinity {
+    struct acpi_subtable_header header;
+    uint32_t proximity_domain;
+    uint16_t reserved;
+    uint64_t base_address;
+    uint64_t length;
+    uint32_t reserved1;
+    uint32_t flags;
+    uint64_t reserved2;
+} __attribute__((packed));
+
+struct acpi_srat_x2apic_cpu_affinity {
+    struct acpi_subtable_header header;
+    uint16_t reserved;
+    uint32_t proximity_domain;
+    uint32_t apic_id;
+    uint32_t flags;
+    uint32_t clock_domain;
+    uint32_t reserved2;
+} __attribute__((packed));
+
+struct acpi_table_slit {
+    struct acpi_sdt_header header;
+    uint64_t locality_count;
+    uint8_t entry[];
+} __attribute__((packed));
+
+int acpi_init(uint64_t multiboot_addr, uint64_t magic);
+struct acpi_sdt_header* acpi_find_table(const char* signature);
+
+#endif
@@ -8,6 +8,8 @@
 #define READ 0
 #define WRITE 1
 
+#define BIO_UPTODATE 0x1
+
 #define ELEVATOR_INSERT_BACK  0
 #define ELEVATOR_INSERT_FRONT 1
 #define ELEVATOR_INSERT_SORT  2
@@ -98,6 +100,11 @@ struct gendisk {
     struct list_head list;
 };
 
+void blk_dev_init(void);
+struct bio *bio_alloc(void);
+void bio_put(struct bio *bio);
+void blk_put_request(struct request *rq);
+
 int register_blkdev(unsigned int major, const char *name);
 void unregister_blkdev(unsigned int major, const char *name);
 struct gendisk *alloc_disk(int minors);
@@ -53,6 +53,15 @@ void pci_write_word(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uin
 #define PCI_COMMAND_MASTER  0x4
 #define PCI_COMMAND_MEMORY  0x2
 
+#define PCI_BASE_ADDRESS_SPACE_IO      0x1
+#define PCI_BASE_ADDRESS_MEM_TYPE_MASK 0x6
+#define PCI_BASE_ADDRESS_MEM_TYPE_64   0x4
+#define PCI_BASE_ADDRESS_MEM_PREFETCH  0x8
+#define PCI_BASE_ADDRESS_MEM_MASK      (~0xFULL)
+
+uint64_t pci_bar_start(struct pci_device *dev, int bar);
+void *pci_iomap(struct pci_device *dev, int bar, uint64_t size);
+
 #define to_pci_device(d) container_of(d, struct pci_device, dev)
 #define to_pci_driver(d) container_of(d, struct pci_driver, driver)
 
@@ -0,0 +1,32 @@
+#ifndef ZRAM_H
+#define ZRAM_H
+
+#include "drivers/blockdev.h"
+
+#define ZRAM_MAJOR 252
+#define ZRAM_DEFAULT_SIZE (16 * 1024 * 1024)
+
+struct zram_stats {
+    uint64_t num_reads;
+    uint64_t num_writes;
+    uint64_t failed_reads;
+    uint64_t failed_writes;
+    uint64_t invalid_io;
+    uint64_t pages_stored;
+    uint64_t zero_pages;
+    uint64_t huge_pages;
+    uint64_t orig_data_size;
+    uint64_t compr_data_size;
+    uint64_t mem_used;
+    uint64_t compressed_bytes;
+    uint64_t compress_ns;
+    uint64_t decompressed_bytes;
+    uint64_t decompress_ns;
+};
+
+void zram_init(void);
+struct gendisk *create_zram(int minor, uint64_t size);
+void zram_get_stats(struct gendisk *disk, struct zram_stats *stats);
+void zram_dump_stats(struct gendisk *disk);
+
+#endif
@@ -4,9 +4,16 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#define HEAP_RESERVE_SIZE (1ULL << 30)
+
 void heap_init(uint64_t start_virt, uint64_t size);
+uint64_t heap_shrink();
 void* kmalloc(size_t size);
 void kfree(void* ptr);
 void heap_dump_stats();
 
+#ifdef HEAP_DEBUG
+void heap_self_test();
+#endif
+
 #endif
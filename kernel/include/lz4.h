@@ -0,0 +1,18 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stdint.h>
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MF_LIMIT 12
+#define LZ4_MAX_DISTANCE 65535
+#define LZ4_HASH_LOG 12
+
+#define LZ4_COMPRESSBOUND(size) ((size) + (size) / 255 + 16)
+#define LZ4_MEM_COMPRESS ((1 << LZ4_HASH_LOG) * sizeof(uint32_t))
+
+int lz4_compress(const uint8_t *src, int src_len, uint8_t *dst, int dst_cap, void *wrkmem);
+int lz4_decompress(const uint8_t *src, int src_len, uint8_t *dst, int dst_cap);
+
+#endif
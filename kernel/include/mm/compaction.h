@@ -0,0 +1,37 @@
+#ifndef COMPACTION_H
+#define COMPACTION_H
+
+#include <stdint.h>
+
+#define COMPACT_DIRECT_MAX_ORDER 4
+#define COMPACT_PROACTIVE_ORDER 4
+#define COMPACT_PROACTIVE_BLOCKS 8
+#define COMPACT_MAX_DEFER_SHIFT 6
+
+#define KCOMPACTD_SLEEP_TICKS 5000
+
+#define COMPACT_BUSY -1
+#define COMPACT_FAIL 0
+#define COMPACT_SUCCESS 1
+
+struct compact_stats {
+    uint64_t migrate_scanned;
+    uint64_t blocks_skipped;
+    uint64_t pages_migrated;
+    uint64_t migrate_failed;
+    uint64_t compact_stall;
+    uint64_t compact_success;
+    uint64_t compact_fail;
+    uint64_t compact_deferred;
+    uint64_t kcompactd_runs;
+};
+
+int compact_node(int nid, unsigned int order);
+int try_to_compact_pages(int nid, unsigned int order);
+void wakeup_kcompactd(unsigned int order);
+
+void kcompactd_init(void);
+void compaction_get_stats(struct compact_stats *stats);
+void compaction_dump_stats(void);
+
+#endif
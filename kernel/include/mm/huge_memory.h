@@ -0,0 +1,33 @@
+#ifndef HUGE_MEMORY_H
+#define HUGE_MEMORY_H
+
+#include <stdint.h>
+#include "mm/mmap.h"
+
+#define HPAGE_PMD_ORDER 9
+#define HPAGE_PMD_NR (1ULL << HPAGE_PMD_ORDER)
+
+#define KHUGEPAGED_PAGES_TO_SCAN 4096
+#define KHUGEPAGED_MAX_PTES_NONE 64
+#define KHUGEPAGED_SLEEP_TICKS 10000
+#define KHUGEPAGED_ALLOC_SLEEP_TICKS 60000
+
+struct thp_stats {
+    uint64_t fault_alloc;
+    uint64_t fault_fallback;
+    uint64_t split;
+    uint64_t collapse_alloc;
+    uint64_t collapse_alloc_failed;
+    uint64_t pages_collapsed;
+    uint64_t full_scans;
+};
+
+int do_huge_anonymous_fault(struct vm_area_struct *vma, uint64_t addr, uint64_t flags);
+void thp_count_split(void);
+
+void khugepaged_init(void);
+void khugepaged_exit(struct mm_struct *mm);
+void thp_get_stats(struct thp_stats *stats);
+void thp_dump_stats(void);
+
+#endif
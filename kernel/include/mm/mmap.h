@@ -0,0 +1,61 @@
+#ifndef MMAP_H
+#define MMAP_H
+
+#include <stdint.h>
+#include "vmm.h"
+#include "list.h"
+
+#define VM_READ 0x1
+#define VM_WRITE 0x2
+#define VM_EXEC 0x4
+#define VM_SHARED 0x8
+
+#define PROT_NONE 0x0
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC 0x4
+
+#define MAP_SHARED 0x01
+#define MAP_PRIVATE 0x02
+#define MAP_FIXED 0x10
+#define MAP_ANONYMOUS 0x20
+
+#define MAP_FAILED ((uint64_t)-1)
+
+#define USER_SPACE_END 0x800000000000ULL
+
+struct file;
+struct anon_vma;
+
+struct vm_area_struct {
+    uint64_t vm_start;
+    uint64_t vm_end;
+    uint64_t vm_flags;
+    struct file *vm_file;
+    uint64_t vm_pgoff;
+    struct mm_struct *vm_mm;
+    struct vm_area_struct *vm_next;
+    struct vm_area_struct *vm_prev;
+    struct rb_node vm_rb;
+    struct anon_vma *anon_vma;
+    struct list_head anon_vma_node;
+    struct list_head shared;
+};
+
+void vma_cache_init();
+struct vm_area_struct *find_vma(struct mm_struct *mm, uint64_t addr);
+int mmap_region(struct mm_struct *mm, uint64_t start, uint64_t len, uint64_t flags, struct file *file, uint64_t pgoff);
+void mm_init_vmas(struct mm_struct *mm);
+int dup_mmap(struct mm_struct *mm, struct mm_struct *oldmm);
+void exit_mmap(struct mm_struct *mm);
+void mm_dump_maps(struct mm_struct *mm);
+int do_munmap(struct mm_struct *mm, uint64_t start, uint64_t len);
+int do_mprotect(struct mm_struct *mm, uint64_t start, uint64_t len, uint64_t prot);
+
+uint64_t sys_mmap(uint64_t addr, uint64_t len, uint64_t prot, uint64_t flags, int fd, uint64_t offset);
+int sys_munmap(uint64_t addr, uint64_t len);
+int sys_mprotect(uint64_t addr, uint64_t len, uint64_t prot);
+
+int handle_mm_fault(struct mm_struct *mm, uint64_t addr, uint64_t err_code);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stdint.h>
+
+#define MAX_NUMNODES 8
+#define NUMA_NO_NODE (-1)
+#define NUMA_MAX_MEMBLKS 32
+#define NUMA_MAX_APICS 256
+
+#define LOCAL_DISTANCE 10
+#define REMOTE_DISTANCE 20
+
+struct numa_memblk {
+    uint64_t start;
+    uint64_t end;
+    int nid;
+};
+
+extern int nr_node_ids;
+extern int numa_nr_memblks;
+extern struct numa_memblk numa_memblks[NUMA_MAX_MEMBLKS];
+
+void numa_init(void);
+int numa_node_id(void);
+int node_distance(int from, int to);
+int node_fallback(int nid, int index);
+void numa_dump_topology(void);
+
+#endif
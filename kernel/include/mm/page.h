@@ -4,6 +4,7 @@
 #include "types.h"
 #include "list.h"
 #include "spinlock.h"
+#include "vmm.h"
 
  
 #define PG_locked       0
@@ -20,6 +21,7 @@ struct address_space;
 struct page {
     unsigned long flags;
     atomic_t _count;
+    atomic_t _mapcount;
     struct address_space *mapping;
     uint64_t index;  
     void *private;   
@@ -29,15 +31,52 @@ struct page {
     void *virtual;  
 };
 
+extern struct page *mem_map;
+extern uint64_t max_pfn;
+
+static inline struct page *pfn_to_page(uint64_t pfn) {
+    return mem_map + pfn;
+}
+
+static inline uint64_t page_to_pfn(struct page *page) {
+    return (uint64_t)(page - mem_map);
+}
+
+static inline int pfn_valid(uint64_t pfn) {
+    return pfn < max_pfn;
+}
+
+static inline struct page *phys_to_page(uint64_t phys) {
+    return pfn_to_page(phys >> 12);
+}
+
+static inline uint64_t page_to_phys(struct page *page) {
+    return page_to_pfn(page) << 12;
+}
+
+static inline struct page *virt_to_page(void *addr) {
+    return phys_to_page(virt_to_phys(addr));
+}
+
  
 static inline void get_page(struct page *page) {
-     
-    page->_count++;
+    __sync_fetch_and_add(&page->_count, 1);
 }
 
 static inline void put_page(struct page *page) {
-     
-    page->_count--;
+    __sync_fetch_and_sub(&page->_count, 1);
+}
+
+static inline int get_page_unless_zero(struct page *page) {
+    while (1) {
+        int count = page->_count;
+        if (count == 0) return 0;
+        if (__sync_bool_compare_and_swap(&page->_count, count, count + 1)) return 1;
+    }
+}
+
+static inline int page_ref_freeze(struct page *page, int count) {
+    return __sync_bool_compare_and_swap(&page->_count, count, 0);
 }
 
 static inline int PageLocked(struct page *page) {
@@ -72,4 +111,40 @@ static inline void ClearPageDirty(struct page *page) {
     page->flags &= ~(1 << PG_dirty);
 }
 
+static inline int PageReferenced(struct page *page) {
+    return (page->flags & (1 << PG_referenced));
+}
+
+static inline void SetPageReferenced(struct page *page) {
+    page->flags |= (1 << PG_referenced);
+}
+
+static inline void ClearPageReferenced(struct page *page) {
+    page->flags &= ~(1 << PG_referenced);
+}
+
+static inline int PageLRU(struct page *page) {
+    return (page->flags & (1 << PG_lru));
+}
+
+static inline void SetPageLRU(struct page *page) {
+    page->flags |= (1 << PG_lru);
+}
+
+static inline void ClearPageLRU(struct page *page) {
+    page->flags &= ~(1 << PG_lru);
+}
+
+static inline int PageActive(struct page *page) {
+    return (page->flags & (1 << PG_active));
+}
+
+static inline void SetPageActive(struct page *page) {
+    page->flags |= (1 << PG_active);
+}
+
+static inline void ClearPageActive(struct page *page) {
+    page->flags &= ~(1 << PG_active);
+}
+
 #endif
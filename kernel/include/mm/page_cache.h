@@ -4,10 +4,25 @@
 #include "mm/page.h"
 #include "vfs.h"
 
+#define PAGECACHE_TAG_DIRTY     0
+#define PAGECACHE_TAG_WRITEBACK 1
+#define PAGECACHE_TAG_ACCESSED  2
+#define PAGEVEC_SIZE            16
+
 struct page *find_get_page(struct address_space *mapping, unsigned long offset);
 int add_to_page_cache(struct page *page, struct address_space *mapping, unsigned long offset, int gfp_mask);
 void delete_from_page_cache(struct page *page);
+int remove_mapping(struct address_space *mapping, struct page *page);
+int migrate_page_mapping(struct address_space *mapping, struct page *page, struct page *newpage);
+unsigned int find_get_pages_tag(struct address_space *mapping, unsigned long *index,
+                                unsigned int tag, unsigned int nr_pages, struct page **pages);
+void set_page_dirty(struct page *page);
+int write_one_page(struct page *page);
 struct page *alloc_page(int flags);
 void __free_page(struct page *page);
 
+struct address_space *filemap_mapping(struct inode *inode);
+struct page *filemap_fault(struct file *filp, unsigned long index);
+int filemap_fdatawrite(struct address_space *mapping);
+
 #endif
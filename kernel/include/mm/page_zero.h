@@ -0,0 +1,7 @@
+#ifndef PAGE_ZERO_H
+#define PAGE_ZERO_H
+
+void page_zero_init(void);
+void page_zero_idle(void);
+
+#endif
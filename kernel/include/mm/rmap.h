@@ -0,0 +1,47 @@
+#ifndef RMAP_H
+#define RMAP_H
+
+#include "mm/page.h"
+#include "mm/mmap.h"
+#include "spinlock.h"
+#include "list.h"
+
+#define PAGE_MAPPING_ANON 0x1
+
+#define SWAP_SUCCESS 0
+#define SWAP_AGAIN 1
+#define SWAP_FAIL 2
+
+struct anon_vma {
+    spinlock_t lock;
+    struct list_head head;
+};
+
+static inline int PageAnon(struct page *page) {
+    return ((uint64_t)page->mapping & PAGE_MAPPING_ANON) != 0;
+}
+
+static inline struct anon_vma *page_anon_vma(struct page *page) {
+    if (!PageAnon(page)) return 0;
+    return (struct anon_vma *)((uint64_t)page->mapping & ~(uint64_t)PAGE_MAPPING_ANON);
+}
+
+static inline int page_mapped(struct page *page) {
+    return page->_mapcount > 0;
+}
+
+static inline uint64_t linear_page_index(struct vm_area_struct *vma, uint64_t addr) {
+    return vma->vm_pgoff + ((addr - vma->vm_start) >> 12);
+}
+
+void anon_vma_init(void);
+int anon_vma_prepare(struct vm_area_struct *vma);
+void vma_link_rmap(struct vm_area_struct *vma);
+void vma_unlink_rmap(struct vm_area_struct *vma);
+
+void page_add_anon_rmap(struct page *page, struct vm_area_struct *vma, uint64_t addr);
+int page_referenced(struct page *page);
+int try_to_unmap(struct page *page, uint64_t swp_pte);
+int try_to_migrate(struct page *page, struct page *newpage);
+
+#endif
@@ -4,19 +4,44 @@
 #include <stdint.h>
 #include <stddef.h>
 
- 
-#define PTE_SWAPPED 0x200  
+
+#define PTE_SWAPPED 0x200
+
+#define MAX_SWAPFILES 8
+#define SWAPFILE_CLUSTER 256
+#define SWAP_BATCH 16
 
 typedef struct {
-    uint64_t offset;  
+    uint64_t offset;
     uint8_t device_id;
 } swap_entry_t;
 
+static inline uint64_t swp_entry_to_pte(swap_entry_t entry) {
+    return (entry.offset << 12) | ((uint64_t)entry.device_id << 1) | PTE_SWAPPED;
+}
+
+static inline swap_entry_t pte_to_swp_entry(uint64_t pte) {
+    swap_entry_t entry;
+    entry.device_id = (pte >> 1) & 0xFF;
+    entry.offset = (pte >> 12) & 0xFFFFFFFFFF;
+    return entry;
+}
+
 void swap_init();
+int swapon(const char *name);
+
+int get_swap_pages(int nr, swap_entry_t *entries);
+void swap_duplicate(swap_entry_t entry);
+void swap_free(swap_entry_t entry);
+int swap_count(swap_entry_t entry);
+
+int swap_writepages(uint64_t *frames, swap_entry_t *entries, int nr);
+int swap_readpages(swap_entry_t entry, uint64_t *frames, int nr);
+
 int swap_out(uint64_t phys_addr, swap_entry_t *entry);
 int swap_in(swap_entry_t entry, uint64_t *phys_addr);
 
- 
+
 int handle_swap_fault(uint64_t vaddr);
 
 #endif
@@ -0,0 +1,31 @@
+#ifndef VMSCAN_H
+#define VMSCAN_H
+
+#include "mm/page.h"
+
+#define DEF_PRIORITY 12
+#define SWAP_CLUSTER_MAX 32
+
+struct zone {
+    spinlock_t lru_lock;
+    struct list_head active_list;
+    struct list_head inactive_list;
+    uint64_t nr_active;
+    uint64_t nr_inactive;
+    uint64_t pages_scanned;
+    uint64_t pages_reclaimed;
+};
+
+void vmscan_init(void);
+struct zone *page_zone(struct page *page);
+
+void lru_cache_add(struct page *page);
+void lru_cache_del(struct page *page);
+void lru_cache_replace(struct page *page, struct page *newpage);
+void mark_page_accessed(struct page *page);
+
+uint64_t shrink_zone(struct zone *zone, int priority);
+void wakeup_kswapd(void);
+void vmscan_dump_stats(void);
+
+#endif
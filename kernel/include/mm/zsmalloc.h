@@ -0,0 +1,37 @@
+#ifndef ZSMALLOC_H
+#define ZSMALLOC_H
+
+#include <stdint.h>
+#include "types.h"
+
+#define ZS_MIN_ALLOC_SIZE 32
+#define ZS_MAX_ALLOC_SIZE 4096
+#define ZS_SIZE_CLASS_DELTA 16
+#define ZS_NR_CLASSES ((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) / ZS_SIZE_CLASS_DELTA + 1)
+#define ZS_MAX_PAGES_PER_ZSPAGE 4
+
+#define ZS_MM_RO 0
+#define ZS_MM_WO 1
+
+struct zs_pool;
+
+struct zs_pool_stats {
+    uint64_t pages_used;
+    uint64_t zspages;
+    uint64_t objs_used;
+    uint64_t objs_allocated;
+};
+
+struct zs_pool *zs_create_pool(const char *name);
+void zs_destroy_pool(struct zs_pool *pool);
+
+uint64_t zs_malloc(struct zs_pool *pool, size_t size);
+void zs_free(struct zs_pool *pool, uint64_t handle);
+
+void *zs_map_object(struct zs_pool *pool, uint64_t handle, int mm);
+void zs_unmap_object(struct zs_pool *pool, uint64_t handle);
+
+uint64_t zs_get_total_pages(struct zs_pool *pool);
+void zs_pool_stats(struct zs_pool *pool, struct zs_pool_stats *stats);
+
+#endif
@@ -15,6 +15,8 @@ struct multiboot_info {
 };
 
 #define MULTIBOOT_TAG_TYPE_MMAP 6
+#define MULTIBOOT_TAG_TYPE_ACPI_OLD 14
+#define MULTIBOOT_TAG_TYPE_ACPI_NEW 15
 
 struct multiboot_mmap_entry {
     uint64_t addr;
@@ -31,6 +33,12 @@ struct multiboot_tag_mmap {
     struct multiboot_mmap_entry entries[];
 };
 
+struct multiboot_tag_acpi {
+    uint32_t type;
+    uint32_t size;
+    uint8_t rsdp[];
+};
+
  
 struct multiboot1_info {
     uint32_t flags;
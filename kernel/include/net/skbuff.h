@@ -30,6 +30,7 @@ struct sk_buff {
 };
 
  
+void skb_init(void);
 struct sk_buff *alloc_skb(uint32_t size);
 void kfree_skb(struct sk_buff *skb);
 
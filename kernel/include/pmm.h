@@ -6,13 +6,79 @@
 
 #define PAGE_SIZE 4096
 #define PAGE_ALIGN(x) (((x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+#define PMM_MAX_ORDER 10
+#define PMM_MAX_ALLOC_PAGES (1ULL << PMM_MAX_ORDER)
+#define PMM_NR_CPUS 1
+#define PMM_PCP_BATCH 32
+#define PMM_PCP_HIGH (PMM_PCP_BATCH * 3)
+#define PMM_MAX_SHRINKERS 8
+
+#define PMM_ZERO_POOL_MAX 256
+#define PMM_ZERO_BATCH 16
+
+#define GFP_KERNEL 0
+#define __GFP_ZERO 0x1
+
+#define PMM_WMARK_MIN 0
+#define PMM_WMARK_LOW 1
+#define PMM_WMARK_HIGH 2
+
+struct pmm_pcp_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t refills;
+    uint64_t drains;
+    uint64_t hot_count;
+    uint64_t cold_count;
+};
+
+struct pmm_node_stats {
+    uint64_t managed_pages;
+    uint64_t free_pages;
+    uint64_t numa_hit;
+    uint64_t numa_miss;
+    uint64_t numa_foreign;
+    uint64_t local_node;
+    uint64_t other_node;
+    uint64_t frees;
+};
 
 void pmm_init(uint64_t multiboot_addr, uint64_t magic);
 void* pmm_alloc_page();
 void* pmm_alloc_pages(uint64_t count);
+void* pmm_alloc_page_node(int nid);
+void* pmm_alloc_pages_node(int nid, uint64_t count);
+void* pmm_alloc_page_cold();
+void* pmm_alloc_page_gfp(int gfp_mask);
 void pmm_free_page(void* addr);
+void pmm_free_page_cold(void* addr);
 void pmm_free_pages(void* addr, uint64_t count);
+void pmm_split_pages(void* addr);
+int pmm_page_nid(void* addr);
+int pmm_get_order(void* addr);
+int pmm_buddy_order(void* addr);
+int pmm_isolate_free_block(void* addr, unsigned int max_order);
+uint64_t pmm_node_free_blocks(int nid, unsigned int order);
+void pmm_node_span(int nid, uint64_t* start_pfn, uint64_t* end_pfn);
+void pmm_drain_all();
+void pmm_page_ref(void* addr);
+int pmm_page_unref(void* addr);
+int pmm_page_count(void* addr);
+
+typedef uint64_t (*pmm_shrinker_t)(void);
+int pmm_register_shrinker(pmm_shrinker_t shrinker);
+uint64_t pmm_run_shrinkers();
 uint64_t pmm_get_total_memory();
 uint64_t pmm_get_free_memory();
+uint64_t pmm_watermark(int level);
+int pmm_watermark_ok(int level);
+int pmm_node_watermark_ok(int nid, int level);
+uint64_t pmm_zero_pool_fill(uint64_t nr);
+uint64_t pmm_zero_pool_drain();
+uint64_t pmm_zero_pool_count();
+void pmm_get_pcp_stats(int cpu, struct pmm_pcp_stats* stats);
+void pmm_dump_pcp_stats();
+void pmm_get_node_stats(int nid, struct pmm_node_stats* stats);
+void pmm_dump_node_stats();
 
 #endif
@@ -67,7 +67,8 @@ struct process {
     uint64_t pid;
     uint64_t rsp;
     uint64_t kernel_stack;
-    uint64_t cr3;
+    struct mm_struct *mm;
+    struct mm_struct *active_mm;
     int state;
     struct interrupt_frame *tf;
     char name[64];
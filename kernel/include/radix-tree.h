@@ -3,26 +3,49 @@
 
 #include <stdint.h>
 #include "types.h"
+#include "rcupdate.h"
 
 #define RADIX_TREE_MAP_SHIFT  6
 #define RADIX_TREE_MAP_SIZE   (1UL << RADIX_TREE_MAP_SHIFT)
 #define RADIX_TREE_MAP_MASK   (RADIX_TREE_MAP_SIZE - 1UL)
+#define RADIX_TREE_MAX_PATH   ((64 + RADIX_TREE_MAP_SHIFT - 1) / RADIX_TREE_MAP_SHIFT)
+#define RADIX_TREE_MAX_TAGS   3
+#define RADIX_TREE_PRELOAD_SIZE (RADIX_TREE_MAX_PATH * 2)
 
 struct radix_tree_node {
+    unsigned int    height;
     unsigned int    count;
+    struct rcu_head rcu_head;
     void            *slots[RADIX_TREE_MAP_SIZE];
+    uint64_t        tags[RADIX_TREE_MAX_TAGS];
 };
 
 struct radix_tree_root {
     unsigned int            height;
+    unsigned int            tags;
     struct radix_tree_node  *rnode;
 };
 
-#define RADIX_TREE_INIT(mask)   { .height = 0, .rnode = 0 }
+#define RADIX_TREE_INIT(mask)   { .height = 0, .tags = 0, .rnode = 0 }
+
+void radix_tree_cache_init(void);
+int radix_tree_preload(int gfp_mask);
 
 void radix_tree_init(struct radix_tree_root *root);
 int radix_tree_insert(struct radix_tree_root *root, unsigned long index, void *item);
 void *radix_tree_lookup(struct radix_tree_root *root, unsigned long index);
 void *radix_tree_delete(struct radix_tree_root *root, unsigned long index);
+void *radix_tree_replace(struct radix_tree_root *root, unsigned long index, void *item);
+
+void *radix_tree_tag_set(struct radix_tree_root *root, unsigned long index, unsigned int tag);
+void *radix_tree_tag_clear(struct radix_tree_root *root, unsigned long index, unsigned int tag);
+int radix_tree_tag_get(struct radix_tree_root *root, unsigned long index, unsigned int tag);
+int radix_tree_tagged(struct radix_tree_root *root, unsigned int tag);
+
+unsigned int radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
+                                    unsigned long first_index, unsigned int max_items);
+unsigned int radix_tree_gang_lookup_tag(struct radix_tree_root *root, void **results,
+                                        unsigned long first_index, unsigned int max_items,
+                                        unsigned int tag);
 
 #endif
@@ -0,0 +1,33 @@
+#ifndef RCUPDATE_H
+#define RCUPDATE_H
+
+#include <stdint.h>
+
+struct rcu_head {
+    struct rcu_head *next;
+    void (*func)(struct rcu_head *head);
+};
+
+extern volatile int rcu_readers;
+
+static inline void rcu_read_lock(void) {
+    __sync_fetch_and_add(&rcu_readers, 1);
+}
+
+static inline void rcu_read_unlock(void) {
+    __sync_fetch_and_sub(&rcu_readers, 1);
+}
+
+#define rcu_dereference(p) (*(volatile __typeof__(p) *)&(p))
+
+#define rcu_assign_pointer(p, v) do { \
+    __asm__ volatile("" ::: "memory"); \
+    (p) = (v); \
+} while (0)
+
+void rcu_init(void);
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head));
+void synchronize_rcu(void);
+void rcu_check_callbacks(void);
+
+#endif
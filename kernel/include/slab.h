@@ -0,0 +1,53 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "list.h"
+#include "spinlock.h"
+
+#define SLAB_HWCACHE_ALIGN 0x1
+#define SLAB_PANIC         0x2
+
+#define SLAB_CACHE_LINE 64
+#define SLAB_MAX_ORDER 3
+#define SLAB_NAME_LEN 32
+
+struct kmem_cache {
+    char name[SLAB_NAME_LEN];
+    size_t object_size;
+    size_t size;
+    size_t align;
+    unsigned long flags;
+    void (*ctor)(void *);
+
+    unsigned int order;
+    unsigned int num;
+    size_t obj_offset;
+
+    unsigned int colour;
+    unsigned int colour_off;
+    unsigned int colour_next;
+
+    struct list_head slabs_full;
+    struct list_head slabs_partial;
+    struct list_head slabs_free;
+
+    uint64_t num_slabs;
+    uint64_t free_slabs;
+    uint64_t active_objs;
+
+    spinlock_t lock;
+    struct list_head next;
+};
+
+void kmem_cache_init(void);
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align,
+                                     unsigned long flags, void (*ctor)(void *));
+void kmem_cache_destroy(struct kmem_cache *cachep);
+void *kmem_cache_alloc(struct kmem_cache *cachep, int flags);
+void kmem_cache_free(struct kmem_cache *cachep, void *objp);
+int kmem_cache_shrink(struct kmem_cache *cachep);
+void kmem_cache_dump_stats(void);
+
+#endif
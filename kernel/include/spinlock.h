@@ -13,5 +13,18 @@ typedef struct {
 void spinlock_init(spinlock_t* lock);
 void spinlock_acquire(spinlock_t* lock);
 void spinlock_release(spinlock_t* lock);
+int spinlock_try_acquire(spinlock_t* lock);
+
+static inline uint64_t local_irq_save(void) {
+    uint64_t rflags;
+    __asm__ volatile ("pushfq\n\tpop %0\n\tcli" : "=r"(rflags) : : "memory");
+    return rflags;
+}
+
+static inline void local_irq_restore(uint64_t rflags) {
+    if (rflags & 0x200) {
+        __asm__ volatile ("sti" : : : "memory");
+    }
+}
 
 #endif
@@ -25,6 +25,10 @@
 #define SYS_LSEEK       18
 #define SYS_KILL        19
 #define SYS_REBOOT      20
+#define SYS_MMAP        21
+#define SYS_MUNMAP      22
+#define SYS_MPROTECT    23
+#define SYS_SWAPON      24
 
 void syscall_init();
 
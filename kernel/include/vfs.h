@@ -138,7 +138,8 @@ struct address_space {
     struct address_space_operations *a_ops;
     unsigned long flags;
     unsigned long nrpages;
-    struct list_head i_mmap;     
+    struct list_head i_mmap;
+    spinlock_t i_mmap_lock;
 };
 
 struct super_operations {
@@ -326,6 +327,8 @@ int unregister_filesystem(struct file_system_type *fs);
 struct super_block *vfs_mount(const char *fs_type, int flags, const char *dev_name, void *data);
 int vfs_open(const char *path, int flags, int mode);
 int vfs_close(int fd);
+struct file *fget(int fd);
+void fput(struct file *file);
 int vfs_read(int fd, char *buf, int count);
 int vfs_write(int fd, const char *buf, int count);
 int vfs_lseek(int fd, int offset, int whence);
@@ -0,0 +1,34 @@
+#ifndef VMALLOC_H
+#define VMALLOC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "rbtree.h"
+#include "list.h"
+
+#define VMALLOC_START 0xFFFF800000000000ULL
+#define VMALLOC_END (VMALLOC_START + (1ULL << 42))
+
+#define VMAP_LAZY_MAX_PAGES 8192
+
+#define VM_IOREMAP 0x1
+#define VM_ALLOC 0x2
+
+struct vmap_area {
+    uint64_t va_start;
+    uint64_t va_end;
+    uint64_t flags;
+    uint64_t* pages;
+    uint64_t nr_pages;
+    struct rb_node rb_node;
+    struct list_head purge_list;
+};
+
+void vmalloc_init();
+void* vmalloc(size_t size);
+void* vzalloc(size_t size);
+void vfree(void* addr);
+void vmap_purge_lazy();
+void vmalloc_dump_stats();
+
+#endif
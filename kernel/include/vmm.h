@@ -2,22 +2,117 @@
 #define VMM_H
 
 #include <stdint.h>
+#include "rbtree.h"
 
 #define PTE_PRESENT 1
 #define PTE_WRITABLE 2
 #define PTE_USER 4
+#define PTE_PWT 0x8
+#define PTE_PCD 0x10
+#define PTE_ACCESSED 0x20
+#define PTE_DIRTY 0x40
+#define PTE_HUGE 0x80
+#define PTE_COW 0x400
 #define PTE_NO_EXEC 0x8000000000000000
+#define PTE_ADDR_MASK 0xFFFFFFFFFF000
+
+#define PTE_CACHE_WB 0
+#define PTE_CACHE_WC PTE_PWT
+#define PTE_CACHE_UC_MINUS PTE_PCD
+#define PTE_CACHE_UC (PTE_PCD | PTE_PWT)
+
+#define HUGE_PAGE_SIZE_2M 0x200000ULL
+#define HUGE_PAGE_SIZE_1G 0x40000000ULL
+
+#define ENOMEM 12
+
+#define MMU_GATHER_BATCH 32
+#define MMU_GATHER_PAGES 64
+
+struct mmu_gather {
+    uint64_t addrs[MMU_GATHER_BATCH];
+    uint64_t nr_addrs;
+    uint64_t pages[MMU_GATHER_PAGES];
+    uint64_t nr_pages;
+    int full_flush;
+    int kernel;
+};
+
+#define CR3_NOFLUSH (1ULL << 63)
+#define PCID_MAX 4096
+
+struct vm_area_struct;
+
+struct mm_struct {
+    uint64_t* pgd;
+    uint64_t pgd_phys;
+    uint16_t pcid;
+    uint64_t pcid_gen;
+    int count;
+    struct vm_area_struct* mmap;
+    struct rb_root mm_rb;
+    struct vm_area_struct* mmap_cache;
+    uint64_t map_count;
+    uint64_t total_vm;
+    struct mm_struct* next;
+    struct mm_struct* prev;
+};
+
+extern struct mm_struct init_mm;
+
+#define PAGE_OFFSET 0xFFFF888000000000ULL
+#define DIRECT_MAP_MAX (1ULL << 46)
+
+uint64_t vmm_get_phys(uint64_t virt);
+
+static inline void* phys_to_virt(uint64_t phys) {
+    return (void*)(phys + PAGE_OFFSET);
+}
+
+static inline uint64_t virt_to_phys(void* virt) {
+    uint64_t addr = (uint64_t)virt;
+    if (addr >= PAGE_OFFSET && addr < PAGE_OFFSET + DIRECT_MAP_MAX) return addr - PAGE_OFFSET;
+    return vmm_get_phys(addr);
+}
 
 void vmm_init();
+void vmm_init_direct_map(uint64_t phys_end, uint64_t (*alloc_table)());
 void vmm_map_page(uint64_t virt, uint64_t phys, uint64_t flags);
+int vmm_map_huge(uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags);
+void vmm_map_range(uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags);
+int vmm_unmap_range(uint64_t virt, uint64_t size);
+int vmm_zap_range(struct mmu_gather* tlb, uint64_t virt, uint64_t size, int free_frames);
+int vmm_protect_range(uint64_t virt, uint64_t size, uint64_t set, uint64_t clear);
+int vmm_user_range(uint64_t virt, uint64_t size);
+
+void mm_cache_init();
+struct mm_struct* mm_alloc();
+struct mm_struct* mm_dup(struct mm_struct* oldmm);
+void mm_get(struct mm_struct* mm);
+void mm_put(struct mm_struct* mm);
+void switch_mm(struct mm_struct* prev, struct mm_struct* next);
+
+void tlb_gather_init(struct mmu_gather* tlb);
+void tlb_gather_page(struct mmu_gather* tlb, uint64_t virt);
+void tlb_remove_page(struct mmu_gather* tlb, uint64_t phys);
+void tlb_flush_mmu(struct mmu_gather* tlb);
+void tlb_finish(struct mmu_gather* tlb);
 void vmm_unmap_page(uint64_t virt);
-uint64_t vmm_get_phys(uint64_t virt);
 uint64_t vmm_get_pte(uint64_t virt);
-void vmm_free_user_space();
+void vmm_free_pgtables(struct mmu_gather* tlb, uint64_t start, uint64_t end);
+int vmm_handle_cow_fault(uint64_t virt, uint64_t err_code);
+int vmm_pmd_none(uint64_t virt);
+uint64_t* vmm_mm_leaf(struct mm_struct* mm, uint64_t virt, uint64_t* size);
+void vmm_flush_mm_page(struct mm_struct* mm, uint64_t virt);
+int vmm_collapse_huge(struct mm_struct* mm, uint64_t haddr, uint64_t block, int max_none);
+void vmm_fork_bench();
 void vmm_dump_stats();
 
  
+int vmm_pat_enabled();
 void *ioremap(uint64_t phys_addr, uint64_t size);
+void *ioremap_wc(uint64_t phys_addr, uint64_t size);
+void *ioremap_uc(uint64_t phys_addr, uint64_t size);
 void iounmap(void *virt_addr);
 
  
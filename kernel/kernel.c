@@ -7,6 +7,7 @@
 #include "pmm.h"
 #include "vmm.h"
 #include "heap.h"
+#include "slab.h"
 #include "drivers/pic.h"
 #include "drivers/pit.h"
 #include "process.h"
@@ -17,17 +18,26 @@
 #include "drivers/keyboard.h"
 #include "drivers/serial.h"
 #include "drivers/ramdisk.h"
+#include "drivers/zram.h"
 #include "chardev.h"
 #include "vfs.h"
 #include "ramfs.h"
 #include "string.h"
 #include "fs/buffer.h"
+#include "mm/page_cache.h"
 #include "net/netdevice.h"
 #include "net/skbuff.h"
 #include "net/ethernet.h"
 #include "net/arp.h"
 
 #include "mm/swap.h"
+#include "mm/vmscan.h"
+#include "mm/page_zero.h"
+#include "mm/huge_memory.h"
+#include "mm/compaction.h"
+#include "vmalloc.h"
+#include "rcupdate.h"
+#include "radix-tree.h"
 #include "module.h"
 #include "virt/vmx.h"
 #include "hrtimer.h"
@@ -88,13 +98,22 @@ void kernel_main(uint64_t multiboot_addr, uint64_t magic) {
 
     uint64_t heap_start = 0x100000000000;
      
-    heap_init(heap_start, 8 * 1024 * 1024);  
+    heap_init(heap_start, HEAP_RESERVE_SIZE);  
+#ifdef HEAP_DEBUG
+    heap_self_test();
+#endif
+    kmem_cache_init();
+    rcu_init();
+    radix_tree_cache_init();
+    vmalloc_init();
 
     driver_core_init();
     chardev_init();
     keyboard_init();
     serial_driver_init();
+    blk_dev_init();
     ramdisk_init();
+    zram_init();
     pci_init();
 
     net_dev_init();
@@ -135,6 +154,10 @@ void kernel_main(uint64_t multiboot_addr, uint64_t magic) {
     mutex_init(&print_mutex);
 
     buffer_init();
+    vmscan_init();
+    page_zero_init();
+    khugepaged_init();
+    kcompactd_init();
     vfs_init();
     ramfs_init();
 
@@ -167,10 +190,15 @@ void kernel_main(uint64_t multiboot_addr, uint64_t magic) {
     module_subsystem_init();
     swap_init();
 
+#ifdef FORK_BENCH
+    vmm_fork_bench();
+#endif
+
     kprint_str("Creating Tasks...\n");
     kprint_str("Starting Scheduler...\n");
     
     while (1) {
+        page_zero_idle();
         process_yield();
         __asm__ volatile("hlt");
     }
@@ -0,0 +1,146 @@
+#include "lz4.h"
+#include "string.h"
+
+static inline uint32_t lz4_read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz4_hash(uint32_t seq) {
+    return (seq * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+static inline uint8_t *lz4_write_length(uint8_t *op, uint64_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static inline int lz4_read_length(const uint8_t **ip, const uint8_t *iend, uint64_t *len) {
+    uint8_t b;
+    do {
+        if (*ip >= iend) return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+static uint8_t *lz4_emit_literals(uint8_t *op, uint8_t *oend, const uint8_t *anchor, uint64_t lit, uint8_t **token) {
+    if (op + 1 + lit / 255 + 1 + lit > oend) return 0;
+
+    *token = op++;
+    **token = (uint8_t)((lit >= 15 ? 15 : lit) << 4);
+    if (lit >= 15) op = lz4_write_length(op, lit - 15);
+    memcpy(op, anchor, lit);
+    return op + lit;
+}
+
+int lz4_compress(const uint8_t *src, int src_len, uint8_t *dst, int dst_cap, void *wrkmem) {
+    uint32_t *table = (uint32_t *)wrkmem;
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    const uint8_t *iend = src + src_len;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + dst_cap;
+    uint8_t *token;
+
+    if (src_len < 0 || dst_cap <= 0) return 0;
+    memset(table, 0, LZ4_MEM_COMPRESS);
+
+    if (src_len > LZ4_MF_LIMIT) {
+        const uint8_t *mflimit = iend - LZ4_MF_LIMIT;
+        const uint8_t *matchlimit = iend - LZ4_LAST_LITERALS;
+        uint32_t misses = 0;
+
+        ip++;
+        while (ip < mflimit) {
+            uint32_t seq = lz4_read32(ip);
+            uint32_t h = lz4_hash(seq);
+            const uint8_t *ref = src + table[h];
+            table[h] = (uint32_t)(ip - src);
+
+            if (ref >= ip || ip - ref > LZ4_MAX_DISTANCE || lz4_read32(ref) != seq) {
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+
+            const uint8_t *mp = ip + LZ4_MIN_MATCH;
+            const uint8_t *rp = ref + LZ4_MIN_MATCH;
+            while (mp < matchlimit && *mp == *rp) {
+                mp++;
+                rp++;
+            }
+
+            uint64_t mlen = (uint64_t)(mp - ip) - LZ4_MIN_MATCH;
+            op = lz4_emit_literals(op, oend, anchor, (uint64_t)(ip - anchor), &token);
+            if (!op || op + 2 + mlen / 255 + 1 > oend) return 0;
+
+            uint16_t offset = (uint16_t)(ip - ref);
+            *op++ = (uint8_t)offset;
+            *op++ = (uint8_t)(offset >> 8);
+            *token |= (uint8_t)(mlen >= 15 ? 15 : mlen);
+            if (mlen >= 15) op = lz4_write_length(op, mlen - 15);
+
+            ip = mp;
+            anchor = ip;
+            if (ip < mflimit) table[lz4_hash(lz4_read32(ip - 2))] = (uint32_t)(ip - 2 - src);
+        }
+    }
+
+    op = lz4_emit_literals(op, oend, anchor, (uint64_t)(iend - anchor), &token);
+    if (!op) return 0;
+    return (int)(op - dst);
+}
+
+int lz4_decompress(const uint8_t *src, int src_len, uint8_t *dst, int dst_cap) {
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + src_len;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + dst_cap;
+
+    if (src_len <= 0 || dst_cap < 0) return -1;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        uint64_t lit = token >> 4;
+        if (lit == 15 && lz4_read_length(&ip, iend, &lit) != 0) return -1;
+        if (lit > (uint64_t)(iend - ip) || lit > (uint64_t)(oend - op)) return -1;
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+
+        if (ip == iend) break;
+        if (iend - ip < 2) return -1;
+
+        uint64_t offset = (uint64_t)ip[0] | ((uint64_t)ip[1] << 8);
+        ip += 2;
+        if (!offset || offset > (uint64_t)(op - dst)) return -1;
+
+        uint64_t mlen = token & 15;
+        if (mlen == 15 && lz4_read_length(&ip, iend, &mlen) != 0) return -1;
+        mlen += LZ4_MIN_MATCH;
+        if (mlen > (uint64_t)(oend - op)) return -1;
+
+        const uint8_t *ref = op - offset;
+        if (offset >= mlen) {
+            memcpy(op, ref, mlen);
+            op += mlen;
+        } else {
+            while (mlen--) *op++ = *ref++;
+        }
+    }
+
+    return (int)(op - dst);
+}
@@ -1,39 +1,120 @@
 #include "radix-tree.h"
-#include "heap.h"
+#include "slab.h"
 #include "string.h"
+#include "spinlock.h"
+
+static struct kmem_cache *radix_tree_node_cachep;
+static struct radix_tree_node *preload_nodes[RADIX_TREE_PRELOAD_SIZE];
+static int preload_nr = 0;
+
+void radix_tree_cache_init(void) {
+    radix_tree_node_cachep = kmem_cache_create("radix_tree_node", sizeof(struct radix_tree_node), 0,
+                                               SLAB_HWCACHE_ALIGN | SLAB_PANIC, 0);
+}
 
 static struct radix_tree_node *radix_tree_node_alloc() {
-    struct radix_tree_node *ret = (struct radix_tree_node *)kmalloc(sizeof(struct radix_tree_node));
+    struct radix_tree_node *ret = 0;
+
+    uint64_t flags = local_irq_save();
+    if (preload_nr) ret = preload_nodes[--preload_nr];
+    local_irq_restore(flags);
+
+    if (!ret) ret = (struct radix_tree_node *)kmem_cache_alloc(radix_tree_node_cachep, 0);
     if (ret) {
         memset(ret, 0, sizeof(struct radix_tree_node));
     }
     return ret;
 }
 
+static void radix_tree_node_rcu_free(struct rcu_head *head) {
+    struct radix_tree_node *node = container_of(head, struct radix_tree_node, rcu_head);
+    kmem_cache_free(radix_tree_node_cachep, node);
+}
+
 static void radix_tree_node_free(struct radix_tree_node *node) {
-    kfree(node);
+    call_rcu(&node->rcu_head, radix_tree_node_rcu_free);
+}
+
+int radix_tree_preload(int gfp_mask) {
+    while (1) {
+        uint64_t flags = local_irq_save();
+        int nr = preload_nr;
+        local_irq_restore(flags);
+        if (nr >= RADIX_TREE_PRELOAD_SIZE) return 0;
+
+        struct radix_tree_node *node = (struct radix_tree_node *)kmem_cache_alloc(radix_tree_node_cachep, gfp_mask);
+        if (!node) return -1;
+
+        flags = local_irq_save();
+        if (preload_nr < RADIX_TREE_PRELOAD_SIZE) {
+            preload_nodes[preload_nr++] = node;
+            node = 0;
+        }
+        local_irq_restore(flags);
+
+        if (node) kmem_cache_free(radix_tree_node_cachep, node);
+    }
 }
 
 void radix_tree_init(struct radix_tree_root *root) {
     root->height = 0;
+    root->tags = 0;
     root->rnode = 0;
 }
 
+static inline unsigned long radix_tree_maxindex(unsigned int height) {
+    unsigned int shift = height * RADIX_TREE_MAP_SHIFT;
+    if (shift >= 64) return ~0UL;
+    return (1UL << shift) - 1;
+}
+
+static inline void tag_set(struct radix_tree_node *node, unsigned int tag, int offset) {
+    node->tags[tag] |= 1UL << offset;
+}
+
+static inline void tag_clear(struct radix_tree_node *node, unsigned int tag, int offset) {
+    node->tags[tag] &= ~(1UL << offset);
+}
+
+static inline int tag_get(struct radix_tree_node *node, unsigned int tag, int offset) {
+    return (node->tags[tag] >> offset) & 1;
+}
+
+static inline int root_tag_get(struct radix_tree_root *root, unsigned int tag) {
+    return (root->tags >> tag) & 1;
+}
+
+static int radix_tree_path(struct radix_tree_root *root, unsigned long index,
+                           struct radix_tree_node **path, int *offsets) {
+    struct radix_tree_node *node = root->rnode;
+    if (!node || index > radix_tree_maxindex(node->height)) return 0;
+
+    unsigned int height = node->height;
+    unsigned int shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
+    int depth = 0;
+
+    while (height > 0) {
+        int offset = (index >> shift) & RADIX_TREE_MAP_MASK;
+        path[depth] = node;
+        offsets[depth] = offset;
+        depth++;
+
+        if (!node->slots[offset]) return 0;
+        if (height == 1) return depth;
+
+        node = (struct radix_tree_node *)node->slots[offset];
+        shift -= RADIX_TREE_MAP_SHIFT;
+        height--;
+    }
+    return 0;
+}
+
 static void radix_tree_shrink(struct radix_tree_root *root) {
-    while (root->height > 0) {
+    while (root->height > 1) {
         struct radix_tree_node *node = root->rnode;
-        if (!node) {
-            root->height = 0;
-            break;
-        }
+        if (!node || node->count != 1 || !node->slots[0]) break;
 
-        if (node->count != 1) break;
-        if (!node->slots[0]) break;
-
-        if (root->height <= 1) break;
-        
-        void *child = node->slots[0];
-        root->rnode = (struct radix_tree_node *)child;
+        rcu_assign_pointer(root->rnode, (struct radix_tree_node *)node->slots[0]);
         root->height--;
         radix_tree_node_free(node);
     }
@@ -41,77 +122,60 @@ static void radix_tree_shrink(struct radix_tree_root *root) {
 
 static int radix_tree_extend(struct radix_tree_root *root, unsigned long index) {
     struct radix_tree_node *node;
-    unsigned int height;
+    unsigned int height = root->height ? root->height : 1;
 
-     
-    height = root->height + 1;
-    while (index > ((1UL << (height * RADIX_TREE_MAP_SHIFT)) - 1))
+    while (index > radix_tree_maxindex(height))
         height++;
 
     if (root->rnode == 0) {
         root->height = height;
+        return 0;
     }
     
     while (root->height < height) {
         node = radix_tree_node_alloc();
         if (!node) return -1;
         
+        node->height = root->height + 1;
         node->slots[0] = root->rnode;
         node->count = 1;  
-        root->rnode = node;
+        for (unsigned int tag = 0; tag < RADIX_TREE_MAX_TAGS; tag++) {
+            if (root_tag_get(root, tag)) tag_set(node, tag, 0);
+        }
+        rcu_assign_pointer(root->rnode, node);
         root->height++;
     }
     return 0;
 }
 
 int radix_tree_insert(struct radix_tree_root *root, unsigned long index, void *item) {
-    struct radix_tree_node *node = 0, *slot = 0;
+    struct radix_tree_node *node, *slot;
     unsigned int height, shift;
     int offset;
 
-     
-    if (root->rnode == 0 && root->height == 0) {
-        unsigned long tmp = index;
-        unsigned int h = 0;
-        while (tmp > 0) {
-            tmp >>= RADIX_TREE_MAP_SHIFT;
-            h++;
-        }
-        if (h == 0) h = 1;  
-        root->height = h;
-    }
-    
-     
-    unsigned long max_index = (1UL << (root->height * RADIX_TREE_MAP_SHIFT)) - 1;
-    if (index > max_index) {
+    if (root->height == 0 || index > radix_tree_maxindex(root->height)) {
         if (radix_tree_extend(root, index)) return -1;
     }
 
-    height = root->height;
-    shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
-
     if (!root->rnode) {
-        root->rnode = radix_tree_node_alloc();
-        if (!root->rnode) return -1;
+        node = radix_tree_node_alloc();
+        if (!node) return -1;
+        node->height = root->height;
+        rcu_assign_pointer(root->rnode, node);
     }
-    
+
     node = root->rnode;
+    height = root->height;
+    shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
     
-    while (height > 0) {
-        if (shift >= 64) offset = 0;  
-        else offset = (index >> shift) & RADIX_TREE_MAP_MASK;
-        
-        if (height == 1) {
-            if (node->slots[offset]) return -1;  
-            node->slots[offset] = item;
-            node->count++;
-            return 0;
-        }
+    while (height > 1) {
+        offset = (index >> shift) & RADIX_TREE_MAP_MASK;
         
         if (!node->slots[offset]) {
             slot = radix_tree_node_alloc();
             if (!slot) return -1;
-            node->slots[offset] = slot;
+            slot->height = height - 1;
+            rcu_assign_pointer(node->slots[offset], slot);
             node->count++;
         }
         
@@ -119,97 +183,194 @@ int radix_tree_insert(struct radix_tree_root *root, unsigned long index, void *i
         shift -= RADIX_TREE_MAP_SHIFT;
         height--;
     }
-    
-    return -1;  
+
+    offset = index & RADIX_TREE_MAP_MASK;
+    if (node->slots[offset]) return -1;  
+    rcu_assign_pointer(node->slots[offset], item);
+    node->count++;
+    return 0;
 }
 
 void *radix_tree_lookup(struct radix_tree_root *root, unsigned long index) {
-    unsigned int height, shift;
-    struct radix_tree_node *node;
-    int offset;
+    struct radix_tree_node *node = rcu_dereference(root->rnode);
+    if (!node) return 0;
 
-    node = root->rnode;
-    height = root->height;
-    if (height == 0 || !node) return 0;
-    
-    unsigned long max_index = (1UL << (height * RADIX_TREE_MAP_SHIFT)) - 1;
-    if (index > max_index) return 0;
+    unsigned int height = node->height;
+    if (index > radix_tree_maxindex(height)) return 0;
 
-    shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
+    unsigned int shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
+    while (height > 1) {
+        node = (struct radix_tree_node *)rcu_dereference(node->slots[(index >> shift) & RADIX_TREE_MAP_MASK]);
+        if (!node) return 0;
+        shift -= RADIX_TREE_MAP_SHIFT;
+        height--;
+    }
+    return rcu_dereference(node->slots[index & RADIX_TREE_MAP_MASK]);
+}
 
-    while (height > 0) {
-        offset = (index >> shift) & RADIX_TREE_MAP_MASK;
-        if (!node->slots[offset]) return 0;
-        
-        if (height == 1) {
-            return node->slots[offset];
-        }
-        
-        node = (struct radix_tree_node *)node->slots[offset];
+void *radix_tree_replace(struct radix_tree_root *root, unsigned long index, void *item) {
+    struct radix_tree_node *node = root->rnode;
+    if (!node) return 0;
+
+    unsigned int height = node->height;
+    if (index > radix_tree_maxindex(height)) return 0;
+
+    unsigned int shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
+    while (height > 1) {
+        node = (struct radix_tree_node *)node->slots[(index >> shift) & RADIX_TREE_MAP_MASK];
+        if (!node) return 0;
         shift -= RADIX_TREE_MAP_SHIFT;
         height--;
     }
-    return 0;
+
+    void *old = node->slots[index & RADIX_TREE_MAP_MASK];
+    if (old) rcu_assign_pointer(node->slots[index & RADIX_TREE_MAP_MASK], item);
+    return old;
+}
+
+void *radix_tree_tag_set(struct radix_tree_root *root, unsigned long index, unsigned int tag) {
+    struct radix_tree_node *path[RADIX_TREE_MAX_PATH];
+    int offsets[RADIX_TREE_MAX_PATH];
+
+    if (tag >= RADIX_TREE_MAX_TAGS) return 0;
+    int depth = radix_tree_path(root, index, path, offsets);
+    if (!depth) return 0;
+
+    for (int i = 0; i < depth; i++) {
+        tag_set(path[i], tag, offsets[i]);
+    }
+    root->tags |= 1U << tag;
+    return path[depth - 1]->slots[offsets[depth - 1]];
+}
+
+void *radix_tree_tag_clear(struct radix_tree_root *root, unsigned long index, unsigned int tag) {
+    struct radix_tree_node *path[RADIX_TREE_MAX_PATH];
+    int offsets[RADIX_TREE_MAX_PATH];
+
+    if (tag >= RADIX_TREE_MAX_TAGS) return 0;
+    int depth = radix_tree_path(root, index, path, offsets);
+    if (!depth) return 0;
+
+    void *item = path[depth - 1]->slots[offsets[depth - 1]];
+    for (int i = depth - 1; i >= 0; i--) {
+        tag_clear(path[i], tag, offsets[i]);
+        if (path[i]->tags[tag]) return item;
+    }
+    root->tags &= ~(1U << tag);
+    return item;
+}
+
+int radix_tree_tag_get(struct radix_tree_root *root, unsigned long index, unsigned int tag) {
+    struct radix_tree_node *path[RADIX_TREE_MAX_PATH];
+    int offsets[RADIX_TREE_MAX_PATH];
+
+    if (tag >= RADIX_TREE_MAX_TAGS || !root_tag_get(root, tag)) return 0;
+    int depth = radix_tree_path(root, index, path, offsets);
+    if (!depth) return 0;
+    return tag_get(path[depth - 1], tag, offsets[depth - 1]);
+}
+
+int radix_tree_tagged(struct radix_tree_root *root, unsigned int tag) {
+    if (tag >= RADIX_TREE_MAX_TAGS) return 0;
+    return root_tag_get(root, tag);
 }
 
 void *radix_tree_delete(struct radix_tree_root *root, unsigned long index) {
-    struct radix_tree_node *stack[16];  
-    int offsets[16];
-    int top = 0;
-    
-    unsigned int height, shift;
-    struct radix_tree_node *node;
-    int offset;
+    struct radix_tree_node *path[RADIX_TREE_MAX_PATH];
+    int offsets[RADIX_TREE_MAX_PATH];
 
-    node = root->rnode;
-    height = root->height;
-    if (height == 0 || !node) return 0;
-    
-    unsigned long max_index = (1UL << (height * RADIX_TREE_MAP_SHIFT)) - 1;
-    if (index > max_index) return 0;
+    int depth = radix_tree_path(root, index, path, offsets);
+    if (!depth) return 0;
 
-    shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
-     
-    while (height > 0) {
-        offset = (index >> shift) & RADIX_TREE_MAP_MASK;
-        stack[top] = node;
-        offsets[top] = offset;
-        top++;
-        
-        if (!node->slots[offset]) return 0;  
-        
-        if (height == 1) {
-             void *item = node->slots[offset];
-             node->slots[offset] = 0;
-             node->count--;
-             
-             while (top > 0) {
-                 node = stack[top-1];
-                 if (node->count > 0) break;  
-
-                 if (top > 1) {
-                     struct radix_tree_node *parent = stack[top-2];
-                     int p_off = offsets[top-2];
-                     parent->slots[p_off] = 0;
-                     parent->count--;
-                     radix_tree_node_free(node);
-                     top--;
-                 } else {
-                     radix_tree_node_free(node);
-                     root->rnode = 0;
-                     root->height = 0;  
-                     top--;
-                 }
-             }
-             
-             radix_tree_shrink(root);
-             
-             return item;
+    struct radix_tree_node *leaf = path[depth - 1];
+    int offset = offsets[depth - 1];
+    void *item = leaf->slots[offset];
+
+    for (unsigned int tag = 0; tag < RADIX_TREE_MAX_TAGS; tag++) {
+        if (tag_get(leaf, tag, offset)) radix_tree_tag_clear(root, index, tag);
+    }
+
+    rcu_assign_pointer(leaf->slots[offset], (void *)0);
+    leaf->count--;
+
+    for (int i = depth - 1; i >= 0 && path[i]->count == 0; i--) {
+        if (i > 0) {
+            rcu_assign_pointer(path[i - 1]->slots[offsets[i - 1]], (void *)0);
+            path[i - 1]->count--;
+        } else {
+            rcu_assign_pointer(root->rnode, (struct radix_tree_node *)0);
+            root->height = 0;
+            root->tags = 0;
         }
-        
-        node = (struct radix_tree_node *)node->slots[offset];
-        shift -= RADIX_TREE_MAP_SHIFT;
-        height--;
+        radix_tree_node_free(path[i]);
     }
-    return 0;
+
+    radix_tree_shrink(root);
+    return item;
+}
+
+static unsigned int __lookup(struct radix_tree_root *root, void **results, unsigned long index,
+                             unsigned int max_items, int tag) {
+    unsigned int nr = 0;
+
+    while (nr < max_items) {
+        struct radix_tree_node *node = rcu_dereference(root->rnode);
+        if (!node) break;
+
+        unsigned int height = node->height;
+        if (index > radix_tree_maxindex(height)) break;
+
+        unsigned int shift = (height - 1) * RADIX_TREE_MAP_SHIFT;
+        int restart = 0;
+
+        while (height > 1) {
+            unsigned long span = 1UL << shift;
+            int offset = (index >> shift) & RADIX_TREE_MAP_MASK;
+
+            for (; offset < (int)RADIX_TREE_MAP_SIZE; offset++) {
+                if (tag < 0 ? node->slots[offset] != 0 : tag_get(node, tag, offset)) break;
+                index = (index & ~(span - 1)) + span;
+                if (index == 0) return nr;
+            }
+            if (offset == (int)RADIX_TREE_MAP_SIZE) {
+                restart = 1;
+                break;
+            }
+
+            node = (struct radix_tree_node *)rcu_dereference(node->slots[offset]);
+            if (!node) {
+                index = (index & ~(span - 1)) + span;
+                if (index == 0) return nr;
+                restart = 1;
+                break;
+            }
+            shift -= RADIX_TREE_MAP_SHIFT;
+            height--;
+        }
+        if (restart) continue;
+
+        for (int offset = index & RADIX_TREE_MAP_MASK; offset < (int)RADIX_TREE_MAP_SIZE; offset++) {
+            void *item = rcu_dereference(node->slots[offset]);
+            if (item && (tag < 0 || tag_get(node, tag, offset))) {
+                results[nr++] = item;
+                if (nr == max_items) break;
+            }
+        }
+
+        index = (index | RADIX_TREE_MAP_MASK) + 1;
+        if (index == 0) break;
+    }
+    return nr;
+}
+
+unsigned int radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
+                                    unsigned long first_index, unsigned int max_items) {
+    return __lookup(root, results, first_index, max_items, -1);
+}
+
+unsigned int radix_tree_gang_lookup_tag(struct radix_tree_root *root, void **results,
+                                        unsigned long first_index, unsigned int max_items,
+                                        unsigned int tag) {
+    if (tag >= RADIX_TREE_MAX_TAGS || !root_tag_get(root, tag)) return 0;
+    return __lookup(root, results, first_index, max_items, (int)tag);
 }
@@ -5,140 +5,421 @@
 #include "string.h"
 #include "spinlock.h"
 
-extern uint64_t* current_pml4;
+#define HEAP_NR_CLASSES 15
+#define HEAP_MAX_SMALL 2048
+#define HEAP_MAGIC 0x12345678
 
-#define HEAP_BLOCK_SIZE sizeof(struct heap_block)
+#define HEAP_PAGE_UNUSED 0
+#define HEAP_PAGE_RUN 1
+#define HEAP_PAGE_UNMAPPED 2
 
-struct heap_block {
-    size_t size;
-    struct heap_block* next;
-    struct heap_block* prev;
-    int free;
-    uint64_t magic;  
+#define HEAP_GROW_PAGES 16
+
+#ifdef HEAP_DEBUG
+#define HEAP_DEBUG_HDR 16
+
+struct heap_debug_hdr {
+    uint64_t magic;
+    uint64_t size;
+};
+#endif
+
+struct heap_page {
+    void* freelist;
+    struct heap_page* next;
+    struct heap_page* prev;
+    uint16_t inuse;
+    uint8_t class_idx;
+    uint8_t state;
+};
+
+struct heap_class {
+    struct heap_page* partial;
+    uint64_t nr_pages;
+    uint64_t nr_objects;
+    spinlock_t lock;
+};
+
+static const uint16_t heap_class_size[HEAP_NR_CLASSES] = {
+    8, 16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048
 };
 
-static struct heap_block* free_list = 0;
+static uint8_t size_index[HEAP_MAX_SMALL / 8 + 1];
+static struct heap_class heap_classes[HEAP_NR_CLASSES];
+
+static uint64_t heap_start = 0;
+static uint64_t heap_end = 0;
+static uint64_t heap_data_start = 0;
+static uint64_t heap_top = 0;
+static uint64_t heap_meta_mapped = 0;
+static struct heap_page* heap_desc = 0;
+static struct heap_page* heap_free_pages = 0;
+static struct heap_page* heap_unmapped_pages = 0;
+static uint64_t heap_free_count = 0;
+static uint64_t heap_unmapped_count = 0;
+static uint64_t heap_large_pages = 0;
 static spinlock_t heap_lock;
 
+static inline struct heap_page* heap_addr_to_desc(uint64_t addr) {
+    return &heap_desc[(addr - heap_start) / PAGE_SIZE];
+}
+
+static inline uint64_t heap_desc_to_addr(struct heap_page* desc) {
+    return heap_start + (uint64_t)(desc - heap_desc) * PAGE_SIZE;
+}
+
+static void heap_free_list_add(struct heap_page* desc) {
+    desc->state = HEAP_PAGE_UNUSED;
+    desc->freelist = 0;
+    desc->prev = 0;
+    desc->next = heap_free_pages;
+    heap_free_pages = desc;
+    heap_free_count++;
+}
+
+static int heap_map_meta(uint64_t page_idx) {
+    uint64_t meta_idx = (page_idx * sizeof(struct heap_page)) / PAGE_SIZE;
+
+    while (heap_meta_mapped <= meta_idx) {
+        void* phys = pmm_alloc_page_gfp(__GFP_ZERO);
+        if (!phys) return -1;
+        uint64_t virt = heap_start + heap_meta_mapped * PAGE_SIZE;
+        vmm_map_page(virt, (uint64_t)phys, PTE_PRESENT | PTE_WRITABLE);
+        heap_meta_mapped++;
+    }
+    return 0;
+}
+
+static uint64_t heap_grow(uint64_t nr_pages) {
+    uint64_t grown = 0;
+
+    while (grown < nr_pages) {
+        struct heap_page* desc = heap_unmapped_pages;
+
+        if (desc) {
+            void* phys = pmm_alloc_page();
+            if (!phys) break;
+            vmm_map_page(heap_desc_to_addr(desc), (uint64_t)phys, PTE_PRESENT | PTE_WRITABLE);
+            heap_unmapped_pages = desc->next;
+            heap_unmapped_count--;
+        } else {
+            if (heap_top >= heap_end) break;
+            uint64_t page_idx = (heap_top - heap_start) / PAGE_SIZE;
+            if (heap_map_meta(page_idx) != 0) break;
+
+            void* phys = pmm_alloc_page();
+            if (!phys) break;
+            vmm_map_page(heap_top, (uint64_t)phys, PTE_PRESENT | PTE_WRITABLE);
+            desc = &heap_desc[page_idx];
+            heap_top += PAGE_SIZE;
+        }
+
+        heap_free_list_add(desc);
+        grown++;
+    }
+    return grown;
+}
+
+static struct heap_page* heap_get_page() {
+    spinlock_acquire(&heap_lock);
+    if (!heap_free_pages) heap_grow(HEAP_GROW_PAGES);
+
+    struct heap_page* desc = heap_free_pages;
+    if (desc) {
+        heap_free_pages = desc->next;
+        heap_free_count--;
+        desc->next = 0;
+    }
+    spinlock_release(&heap_lock);
+    return desc;
+}
+
+static void heap_put_page(struct heap_page* desc) {
+    spinlock_acquire(&heap_lock);
+    heap_free_list_add(desc);
+    spinlock_release(&heap_lock);
+}
+
+uint64_t heap_shrink() {
+    struct mmu_gather tlb;
+    uint64_t freed = 0;
+
+    if (!heap_desc || !spinlock_try_acquire(&heap_lock)) return 0;
+
+    tlb_gather_init(&tlb);
+
+    while (heap_free_pages) {
+        struct heap_page* desc = heap_free_pages;
+
+        heap_free_pages = desc->next;
+        heap_free_count--;
+
+        vmm_zap_range(&tlb, heap_desc_to_addr(desc), PAGE_SIZE, 1);
+
+        desc->state = HEAP_PAGE_UNMAPPED;
+        desc->next = heap_unmapped_pages;
+        heap_unmapped_pages = desc;
+        heap_unmapped_count++;
+        freed++;
+    }
+
+    tlb_finish(&tlb);
+    spinlock_release(&heap_lock);
+    return freed;
+}
+
+static void heap_class_link(struct heap_class* cls, struct heap_page* desc) {
+    desc->prev = 0;
+    desc->next = cls->partial;
+    if (cls->partial) cls->partial->prev = desc;
+    cls->partial = desc;
+}
+
+static void heap_class_unlink(struct heap_class* cls, struct heap_page* desc) {
+    if (desc->prev) desc->prev->next = desc->next;
+    else cls->partial = desc->next;
+    if (desc->next) desc->next->prev = desc->prev;
+    desc->next = 0;
+    desc->prev = 0;
+}
+
+static void heap_init_run(struct heap_page* desc, int class_idx) {
+    uint64_t size = heap_class_size[class_idx];
+    uint64_t count = PAGE_SIZE / size;
+    uint8_t* base = (uint8_t*)heap_desc_to_addr(desc);
+
+    for (uint64_t i = 0; i < count - 1; i++) {
+        *(void**)(base + i * size) = base + (i + 1) * size;
+    }
+    *(void**)(base + (count - 1) * size) = 0;
+
+    desc->freelist = base;
+    desc->inuse = 0;
+    desc->class_idx = class_idx;
+    desc->state = HEAP_PAGE_RUN;
+}
+
 void heap_init(uint64_t start_virt, uint64_t size) {
-     
-    uint64_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint64_t pages = size / PAGE_SIZE;
+    uint64_t meta_pages = (pages * sizeof(struct heap_page) + PAGE_SIZE - 1) / PAGE_SIZE;
     
     spinlock_init(&heap_lock);
 
     kprint_str("Initializing Heap at ");
     kprint_hex(start_virt);
-    kprint_str(" Size: ");
+    kprint_str(" Reserved: ");
     kprint_dec(size);
     kprint_newline();
 
-    for (uint64_t i = 0; i < pages; i++) {
-        vmm_map_page(start_virt + i * PAGE_SIZE, (uint64_t)pmm_alloc_page(), PTE_PRESENT | PTE_WRITABLE);
+    heap_start = start_virt;
+    heap_end = start_virt + pages * PAGE_SIZE;
+    heap_data_start = start_virt + meta_pages * PAGE_SIZE;
+    heap_top = heap_data_start;
+    heap_desc = (struct heap_page*)start_virt;
+
+    int class_idx = 0;
+    for (uint64_t i = 0; i <= HEAP_MAX_SMALL / 8; i++) {
+        while (i * 8 > heap_class_size[class_idx]) class_idx++;
+        size_index[i] = class_idx;
+    }
+
+    for (int i = 0; i < HEAP_NR_CLASSES; i++) {
+        heap_classes[i].partial = 0;
+        heap_classes[i].nr_pages = 0;
+        heap_classes[i].nr_objects = 0;
+        spinlock_init(&heap_classes[i].lock);
     }
 
-    free_list = (struct heap_block*)start_virt;
-    free_list->size = size - HEAP_BLOCK_SIZE;
-    free_list->next = 0;
-    free_list->prev = 0;
-    free_list->free = 1;
-    free_list->magic = 0x12345678;
+    if (heap_grow(HEAP_GROW_PAGES) == 0) {
+        kprint_str("Heap: Failed to map initial pages\n");
+        return;
+    }
+
+    pmm_register_shrinker(heap_shrink);
+
     kprint_str("Heap Initialized successfully.\n");
 }
 
+static void* heap_alloc_large(size_t size) {
+    uint64_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint64_t count = 1;
+    while (count < pages) count <<= 1;
+
+    void* phys = pmm_alloc_pages(count);
+    if (!phys) return 0;
+
+    __sync_fetch_and_add(&heap_large_pages, count);
+    return phys_to_virt((uint64_t)phys);
+}
+
+static void heap_free_large(void* ptr) {
+    uint64_t addr = (uint64_t)ptr;
+    int order = (addr >= PAGE_OFFSET) ? pmm_get_order((void*)(addr - PAGE_OFFSET)) : -1;
+    if ((addr & (PAGE_SIZE - 1)) || order < 0) {
+        kprint_str("kfree: Invalid pointer ");
+        kprint_hex((uint64_t)ptr);
+        kprint_newline();
+        return;
+    }
+
+    __sync_fetch_and_sub(&heap_large_pages, 1ULL << order);
+    pmm_free_pages((void*)(addr - PAGE_OFFSET), 1ULL << order);
+}
+
 void* kmalloc(size_t size) {
     if (size == 0) return 0;
-    
-    spinlock_acquire(&heap_lock);
 
-    size_t aligned_size = (size + 7) & ~7;
-    
-    struct heap_block* curr = free_list;
-    while (curr) {
-        if (curr->free && curr->size >= aligned_size) {
-             
-                    if (curr->size > aligned_size + HEAP_BLOCK_SIZE + 16) {
-                        struct heap_block* new_block = (struct heap_block*)((uint8_t*)curr + HEAP_BLOCK_SIZE + aligned_size);
-                        new_block->size = curr->size - aligned_size - HEAP_BLOCK_SIZE;
-                        new_block->next = curr->next;
-                        new_block->prev = curr;
-                        new_block->free = 1;
-                        new_block->magic = 0x12345678;
-                        
-                        if (new_block->next) {
-                            new_block->next->prev = new_block;
-                        }
-                        
-                        curr->size = aligned_size;
-                        curr->next = new_block;
-                    }
-            curr->free = 0;
-            spinlock_release(&heap_lock);
-            return (void*)((uint8_t*)curr + HEAP_BLOCK_SIZE);
+    size_t obj_size = size;
+#ifdef HEAP_DEBUG
+    obj_size += HEAP_DEBUG_HDR;
+#endif
+
+    if (obj_size > HEAP_MAX_SMALL) return heap_alloc_large(size);
+
+    int class_idx = size_index[(obj_size + 7) / 8];
+    struct heap_class* cls = &heap_classes[class_idx];
+
+    spinlock_acquire(&cls->lock);
+
+    struct heap_page* desc = cls->partial;
+    if (!desc) {
+        desc = heap_get_page();
+        if (!desc) {
+            spinlock_release(&cls->lock);
+            return 0;
         }
-        curr = curr->next;
+        heap_init_run(desc, class_idx);
+        heap_class_link(cls, desc);
+        cls->nr_pages++;
     }
-    spinlock_release(&heap_lock);
-    return 0;  
+
+    void* obj = desc->freelist;
+    desc->freelist = *(void**)obj;
+    desc->inuse++;
+    cls->nr_objects++;
+
+    if (!desc->freelist) heap_class_unlink(cls, desc);
+
+    spinlock_release(&cls->lock);
+
+#ifdef HEAP_DEBUG
+    struct heap_debug_hdr* hdr = (struct heap_debug_hdr*)obj;
+    hdr->magic = HEAP_MAGIC;
+    hdr->size = size;
+    obj = (uint8_t*)obj + HEAP_DEBUG_HDR;
+#endif
+
+    return obj;
 }
 
 void kfree(void* ptr) {
     if (!ptr) return;
     
-    spinlock_acquire(&heap_lock);
+    uint64_t addr = (uint64_t)ptr;
+    if (addr < heap_start || addr >= heap_end) {
+        heap_free_large(ptr);
+        return;
+    }
 
-    struct heap_block* block = (struct heap_block*)((uint8_t*)ptr - HEAP_BLOCK_SIZE);
+    struct heap_page* desc = heap_addr_to_desc(addr);
+    if (addr < heap_data_start || addr >= heap_top || desc->state != HEAP_PAGE_RUN) {
+        kprint_str("kfree: Pointer to unused heap page ");
+        kprint_hex(addr);
+        kprint_newline();
+        return;
+    }
 
-    if (block->magic != 0x12345678) {
+#ifdef HEAP_DEBUG
+    ptr = (uint8_t*)ptr - HEAP_DEBUG_HDR;
+    struct heap_debug_hdr* hdr = (struct heap_debug_hdr*)ptr;
+    if (hdr->magic != HEAP_MAGIC) {
         kprint_str("Heap Corruption Detected! Addr: ");
-        kprint_hex((uint64_t)ptr);
+        kprint_hex(addr);
         kprint_str(" Magic: ");
-        kprint_hex(block->magic);
+        kprint_hex(hdr->magic);
         kprint_str("\n");
-        spinlock_release(&heap_lock);
         return;
     }
-    
-    block->free = 1;
-    
-    if (block->next && block->next->free) {
-        block->size += HEAP_BLOCK_SIZE + block->next->size;
-        block->next = block->next->next;
-        if (block->next) {
-            block->next->prev = block;
-        }
-    }
-    
-    if (block->prev && block->prev->free) {
-        block->prev->size += HEAP_BLOCK_SIZE + block->size;
-        block->prev->next = block->next;
-        if (block->next) {
-            block->next->prev = block->prev;
-        }
-         
+    hdr->magic = 0;
+#endif
+
+    struct heap_class* cls = &heap_classes[desc->class_idx];
+
+    spinlock_acquire(&cls->lock);
+
+    int was_full = (desc->freelist == 0);
+    *(void**)ptr = desc->freelist;
+    desc->freelist = ptr;
+    desc->inuse--;
+    cls->nr_objects--;
+
+    if (was_full) heap_class_link(cls, desc);
+
+    if (desc->inuse == 0 && (desc->prev || desc->next)) {
+        heap_class_unlink(cls, desc);
+        cls->nr_pages--;
+        spinlock_release(&cls->lock);
+        heap_put_page(desc);
+        return;
     }
     
-    spinlock_release(&heap_lock);
+    spinlock_release(&cls->lock);
 }
 
 void heap_dump_stats() {
-    spinlock_acquire(&heap_lock);
     kprint_str("Heap Statistics:\n");
-    struct heap_block* curr = free_list;
-    int count = 0;
-    size_t total_free = 0;
-    
-    while (curr) {
-        if (curr->free) {
-            count++;
-            total_free += curr->size;
-        }
-        curr = curr->next;
+
+    for (int i = 0; i < HEAP_NR_CLASSES; i++) {
+        struct heap_class* cls = &heap_classes[i];
+        if (!cls->nr_pages) continue;
+        kprint_str("kmalloc-");
+        kprint_dec(heap_class_size[i]);
+        kprint_str(": Pages: ");
+        kprint_dec(cls->nr_pages);
+        kprint_str(" Objects: ");
+        kprint_dec(cls->nr_objects);
+        kprint_newline();
     }
-    
-    kprint_str("Free Blocks: ");
-    kprint_dec(count);
-    kprint_str("\nTotal Free Bytes: ");
-    kprint_dec(total_free);
+
+    kprint_str("Mapped Pages: ");
+    kprint_dec((heap_top - heap_data_start) / PAGE_SIZE - heap_unmapped_count);
+    kprint_str("\nFree Pages: ");
+    kprint_dec(heap_free_count);
+    kprint_str("\nLarge Pages: ");
+    kprint_dec(heap_large_pages);
     kprint_newline();
-    spinlock_release(&heap_lock);
 }
+
+#ifdef HEAP_DEBUG
+void heap_self_test() {
+    uint64_t large_size = (PMM_MAX_ALLOC_PAGES / 2) * PAGE_SIZE;
+    uint64_t large_before = heap_large_pages;
+    int ok = 1;
+
+    uint8_t* small = (uint8_t*)kmalloc(64);
+    if (small) {
+        struct heap_debug_hdr* hdr = (struct heap_debug_hdr*)(small - HEAP_DEBUG_HDR);
+        if (hdr->magic != HEAP_MAGIC || hdr->size != 64) ok = 0;
+        memset(small, 0xA5, 64);
+        kfree(small);
+    } else {
+        ok = 0;
+    }
+
+    uint8_t* large = (uint8_t*)kmalloc(large_size);
+    if (large) {
+        large[0] = 1;
+        large[large_size - 1] = 1;
+        if (heap_large_pages - large_before != PMM_MAX_ALLOC_PAGES / 2) ok = 0;
+        kfree(large);
+        if (heap_large_pages != large_before) ok = 0;
+    } else {
+        ok = 0;
+    }
+
+    kprint_str("Heap self-test (");
+    kprint_dec(large_size / 1024);
+    kprint_str(" KB large): ");
+    kprint_str(ok ? "passed\n" : "FAILED\n");
+}
+#endif
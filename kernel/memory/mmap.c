@@ -0,0 +1,447 @@
+#include "mm/mmap.h"
+#include "mm/page_cache.h"
+#include "mm/huge_memory.h"
+#include "mm/rmap.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "vfs.h"
+#include "slab.h"
+#include "string.h"
+#include "process.h"
+#include "console.h"
+
+#define MMAP_BASE 0x10000000000ULL
+
+static struct kmem_cache* vma_cachep;
+
+void vma_cache_init() {
+    vma_cachep = kmem_cache_create("vm_area_struct", sizeof(struct vm_area_struct), 0, SLAB_PANIC, 0);
+}
+
+void mm_init_vmas(struct mm_struct* mm) {
+    mm->mmap = 0;
+    mm->mm_rb.rb_node = 0;
+    mm->mmap_cache = 0;
+    mm->map_count = 0;
+    mm->total_vm = 0;
+}
+
+struct vm_area_struct* find_vma(struct mm_struct* mm, uint64_t addr) {
+    struct vm_area_struct* vma = mm->mmap_cache;
+    if (vma && vma->vm_start <= addr && vma->vm_end > addr) return vma;
+
+    struct rb_node* node = mm->mm_rb.rb_node;
+    vma = 0;
+    while (node) {
+        struct vm_area_struct* tmp = rb_entry(node, struct vm_area_struct, vm_rb);
+        if (tmp->vm_end > addr) {
+            vma = tmp;
+            if (tmp->vm_start <= addr) break;
+            node = node->rb_left;
+        } else {
+            node = node->rb_right;
+        }
+    }
+
+    if (vma) mm->mmap_cache = vma;
+    return vma;
+}
+
+static void vma_link(struct mm_struct* mm, struct vm_area_struct* vma) {
+    struct rb_node** link = &mm->mm_rb.rb_node;
+    struct rb_node* parent = 0;
+    struct vm_area_struct* prev = 0;
+
+    while (*link) {
+        struct vm_area_struct* tmp = rb_entry(*link, struct vm_area_struct, vm_rb);
+        parent = *link;
+        if (vma->vm_start < tmp->vm_start) {
+            link = &parent->rb_left;
+        } else {
+            prev = tmp;
+            link = &parent->rb_right;
+        }
+    }
+    rb_link_node(&vma->vm_rb, parent, link);
+    rb_insert_color(&vma->vm_rb, &mm->mm_rb);
+
+    vma->vm_prev = prev;
+    vma->vm_next = prev ? prev->vm_next : mm->mmap;
+    if (vma->vm_next) vma->vm_next->vm_prev = vma;
+    if (prev) prev->vm_next = vma;
+    else mm->mmap = vma;
+
+    mm->map_count++;
+    mm->total_vm += (vma->vm_end - vma->vm_start) >> 12;
+    vma_link_rmap(vma);
+}
+
+static void vma_unlink(struct mm_struct* mm, struct vm_area_struct* vma) {
+    rb_erase(&vma->vm_rb, &mm->mm_rb);
+
+    if (vma->vm_prev) vma->vm_prev->vm_next = vma->vm_next;
+    else mm->mmap = vma->vm_next;
+    if (vma->vm_next) vma->vm_next->vm_prev = vma->vm_prev;
+
+    if (mm->mmap_cache == vma) mm->mmap_cache = 0;
+    mm->map_count--;
+    mm->total_vm -= (vma->vm_end - vma->vm_start) >> 12;
+}
+
+static void vma_free(struct vm_area_struct* vma) {
+    vma_unlink_rmap(vma);
+    if (vma->vm_file) fput(vma->vm_file);
+    kmem_cache_free(vma_cachep, vma);
+}
+
+int mmap_region(struct mm_struct* mm, uint64_t start, uint64_t len, uint64_t flags, struct file* file, uint64_t pgoff) {
+    uint64_t end = start + len;
+
+    if (!mm || !len || (start | len) & (PAGE_SIZE - 1)) return -1;
+    if (!vmm_user_range(start, len)) return -1;
+
+    struct vm_area_struct* next = find_vma(mm, start);
+    if (next && next->vm_start < end) return -1;
+
+    struct vm_area_struct* vma = (struct vm_area_struct*)kmem_cache_alloc(vma_cachep, 0);
+    if (!vma) return -1;
+
+    vma->vm_start = start;
+    vma->vm_end = end;
+    vma->vm_flags = flags;
+    vma->vm_file = file;
+    vma->vm_pgoff = file ? pgoff : start >> 12;
+    vma->vm_mm = mm;
+    vma->anon_vma = 0;
+    if (file) file->f_count++;
+
+    vma_link(mm, vma);
+    return 0;
+}
+
+int dup_mmap(struct mm_struct* mm, struct mm_struct* oldmm) {
+    for (struct vm_area_struct* old = oldmm->mmap; old; old = old->vm_next) {
+        struct vm_area_struct* vma = (struct vm_area_struct*)kmem_cache_alloc(vma_cachep, 0);
+        if (!vma) return -1;
+
+        *vma = *old;
+        vma->vm_mm = mm;
+        if (vma->vm_file) vma->vm_file->f_count++;
+        vma_link(mm, vma);
+    }
+    return 0;
+}
+
+static void vma_writeback(struct vm_area_struct* vma) {
+    struct file* file = vma->vm_file;
+    if (!file || (vma->vm_flags & (VM_SHARED | VM_WRITE)) != (VM_SHARED | VM_WRITE)) return;
+    if (!file->f_op || !file->f_op->write) return;
+
+    uint64_t size = file->f_dentry->d_inode->i_size;
+    for (uint64_t addr = vma->vm_start; addr < vma->vm_end; addr += PAGE_SIZE) {
+        uint64_t pte = vmm_get_pte(addr);
+        if (!(pte & PTE_PRESENT) || !(pte & PTE_DIRTY)) continue;
+
+        uint64_t pos = (vma->vm_pgoff << 12) + (addr - vma->vm_start);
+        if (pos >= size) continue;
+        uint64_t bytes = size - pos;
+        if (bytes > PAGE_SIZE) bytes = PAGE_SIZE;
+
+        file->f_op->write(file, (const char*)phys_to_virt(vmm_get_phys(addr)), (int)bytes, &pos);
+    }
+}
+
+void exit_mmap(struct mm_struct* mm) {
+    struct mmu_gather tlb;
+    struct vm_area_struct* vma;
+
+    tlb_gather_init(&tlb);
+    tlb.full_flush = 1;
+
+    for (vma = mm->mmap; vma; vma = vma->vm_next) {
+        vma_writeback(vma);
+        vmm_zap_range(&tlb, vma->vm_start, vma->vm_end - vma->vm_start, 1);
+    }
+    tlb_finish(&tlb);
+
+    for (vma = mm->mmap; vma; vma = vma->vm_next) vma_unlink_rmap(vma);
+
+    uint64_t floor = 0;
+    for (vma = mm->mmap; vma; vma = vma->vm_next) {
+        uint64_t start = vma->vm_start > floor ? vma->vm_start : floor;
+        if (start >= vma->vm_end) continue;
+        vmm_free_pgtables(&tlb, start, vma->vm_end);
+        floor = (vma->vm_end + (1ULL << 39) - 1) & ~((1ULL << 39) - 1);
+    }
+    tlb_finish(&tlb);
+
+    vma = mm->mmap;
+    while (vma) {
+        struct vm_area_struct* next = vma->vm_next;
+        vma_free(vma);
+        vma = next;
+    }
+    mm_init_vmas(mm);
+}
+
+void mm_dump_maps(struct mm_struct* mm) {
+    uint64_t resident = 0;
+
+    for (struct vm_area_struct* vma = mm->mmap; vma; vma = vma->vm_next) {
+        for (uint64_t addr = vma->vm_start; addr < vma->vm_end; addr += PAGE_SIZE) {
+            if (vmm_get_pte(addr) & PTE_PRESENT) resident++;
+        }
+
+        char perms[5];
+        perms[0] = (vma->vm_flags & VM_READ) ? 'r' : '-';
+        perms[1] = (vma->vm_flags & VM_WRITE) ? 'w' : '-';
+        perms[2] = (vma->vm_flags & VM_EXEC) ? 'x' : '-';
+        perms[3] = (vma->vm_flags & VM_SHARED) ? 's' : 'p';
+        perms[4] = 0;
+
+        kprint_hex(vma->vm_start);
+        kprint_str("-");
+        kprint_hex(vma->vm_end);
+        kprint_str(" ");
+        kprint_str(perms);
+        kprint_str(" ");
+        kprint_hex(vma->vm_file ? vma->vm_pgoff << 12 : 0);
+        if (vma->vm_file && vma->vm_file->f_dentry && vma->vm_file->f_dentry->d_name.name) {
+            kprint_str(" ");
+            kprint_str(vma->vm_file->f_dentry->d_name.name);
+        }
+        kprint_newline();
+    }
+
+    kprint_str("VMAs: ");
+    kprint_dec(mm->map_count);
+    kprint_str(" VM: ");
+    kprint_dec(mm->total_vm * 4);
+    kprint_str(" KB RSS: ");
+    kprint_dec(resident * 4);
+    kprint_str(" KB\n");
+}
+
+static int vma_split(struct vm_area_struct* vma, uint64_t addr) {
+    struct vm_area_struct* upper = (struct vm_area_struct*)kmem_cache_alloc(vma_cachep, 0);
+    if (!upper) return -1;
+
+    *upper = *vma;
+    upper->vm_start = addr;
+    upper->vm_pgoff += (addr - vma->vm_start) >> 12;
+    if (upper->vm_file) upper->vm_file->f_count++;
+
+    vma->vm_end = addr;
+    vma->vm_mm->total_vm -= (upper->vm_end - addr) >> 12;
+    vma_link(vma->vm_mm, upper);
+    return 0;
+}
+
+static int vma_split_range(struct mm_struct* mm, uint64_t start, uint64_t end) {
+    struct vm_area_struct* vma = find_vma(mm, start);
+    if (vma && vma->vm_start < start && vma_split(vma, start) != 0) return -1;
+
+    vma = find_vma(mm, end);
+    if (vma && vma->vm_start < end && vma_split(vma, end) != 0) return -1;
+    return 0;
+}
+
+static uint64_t get_unmapped_area(struct mm_struct* mm, uint64_t hint, uint64_t len) {
+    uint64_t addr = (hint + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    if (addr < MMAP_BASE) addr = MMAP_BASE;
+
+    while (addr + len > addr && addr + len <= USER_SPACE_END) {
+        if (!vmm_user_range(addr, len)) {
+            addr = (addr + (1ULL << 39)) & ~((1ULL << 39) - 1);
+            continue;
+        }
+
+        struct vm_area_struct* vma = find_vma(mm, addr);
+        if (!vma || vma->vm_start >= addr + len) return addr;
+        addr = vma->vm_end;
+    }
+    return 0;
+}
+
+static uint64_t prot_to_vm_flags(uint64_t prot) {
+    uint64_t flags = 0;
+    if (prot & PROT_READ) flags |= VM_READ;
+    if (prot & PROT_WRITE) flags |= VM_WRITE;
+    if (prot & PROT_EXEC) flags |= VM_EXEC;
+    return flags;
+}
+
+int do_munmap(struct mm_struct* mm, uint64_t start, uint64_t len) {
+    len = (len + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t end = start + len;
+
+    if ((start & (PAGE_SIZE - 1)) || !vmm_user_range(start, len)) return -1;
+    if (vma_split_range(mm, start, end) != 0) return -1;
+
+    for (struct vm_area_struct* vma = find_vma(mm, start); vma && vma->vm_start < end; vma = vma->vm_next) {
+        vma_writeback(vma);
+    }
+
+    struct mmu_gather tlb;
+    tlb_gather_init(&tlb);
+    int ret = vmm_zap_range(&tlb, start, len, 1);
+    tlb_finish(&tlb);
+    if (ret != 0) return ret;
+
+    struct vm_area_struct* vma = find_vma(mm, start);
+    while (vma && vma->vm_start < end) {
+        struct vm_area_struct* next = vma->vm_next;
+        vma_unlink(mm, vma);
+        vma_free(vma);
+        vma = next;
+    }
+    return 0;
+}
+
+int do_mprotect(struct mm_struct* mm, uint64_t start, uint64_t len, uint64_t prot) {
+    len = (len + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t end = start + len;
+
+    if ((start & (PAGE_SIZE - 1)) || !vmm_user_range(start, len)) return -1;
+
+    uint64_t covered = start;
+    for (struct vm_area_struct* vma = find_vma(mm, start); vma && covered < end; vma = vma->vm_next) {
+        if (vma->vm_start > covered) break;
+        covered = vma->vm_end;
+    }
+    if (covered < end) return -1;
+
+    if (vma_split_range(mm, start, end) != 0) return -1;
+
+    uint64_t access = prot_to_vm_flags(prot);
+    for (struct vm_area_struct* vma = find_vma(mm, start); vma && vma->vm_start < end; vma = vma->vm_next) {
+        uint64_t set = 0;
+        uint64_t clear = 0;
+
+        if (access) set |= PTE_USER;
+        else clear |= PTE_USER;
+
+        if (!(access & VM_WRITE)) clear |= PTE_WRITABLE | PTE_COW;
+        else if (vma->vm_flags & VM_SHARED) set |= PTE_WRITABLE;
+        else set |= PTE_COW;
+
+        int ret = vmm_protect_range(vma->vm_start, vma->vm_end - vma->vm_start, set, clear);
+        if (ret != 0) return ret;
+        vma->vm_flags = (vma->vm_flags & ~(uint64_t)(VM_READ | VM_WRITE | VM_EXEC)) | access;
+    }
+    return 0;
+}
+
+static int do_file_fault(struct vm_area_struct* vma, uint64_t addr, uint64_t err_code, uint64_t flags) {
+    uint64_t index = vma->vm_pgoff + ((addr - vma->vm_start) >> 12);
+    struct page* page = filemap_fault(vma->vm_file, index);
+    if (!page) return -1;
+
+    uint64_t phys = virt_to_phys(page->virtual);
+
+    if (!(vma->vm_flags & VM_SHARED) && (err_code & 2)) {
+        void* copy = anon_vma_prepare(vma) == 0 ? pmm_alloc_page() : 0;
+        if (!copy) {
+            put_page(page);
+            return -1;
+        }
+        memcpy(phys_to_virt((uint64_t)copy), page->virtual, PAGE_SIZE);
+        vmm_map_page(addr, (uint64_t)copy, flags | PTE_WRITABLE);
+        page_add_anon_rmap(phys_to_page((uint64_t)copy), vma, addr);
+    } else {
+        if (vma->vm_flags & VM_SHARED) {
+            if (vma->vm_flags & VM_WRITE) flags |= PTE_WRITABLE;
+        } else if (vma->vm_flags & VM_WRITE) {
+            flags |= PTE_COW;
+        }
+        pmm_page_ref((void*)phys);
+        vmm_map_page(addr, phys, flags);
+    }
+
+    put_page(page);
+    return 0;
+}
+
+int handle_mm_fault(struct mm_struct* mm, uint64_t addr, uint64_t err_code) {
+    if (!mm) return -1;
+
+    struct vm_area_struct* vma = find_vma(mm, addr);
+    if (!vma || vma->vm_start > addr) return -1;
+    if (!(vma->vm_flags & (VM_READ | VM_WRITE | VM_EXEC))) return -1;
+    if ((err_code & 2) && !(vma->vm_flags & VM_WRITE)) return -1;
+
+    if (err_code & 1) {
+        if (!(err_code & 2) || anon_vma_prepare(vma) != 0) return -1;
+        if (vmm_handle_cow_fault(addr, err_code) != 0) return -1;
+
+        addr &= (vmm_get_pte(addr) & PTE_HUGE) ? ~(HUGE_PAGE_SIZE_2M - 1) : ~(uint64_t)(PAGE_SIZE - 1);
+        struct page* page = phys_to_page(vmm_get_phys(addr));
+        if (!page->mapping || PageAnon(page)) page_add_anon_rmap(page, vma, addr);
+        return 0;
+    }
+
+    addr &= ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t flags = PTE_PRESENT | PTE_USER;
+
+    if (vma->vm_file) return do_file_fault(vma, addr, err_code, flags);
+    if (anon_vma_prepare(vma) != 0) return -1;
+    if (do_huge_anonymous_fault(vma, addr, flags) == 0) return 0;
+
+    void* frame = pmm_alloc_page_gfp(__GFP_ZERO);
+    if (!frame) return -1;
+
+    if (vma->vm_flags & VM_WRITE) flags |= PTE_WRITABLE;
+    vmm_map_page(addr, (uint64_t)frame, flags);
+    page_add_anon_rmap(phys_to_page((uint64_t)frame), vma, addr);
+    return 0;
+}
+
+uint64_t sys_mmap(uint64_t addr, uint64_t len, uint64_t prot, uint64_t flags, int fd, uint64_t offset) {
+    struct mm_struct* mm = current_process->mm;
+    uint64_t type = flags & (MAP_SHARED | MAP_PRIVATE);
+
+    if (!mm || !len || (offset & (PAGE_SIZE - 1))) return MAP_FAILED;
+    if (type != MAP_SHARED && type != MAP_PRIVATE) return MAP_FAILED;
+
+    len = (len + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t vm_flags = prot_to_vm_flags(prot);
+    if (type == MAP_SHARED) vm_flags |= VM_SHARED;
+
+    struct file* file = 0;
+    if (!(flags & MAP_ANONYMOUS)) {
+        file = fget(fd);
+        if (!file) return MAP_FAILED;
+    } else {
+        vm_flags &= ~(uint64_t)VM_SHARED;
+        offset = 0;
+    }
+
+    if (flags & MAP_FIXED) {
+        if ((addr & (PAGE_SIZE - 1)) || do_munmap(mm, addr, len) != 0) addr = 0;
+    } else {
+        addr = get_unmapped_area(mm, addr, len);
+    }
+
+    if (!addr || mmap_region(mm, addr, len, vm_flags, file, offset >> 12) != 0) {
+        if (file) fput(file);
+        return MAP_FAILED;
+    }
+    if (file) fput(file);
+
+    struct vm_area_struct* vma = find_vma(mm, addr);
+    if (file && file->f_op && file->f_op->mmap && file->f_op->mmap(file, vma) != 0) {
+        do_munmap(mm, addr, len);
+        return MAP_FAILED;
+    }
+    return addr;
+}
+
+int sys_munmap(uint64_t addr, uint64_t len) {
+    if (!current_process->mm || !len) return -1;
+    return do_munmap(current_process->mm, addr, len);
+}
+
+int sys_mprotect(uint64_t addr, uint64_t len, uint64_t prot) {
+    if (!current_process->mm || !len) return -1;
+    return do_mprotect(current_process->mm, addr, len, prot);
+}
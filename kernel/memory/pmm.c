@@ -1,14 +1,71 @@
 #include "pmm.h"
+#include "vmm.h"
 #include "console.h"
+#include "string.h"
+#include "spinlock.h"
+#include "mm/vmscan.h"
+#include "mm/page.h"
+#include "mm/numa.h"
+#include "mm/compaction.h"
+#include "acpi.h"
 
 extern uint64_t _kernel_end;  
 
+#define PMM_FRAME_FREE 0x80
+
+struct pmm_free_block {
+    struct pmm_free_block* next;
+    struct pmm_free_block* prev;
+};
+
+struct pmm_free_area {
+    struct pmm_free_block* head;
+    uint64_t nr_free;
+};
+
+#define PMM_PCP_HOT 0
+#define PMM_PCP_COLD 1
+
+struct pmm_pcp_list {
+    uint64_t count;
+    void* pages[PMM_PCP_HIGH];
+};
+
+struct pmm_pcp {
+    struct pmm_pcp_list lists[2];
+    struct pmm_pcp_stats stats;
+};
+
+struct pmm_node {
+    struct pmm_free_area free_area[PMM_MAX_ORDER + 1];
+    uint64_t start_pfn;
+    uint64_t end_pfn;
+    uint64_t managed_pages;
+    uint64_t free_pages;
+    uint64_t watermark[3];
+    struct pmm_node_stats stats;
+};
+
 static uint8_t* bitmap __attribute__((section(".data")));
+static uint8_t* frame_order __attribute__((section(".data")));
+static uint8_t* frame_node __attribute__((section(".data")));
 static uint64_t total_pages __attribute__((section(".data"))) = 0;
+struct page* mem_map __attribute__((section(".data")));
+uint64_t max_pfn __attribute__((section(".data"))) = 0;
 static uint64_t bitmap_size __attribute__((section(".data"))) = 0;
 static uint64_t highest_addr __attribute__((section(".data"))) = 0;
 static uint64_t free_memory __attribute__((section(".data"))) = 0;
-static uint64_t last_free_index __attribute__((section(".data"))) = 0;  
+static struct pmm_node nodes[MAX_NUMNODES] __attribute__((section(".data")));
+static struct pmm_pcp pcp[PMM_NR_CPUS] __attribute__((section(".data")));
+static spinlock_t pmm_lock;
+static pmm_shrinker_t shrinkers[PMM_MAX_SHRINKERS];
+static int nr_shrinkers = 0;
+static volatile int shrinking = 0;
+static uint64_t watermark[3];
+static void* zero_pool[PMM_ZERO_POOL_MAX];
+static uint64_t zero_pool_nr = 0;
+static uint64_t zero_pool_hits = 0;
+static uint64_t zero_pool_misses = 0;
 
 void pmm_set_bit(uint64_t bit) {
     bitmap[bit / 8] |= (1 << (bit % 8));
@@ -27,31 +84,295 @@ uint64_t pmm_get_total_memory() {
 }
 
 uint64_t pmm_get_free_memory() {
-    return free_memory;
+    uint64_t cached = 0;
+    for (int cpu = 0; cpu < PMM_NR_CPUS; cpu++) {
+        cached += pcp[cpu].lists[PMM_PCP_HOT].count + pcp[cpu].lists[PMM_PCP_COLD].count;
+    }
+    return free_memory + cached * PAGE_SIZE;
 }
- 
-int64_t pmm_find_first_free() {
-     
-    for (uint64_t i = last_free_index; i < total_pages; i++) {
-        if (!pmm_test_bit(i)) {
-            last_free_index = i;
-            return i;
+
+uint64_t pmm_watermark(int level) {
+    return watermark[level];
+}
+
+int pmm_watermark_ok(int level) {
+    return pmm_get_free_memory() / PAGE_SIZE >= watermark[level];
+}
+
+int pmm_node_watermark_ok(int nid, int level) {
+    if (nid < 0 || nid >= nr_node_ids) return 0;
+    return nodes[nid].free_pages >= nodes[nid].watermark[level];
+}
+
+static void pmm_setup_watermarks() {
+    for (int level = 0; level < 3; level++) watermark[level] = 0;
+
+    for (int nid = 0; nid < nr_node_ids; nid++) {
+        struct pmm_node* node = &nodes[nid];
+        uint64_t min = node->free_pages / 256;
+        if (min < 32) min = 32;
+        if (min > 4096) min = 4096;
+
+        node->watermark[PMM_WMARK_MIN] = min;
+        node->watermark[PMM_WMARK_LOW] = min + min / 4;
+        node->watermark[PMM_WMARK_HIGH] = min + min / 2;
+        for (int level = 0; level < 3; level++) watermark[level] += node->watermark[level];
+    }
+}
+
+static inline int pmm_cpu_id() {
+    return 0;
+}
+
+static inline struct pmm_free_block* pmm_block_ptr(uint64_t pfn) {
+    return (struct pmm_free_block*)phys_to_virt(pfn * PAGE_SIZE);
+}
+
+static inline uint64_t pmm_block_pfn(struct pmm_free_block* block) {
+    return ((uint64_t)block - PAGE_OFFSET) / PAGE_SIZE;
+}
+
+static void pmm_list_add(uint64_t pfn, unsigned int order) {
+    struct pmm_free_block* block = pmm_block_ptr(pfn);
+    struct pmm_free_area* area = &nodes[frame_node[pfn]].free_area[order];
+
+    block->prev = 0;
+    block->next = area->head;
+    if (area->head) area->head->prev = block;
+    area->head = block;
+    area->nr_free++;
+
+    frame_order[pfn] = PMM_FRAME_FREE | order;
+}
+
+static void pmm_list_del(uint64_t pfn, unsigned int order) {
+    struct pmm_free_block* block = pmm_block_ptr(pfn);
+    struct pmm_free_area* area = &nodes[frame_node[pfn]].free_area[order];
+
+    if (block->prev) block->prev->next = block->next;
+    else area->head = block->next;
+    if (block->next) block->next->prev = block->prev;
+    area->nr_free--;
+
+    frame_order[pfn] = 0;
+}
+
+static void pmm_free_block(uint64_t pfn, unsigned int order) {
+    if (frame_order[pfn] & PMM_FRAME_FREE) {
+        kprint_str("PMM Error: Double free of frame ");
+        kprint_hex(pfn * PAGE_SIZE);
+        kprint_newline();
+        return;
+    }
+
+    struct pmm_node* node = &nodes[frame_node[pfn]];
+    free_memory += (PAGE_SIZE << order);
+    node->free_pages += (1ULL << order);
+    node->stats.frees += (1ULL << order);
+
+    while (order < PMM_MAX_ORDER) {
+        uint64_t buddy = pfn ^ (1ULL << order);
+        if (buddy + (1ULL << order) > total_pages) break;
+        if (frame_order[buddy] != (PMM_FRAME_FREE | order)) break;
+        if (frame_node[buddy] != frame_node[pfn]) break;
+
+        pmm_list_del(buddy, order);
+        if (buddy < pfn) pfn = buddy;
+        order++;
+    }
+
+    pmm_list_add(pfn, order);
+}
+
+static void pmm_free_range(uint64_t pfn, uint64_t count) {
+    while (count > 0) {
+        unsigned int order = 0;
+        while (order < PMM_MAX_ORDER &&
+               !(pfn & (1ULL << order)) &&
+               (2ULL << order) <= count) {
+            order++;
         }
+        pmm_free_block(pfn, order);
+        pfn += (1ULL << order);
+        count -= (1ULL << order);
     }
-    
-    for (uint64_t i = 0; i < last_free_index; i++) {
-        if (!pmm_test_bit(i)) {
-            last_free_index = i;
-            return i;
+}
+
+static int64_t pmm_node_alloc_block(int nid, unsigned int order) {
+    struct pmm_node* node = &nodes[nid];
+    unsigned int current = order;
+    while (current <= PMM_MAX_ORDER && !node->free_area[current].head) {
+        current++;
+    }
+    if (current > PMM_MAX_ORDER) return -1;
+
+    uint64_t pfn = pmm_block_pfn(node->free_area[current].head);
+    pmm_list_del(pfn, current);
+
+    while (current > order) {
+        current--;
+        pmm_list_add(pfn + (1ULL << current), current);
+    }
+
+    frame_order[pfn] = order;
+    free_memory -= (PAGE_SIZE << order);
+    node->free_pages -= (1ULL << order);
+    return pfn;
+}
+
+static void pmm_count_alloc(int preferred, int nid, unsigned int order) {
+    uint64_t pages = 1ULL << order;
+
+    if (nid == preferred) {
+        nodes[nid].stats.numa_hit += pages;
+    } else {
+        nodes[nid].stats.numa_miss += pages;
+        nodes[preferred].stats.numa_foreign += pages;
+    }
+    if (nid == numa_node_id()) nodes[nid].stats.local_node += pages;
+    else nodes[nid].stats.other_node += pages;
+}
+
+static int64_t pmm_alloc_block(int preferred, unsigned int order) {
+    if (preferred < 0 || preferred >= nr_node_ids) preferred = numa_node_id();
+
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < nr_node_ids; i++) {
+            int nid = node_fallback(preferred, i);
+            if (pass == 0 && nodes[nid].free_pages < nodes[nid].watermark[PMM_WMARK_LOW] + (1ULL << order)) {
+                continue;
+            }
+
+            int64_t pfn = pmm_node_alloc_block(nid, order);
+            if (pfn == -1) continue;
+
+            pmm_count_alloc(preferred, nid, order);
+            return pfn;
         }
     }
-    
     return -1;
 }
 
+static unsigned int pmm_count_to_order(uint64_t count) {
+    unsigned int order = 0;
+    while ((1ULL << order) < count) order++;
+    return order;
+}
+
+static uint64_t pmm_early_alloc_table() {
+    static uint64_t next_frame = 1;
+    uint64_t limit = 0x100000000 / PAGE_SIZE;
+    if (limit > total_pages) limit = total_pages;
+
+    for (; next_frame < limit; next_frame++) {
+        if (!pmm_test_bit(next_frame)) {
+            pmm_set_bit(next_frame);
+            memset((void*)(next_frame * PAGE_SIZE), 0, PAGE_SIZE);
+            return (next_frame++) * PAGE_SIZE;
+        }
+    }
+    return 0;
+}
+
+static void pmm_init_page(struct page* page, uint64_t pfn) {
+    page->flags = 0;
+    page->_count = 0;
+    page->_mapcount = 0;
+    page->mapping = 0;
+    page->index = 0;
+    page->private = 0;
+    INIT_LIST_HEAD(&page->lru);
+    page->virtual = phys_to_virt(pfn * PAGE_SIZE);
+}
+
+static void pmm_node_init() {
+    for (uint64_t i = 0; i < total_pages; i++) frame_node[i] = 0;
+
+    for (int i = 0; i < numa_nr_memblks; i++) {
+        uint64_t start = numa_memblks[i].start / PAGE_SIZE;
+        uint64_t end = (numa_memblks[i].end + PAGE_SIZE - 1) / PAGE_SIZE;
+        if (end > total_pages) end = total_pages;
+        for (uint64_t pfn = start; pfn < end; pfn++) frame_node[pfn] = (uint8_t)numa_memblks[i].nid;
+    }
+
+    for (int nid = 0; nid < MAX_NUMNODES; nid++) {
+        struct pmm_node* node = &nodes[nid];
+        for (int i = 0; i <= PMM_MAX_ORDER; i++) {
+            node->free_area[i].head = 0;
+            node->free_area[i].nr_free = 0;
+        }
+        node->start_pfn = total_pages;
+        node->end_pfn = 0;
+        node->managed_pages = 0;
+        node->free_pages = 0;
+        memset(&node->stats, 0, sizeof(node->stats));
+    }
+
+    for (uint64_t pfn = 0; pfn < total_pages; pfn++) {
+        struct pmm_node* node = &nodes[frame_node[pfn]];
+        if (pfn < node->start_pfn) node->start_pfn = pfn;
+        if (pfn + 1 > node->end_pfn) node->end_pfn = pfn + 1;
+    }
+}
+
+static void pmm_buddy_init() {
+    for (uint64_t i = 0; i < total_pages; i++) {
+        frame_order[i] = 0;
+        pmm_init_page(&mem_map[i], i);
+    }
+
+    free_memory = 0;
+
+    uint64_t run_start = 0;
+    uint64_t run_len = 0;
+    for (uint64_t i = 0; i < total_pages; i++) {
+        if (run_len && (pmm_test_bit(i) || frame_node[i] != frame_node[run_start])) {
+            pmm_free_range(run_start, run_len);
+            run_len = 0;
+        }
+        if (!pmm_test_bit(i)) {
+            if (run_len == 0) run_start = i;
+            run_len++;
+        }
+    }
+    if (run_len) pmm_free_range(run_start, run_len);
+
+    for (int nid = 0; nid < nr_node_ids; nid++) {
+        nodes[nid].managed_pages = nodes[nid].free_pages;
+        memset(&nodes[nid].stats, 0, sizeof(nodes[nid].stats));
+    }
+    pmm_setup_watermarks();
+
+    kprint_str("PMM: Buddy allocator ready. Free: ");
+    kprint_dec(free_memory / 1024 / 1024);
+    kprint_str(" MB. Order-");
+    kprint_dec(PMM_MAX_ORDER);
+    kprint_str(" blocks: ");
+    uint64_t max_blocks = 0;
+    for (int nid = 0; nid < nr_node_ids; nid++) max_blocks += nodes[nid].free_area[PMM_MAX_ORDER].nr_free;
+    kprint_dec(max_blocks);
+    kprint_newline();
+
+    if (nr_node_ids > 1) {
+        for (int nid = 0; nid < nr_node_ids; nid++) {
+            kprint_str("PMM: Node ");
+            kprint_dec(nid);
+            kprint_str(" pfn ");
+            kprint_hex(nodes[nid].start_pfn);
+            kprint_str(" - ");
+            kprint_hex(nodes[nid].end_pfn);
+            kprint_str(" free ");
+            kprint_dec(nodes[nid].free_pages * PAGE_SIZE / 1024 / 1024);
+            kprint_str(" MB\n");
+        }
+    }
+}
+
 void pmm_init(uint64_t multiboot_addr, uint64_t magic) {
     kprint_str("Initializing PMM...\n");
 
+    spinlock_init(&pmm_lock);
+
     highest_addr = 0;
 
     if (magic == 0x2BADB002) {
@@ -99,13 +420,13 @@ void pmm_init(uint64_t multiboot_addr, uint64_t magic) {
         highest_addr = 128 * 1024 * 1024;
     }
 
-    if (highest_addr > 0x100000000) {
-         kprint_str("Warning: Memory > 4GB detected. Capping to 4GB for safety.\n");
-         highest_addr = 0x100000000;
+    if (highest_addr > DIRECT_MAP_MAX) {
+         kprint_str("Warning: Memory exceeds direct map. Capping to 64TB.\n");
+         highest_addr = DIRECT_MAP_MAX;
     }
 
     total_pages = highest_addr / PAGE_SIZE;
-    bitmap_size = total_pages / 8;
+    bitmap_size = (total_pages + 7) / 8;
 
     bitmap = (uint8_t*)PAGE_ALIGN((uint64_t)&_kernel_end);
 
@@ -136,8 +457,13 @@ void pmm_init(uint64_t multiboot_addr, uint64_t magic) {
         kprint_newline();
     }
     
-    if ((uint64_t)bitmap + bitmap_size > 0x40000000) {
-        kprint_str("CRITICAL ERROR: Bitmap exceeds identity mapped memory (1GB)!\n");
+    frame_order = bitmap + bitmap_size;
+    frame_node = frame_order + total_pages;
+    mem_map = (struct page*)(((uint64_t)frame_node + total_pages + 63) & ~63ULL);
+    max_pfn = total_pages;
+
+    if ((uint64_t)(mem_map + total_pages) > 0x100000000) {
+        kprint_str("CRITICAL ERROR: Bitmap exceeds identity mapped memory (4GB)!\n");
         while(1);
     }
 
@@ -203,8 +529,7 @@ void pmm_init(uint64_t multiboot_addr, uint64_t magic) {
          }
     }
 
-    uint64_t bitmap_start_p = (uint64_t)bitmap;
-    uint64_t bitmap_end_p = bitmap_start_p + bitmap_size;
+    uint64_t bitmap_end_p = (uint64_t)(mem_map + total_pages);
 
     uint64_t start_frame = 0; 
     uint64_t end_frame = (bitmap_end_p + PAGE_SIZE - 1) / PAGE_SIZE;
@@ -250,12 +575,18 @@ void pmm_init(uint64_t multiboot_addr, uint64_t magic) {
     kprint_hex(bitmap[1]);
     kprint_str("\n");
 
-    uint64_t reserved_end = (uint64_t)bitmap + bitmap_size;
+    uint64_t reserved_end = (uint64_t)(mem_map + total_pages);
      
     reserved_end = PAGE_ALIGN(reserved_end);
     
     uint64_t reserved_frames = reserved_end / PAGE_SIZE;
     
+    kprint_str("PMM: mem_map @ ");
+    kprint_hex((uint64_t)mem_map);
+    kprint_str(" Entries: ");
+    kprint_dec(total_pages);
+    kprint_newline();
+
     kprint_str("PMM: Reserving Kernel+Bitmap (0 - ");
     kprint_hex(reserved_end);
     kprint_str(")\n");
@@ -268,84 +599,448 @@ void pmm_init(uint64_t multiboot_addr, uint64_t magic) {
 
      
     pmm_set_bit(0);
+
+    vmm_init_direct_map(highest_addr, pmm_early_alloc_table);
+
+    acpi_init(multiboot_addr, magic);
+    numa_init();
+    pmm_node_init();
+    pmm_buddy_init();
 }
 
-void* pmm_alloc_page() {
-    int64_t bit = pmm_find_first_free();
+int pmm_register_shrinker(pmm_shrinker_t shrinker) {
+    if (nr_shrinkers >= PMM_MAX_SHRINKERS) return -1;
+    shrinkers[nr_shrinkers++] = shrinker;
+    return 0;
+}
 
-    if (bit == -1) {
-        kprint_str("PMM Alloc Error: No free pages! Total: ");
-        kprint_dec(total_pages);
-        kprint_str(" Free: ");
-        kprint_dec(free_memory);
-        kprint_newline();
-        return 0;
+uint64_t pmm_run_shrinkers() {
+    if (__sync_lock_test_and_set(&shrinking, 1)) return 0;
+
+    uint64_t freed = 0;
+    for (int i = 0; i < nr_shrinkers; i++) {
+        freed += shrinkers[i]();
     }
 
-    if (bit == 0) {
-         
-        pmm_set_bit(0);
-        return pmm_alloc_page();  
+    __sync_lock_release(&shrinking);
+    return freed;
+}
+
+static void pmm_pcp_refill(struct pmm_pcp* p, struct pmm_pcp_list* list) {
+    int nid = numa_node_id();
+
+    spinlock_acquire(&pmm_lock);
+    while (list->count < PMM_PCP_BATCH) {
+        int64_t pfn = pmm_node_alloc_block(nid, 0);
+        if (pfn == -1) break;
+        pmm_count_alloc(nid, nid, 0);
+        list->pages[list->count++] = (void*)(pfn * PAGE_SIZE);
     }
+    spinlock_release(&pmm_lock);
+    p->stats.refills++;
+}
 
-    pmm_set_bit(bit);
-    free_memory -= PAGE_SIZE;
-    
-     
-    if ((uint64_t)(bit * PAGE_SIZE) >= 0xC0000000) {
-        kprint_str("PMM Alloc Warning: Allocated > 3GB. Might fault if not mapped.\n");
+static void pmm_pcp_drain(struct pmm_pcp* p, struct pmm_pcp_list* list, uint64_t nr) {
+    if (nr > list->count) nr = list->count;
+
+    spinlock_acquire(&pmm_lock);
+    for (uint64_t i = 0; i < nr; i++) {
+        pmm_free_block((uint64_t)list->pages[i] / PAGE_SIZE, 0);
     }
-    
-    return (void*)(bit * PAGE_SIZE);
+    spinlock_release(&pmm_lock);
+
+    for (uint64_t i = nr; i < list->count; i++) {
+        list->pages[i - nr] = list->pages[i];
+    }
+    list->count -= nr;
+    p->stats.drains++;
 }
 
-void* pmm_alloc_pages(uint64_t count) {
-    if (count == 0) return 0;
-    
-     
-    for (uint64_t i = 0; i <= total_pages - count; i++) {
-        int found = 1;
-        for (uint64_t j = 0; j < count; j++) {
-            if (pmm_test_bit(i + j)) {
-                found = 0;
-                i += j;  
-                break;
-            }
+void pmm_drain_all() {
+    uint64_t flags = local_irq_save();
+    for (int cpu = 0; cpu < PMM_NR_CPUS; cpu++) {
+        pmm_pcp_drain(&pcp[cpu], &pcp[cpu].lists[PMM_PCP_HOT], PMM_PCP_HIGH);
+        pmm_pcp_drain(&pcp[cpu], &pcp[cpu].lists[PMM_PCP_COLD], PMM_PCP_HIGH);
+    }
+    local_irq_restore(flags);
+}
+
+static void* pmm_pcp_alloc(int cold) {
+    uint64_t flags = local_irq_save();
+    struct pmm_pcp* p = &pcp[pmm_cpu_id()];
+    struct pmm_pcp_list* list = &p->lists[cold];
+
+    if (list->count == 0) {
+        p->stats.misses++;
+        pmm_pcp_refill(p, list);
+        if (list->count == 0 && pmm_zero_pool_drain()) {
+            pmm_pcp_refill(p, list);
         }
-        
-        if (found) {
-            for (uint64_t j = 0; j < count; j++) {
-                pmm_set_bit(i + j);
-            }
-            free_memory -= (count * PAGE_SIZE);
-            return (void*)(i * PAGE_SIZE);
+        if (list->count == 0 && p->lists[!cold].count != 0) {
+            list = &p->lists[!cold];
         }
+        if (list->count == 0) {
+            spinlock_acquire(&pmm_lock);
+            int64_t pfn = pmm_alloc_block(numa_node_id(), 0);
+            spinlock_release(&pmm_lock);
+            local_irq_restore(flags);
+            wakeup_kswapd();
+            if (pfn != -1) return (void*)(pfn * PAGE_SIZE);
+
+            kprint_str("PMM Alloc Error: No free pages! Total: ");
+            kprint_dec(total_pages);
+            kprint_str(" Free: ");
+            kprint_dec(free_memory);
+            kprint_newline();
+            return 0;
+        }
+    } else {
+        p->stats.hits++;
     }
-    return 0;
+
+    void* page = list->pages[--list->count];
+    local_irq_restore(flags);
+
+    if (!pmm_watermark_ok(PMM_WMARK_LOW)) wakeup_kswapd();
+    return page;
 }
 
-void pmm_free_page(void* addr) {
-    uint64_t bit = (uint64_t)addr / PAGE_SIZE;
-    if (bit < total_pages) {
-        pmm_clear_bit(bit);
-        free_memory += PAGE_SIZE;
-         
-        if (bit < last_free_index) {
-            last_free_index = bit;
+static void pmm_pcp_free(void* addr, int cold) {
+    uint64_t pfn = (uint64_t)addr / PAGE_SIZE;
+    if (pfn == 0 || pfn >= total_pages) return;
+    mem_map[pfn].mapping = 0;
+
+    if (frame_node[pfn] != numa_node_id()) {
+        spinlock_acquire(&pmm_lock);
+        pmm_free_block(pfn, 0);
+        spinlock_release(&pmm_lock);
+        return;
+    }
+
+    uint64_t flags = local_irq_save();
+    struct pmm_pcp* p = &pcp[pmm_cpu_id()];
+    struct pmm_pcp_list* list = &p->lists[cold];
+
+    if (list->count >= PMM_PCP_HIGH) {
+        pmm_pcp_drain(p, list, PMM_PCP_BATCH);
+    }
+
+    list->pages[list->count++] = (void*)(pfn * PAGE_SIZE);
+    local_irq_restore(flags);
+}
+
+void* pmm_alloc_page() {
+    return pmm_pcp_alloc(PMM_PCP_HOT);
+}
+
+void* pmm_alloc_page_cold() {
+    return pmm_pcp_alloc(PMM_PCP_COLD);
+}
+
+void* pmm_alloc_page_gfp(int gfp_mask) {
+    if (!(gfp_mask & __GFP_ZERO)) return pmm_alloc_page();
+
+    void* page = 0;
+    spinlock_acquire(&pmm_lock);
+    if (zero_pool_nr) {
+        page = zero_pool[--zero_pool_nr];
+        zero_pool_hits++;
+    } else {
+        zero_pool_misses++;
+    }
+    spinlock_release(&pmm_lock);
+
+    if (page) {
+        if (!pmm_watermark_ok(PMM_WMARK_LOW)) wakeup_kswapd();
+        return page;
+    }
+
+    page = pmm_alloc_page();
+    if (page) memset(phys_to_virt((uint64_t)page), 0, PAGE_SIZE);
+    return page;
+}
+
+uint64_t pmm_zero_pool_fill(uint64_t nr) {
+    uint64_t filled = 0;
+
+    while (filled < nr && zero_pool_nr < PMM_ZERO_POOL_MAX && pmm_watermark_ok(PMM_WMARK_HIGH)) {
+        void* page = pmm_alloc_page_cold();
+        if (!page) break;
+        memset(phys_to_virt((uint64_t)page), 0, PAGE_SIZE);
+
+        spinlock_acquire(&pmm_lock);
+        if (zero_pool_nr < PMM_ZERO_POOL_MAX) {
+            zero_pool[zero_pool_nr++] = page;
+            page = 0;
+        }
+        spinlock_release(&pmm_lock);
+
+        if (page) {
+            pmm_free_page_cold(page);
+            break;
         }
+        filled++;
     }
+    return filled;
+}
+
+uint64_t pmm_zero_pool_drain() {
+    spinlock_acquire(&pmm_lock);
+    uint64_t nr = zero_pool_nr;
+    while (zero_pool_nr) {
+        pmm_free_block((uint64_t)zero_pool[--zero_pool_nr] / PAGE_SIZE, 0);
+    }
+    spinlock_release(&pmm_lock);
+    return nr;
+}
+
+uint64_t pmm_zero_pool_count() {
+    return zero_pool_nr;
+}
+
+void* pmm_alloc_pages_node(int nid, uint64_t count) {
+    if (count == 0) return 0;
+    if (count > PMM_MAX_ALLOC_PAGES) {
+        kprint_str("PMM: Request for ");
+        kprint_dec(count);
+        kprint_str(" pages exceeds max order\n");
+        return 0;
+    }
+
+    unsigned int order = pmm_count_to_order(count);
+
+    spinlock_acquire(&pmm_lock);
+    int64_t pfn = pmm_alloc_block(nid, order);
+    spinlock_release(&pmm_lock);
+
+    if (pfn == -1) {
+        pmm_zero_pool_drain();
+        pmm_drain_all();
+        spinlock_acquire(&pmm_lock);
+        pfn = pmm_alloc_block(nid, order);
+        spinlock_release(&pmm_lock);
+    }
+
+    if (pfn == -1 && order && try_to_compact_pages(nid, order)) {
+        spinlock_acquire(&pmm_lock);
+        pfn = pmm_alloc_block(nid, order);
+        spinlock_release(&pmm_lock);
+    }
+    if (pfn == -1) {
+        wakeup_kswapd();
+        return 0;
+    }
+
+    if (count < (1ULL << order)) {
+        spinlock_acquire(&pmm_lock);
+        pmm_free_range(pfn + count, (1ULL << order) - count);
+        spinlock_release(&pmm_lock);
+    }
+
+    if (!pmm_watermark_ok(PMM_WMARK_LOW)) wakeup_kswapd();
+    return (void*)(pfn * PAGE_SIZE);
+}
+
+void* pmm_alloc_pages(uint64_t count) {
+    return pmm_alloc_pages_node(numa_node_id(), count);
+}
+
+void* pmm_alloc_page_node(int nid) {
+    if (nid == NUMA_NO_NODE || nid == numa_node_id()) return pmm_alloc_page();
+    return pmm_alloc_pages_node(nid, 1);
+}
+
+void pmm_free_page(void* addr) {
+    pmm_pcp_free(addr, PMM_PCP_HOT);
+}
+
+void pmm_free_page_cold(void* addr) {
+    pmm_pcp_free(addr, PMM_PCP_COLD);
 }
 
 void pmm_free_pages(void* addr, uint64_t count) {
-    uint64_t start_bit = (uint64_t)addr / PAGE_SIZE;
-    for (uint64_t i = 0; i < count; i++) {
-        if (start_bit + i < total_pages) {
-            pmm_clear_bit(start_bit + i);
+    uint64_t pfn = (uint64_t)addr / PAGE_SIZE;
+    if (pfn == 0 || pfn >= total_pages) return;
+    if (pfn + count > total_pages) count = total_pages - pfn;
+    for (uint64_t i = 0; i < count; i++) mem_map[pfn + i].mapping = 0;
+
+    spinlock_acquire(&pmm_lock);
+    pmm_free_range(pfn, count);
+    spinlock_release(&pmm_lock);
+}
+
+void pmm_split_pages(void* addr) {
+    uint64_t pfn = (uint64_t)addr / PAGE_SIZE;
+    if (pfn == 0 || pfn >= total_pages) return;
+
+    spinlock_acquire(&pmm_lock);
+    unsigned int order = frame_order[pfn];
+    if (order && !(order & PMM_FRAME_FREE)) {
+        frame_order[pfn] = 0;
+        for (uint64_t i = 1; i < (1ULL << order) && pfn + i < total_pages; i++) {
+            mem_map[pfn + i]._mapcount = mem_map[pfn]._mapcount;
+            mem_map[pfn + i].mapping = mem_map[pfn].mapping;
+            mem_map[pfn + i].index = mem_map[pfn].index + i;
         }
     }
-    free_memory += (count * PAGE_SIZE);
-     
-    if (start_bit < last_free_index) {
-        last_free_index = start_bit;
+    spinlock_release(&pmm_lock);
+}
+
+int pmm_page_nid(void* addr) {
+    uint64_t pfn = (uint64_t)addr / PAGE_SIZE;
+    if (pfn >= total_pages) return NUMA_NO_NODE;
+    return frame_node[pfn];
+}
+
+int pmm_buddy_order(void* addr) {
+    uint64_t pfn = (uint64_t)addr / PAGE_SIZE;
+    if (pfn == 0 || pfn >= total_pages) return -1;
+    if (!(frame_order[pfn] & PMM_FRAME_FREE)) return -1;
+    return frame_order[pfn] & ~PMM_FRAME_FREE;
+}
+
+int pmm_isolate_free_block(void* addr, unsigned int max_order) {
+    uint64_t pfn = (uint64_t)addr / PAGE_SIZE;
+    if (pfn == 0 || pfn >= total_pages) return -1;
+
+    spinlock_acquire(&pmm_lock);
+    unsigned int order = frame_order[pfn];
+    if (!(order & PMM_FRAME_FREE) || (order & ~PMM_FRAME_FREE) > max_order) {
+        spinlock_release(&pmm_lock);
+        return -1;
+    }
+    order &= ~PMM_FRAME_FREE;
+
+    struct pmm_node* node = &nodes[frame_node[pfn]];
+    pmm_list_del(pfn, order);
+    free_memory -= (PAGE_SIZE << order);
+    node->free_pages -= (1ULL << order);
+    spinlock_release(&pmm_lock);
+    return order;
+}
+
+uint64_t pmm_node_free_blocks(int nid, unsigned int order) {
+    if (nid < 0 || nid >= nr_node_ids) return 0;
+
+    uint64_t nr = 0;
+    spinlock_acquire(&pmm_lock);
+    for (unsigned int i = order; i <= PMM_MAX_ORDER; i++) {
+        nr += nodes[nid].free_area[i].nr_free << (i - order);
+    }
+    spinlock_release(&pmm_lock);
+    return nr;
+}
+
+void pmm_node_span(int nid, uint64_t* start_pfn, uint64_t* end_pfn) {
+    if (nid < 0 || nid >= nr_node_ids) {
+        *start_pfn = *end_pfn = 0;
+        return;
+    }
+    *start_pfn = nodes[nid].start_pfn;
+    *end_pfn = nodes[nid].end_pfn;
+}
+
+int pmm_get_order(void* addr) {
+    uint64_t pfn = (uint64_t)addr / PAGE_SIZE;
+    if (pfn == 0 || pfn >= total_pages) return -1;
+    if (frame_order[pfn] & PMM_FRAME_FREE) return -1;
+    return frame_order[pfn];
+}
+
+void pmm_page_ref(void* addr) {
+    uint64_t pfn = (uint64_t)addr / PAGE_SIZE;
+    if (pfn == 0 || pfn >= total_pages) return;
+    __sync_fetch_and_add(&mem_map[pfn]._mapcount, 1);
+}
+
+int pmm_page_unref(void* addr) {
+    uint64_t pfn = (uint64_t)addr / PAGE_SIZE;
+    if (pfn == 0 || pfn >= total_pages) return 1;
+
+    while (1) {
+        int refs = mem_map[pfn]._mapcount;
+        if (refs <= 0) return 1;
+        if (__sync_bool_compare_and_swap(&mem_map[pfn]._mapcount, refs, refs - 1)) return 0;
+    }
+}
+
+int pmm_page_count(void* addr) {
+    uint64_t pfn = (uint64_t)addr / PAGE_SIZE;
+    if (pfn == 0 || pfn >= total_pages) return 1;
+    return mem_map[pfn]._mapcount + 1;
+}
+
+void pmm_get_pcp_stats(int cpu, struct pmm_pcp_stats* stats) {
+    if (cpu < 0 || cpu >= PMM_NR_CPUS || !stats) return;
+
+    uint64_t flags = local_irq_save();
+    *stats = pcp[cpu].stats;
+    stats->hot_count = pcp[cpu].lists[PMM_PCP_HOT].count;
+    stats->cold_count = pcp[cpu].lists[PMM_PCP_COLD].count;
+    local_irq_restore(flags);
+}
+
+void pmm_dump_pcp_stats() {
+    struct pmm_pcp_stats stats;
+    for (int cpu = 0; cpu < PMM_NR_CPUS; cpu++) {
+        pmm_get_pcp_stats(cpu, &stats);
+        kprint_str("PMM PCP CPU");
+        kprint_dec(cpu);
+        kprint_str(": Hits: ");
+        kprint_dec(stats.hits);
+        kprint_str(" Misses: ");
+        kprint_dec(stats.misses);
+        kprint_str(" Refills: ");
+        kprint_dec(stats.refills);
+        kprint_str(" Drains: ");
+        kprint_dec(stats.drains);
+        kprint_str(" Hot: ");
+        kprint_dec(stats.hot_count);
+        kprint_str(" Cold: ");
+        kprint_dec(stats.cold_count);
+        kprint_newline();
+    }
+    kprint_str("PMM Zero Pool: ");
+    kprint_dec(zero_pool_nr);
+    kprint_str(" Hits: ");
+    kprint_dec(zero_pool_hits);
+    kprint_str(" Misses: ");
+    kprint_dec(zero_pool_misses);
+    kprint_newline();
+}
+
+void pmm_get_node_stats(int nid, struct pmm_node_stats* stats) {
+    if (nid < 0 || nid >= nr_node_ids || !stats) return;
+
+    spinlock_acquire(&pmm_lock);
+    *stats = nodes[nid].stats;
+    stats->managed_pages = nodes[nid].managed_pages;
+    stats->free_pages = nodes[nid].free_pages;
+    spinlock_release(&pmm_lock);
+}
+
+void pmm_dump_node_stats() {
+    struct pmm_node_stats stats;
+    for (int nid = 0; nid < nr_node_ids; nid++) {
+        pmm_get_node_stats(nid, &stats);
+        kprint_str("PMM Node");
+        kprint_dec(nid);
+        kprint_str(": Free: ");
+        kprint_dec(stats.free_pages);
+        kprint_str("/");
+        kprint_dec(stats.managed_pages);
+        kprint_str(" Hit: ");
+        kprint_dec(stats.numa_hit);
+        kprint_str(" Miss: ");
+        kprint_dec(stats.numa_miss);
+        kprint_str(" Foreign: ");
+        kprint_dec(stats.numa_foreign);
+        kprint_str(" Local: ");
+        kprint_dec(stats.local_node);
+        kprint_str(" Other: ");
+        kprint_dec(stats.other_node);
+        kprint_str(" Freed: ");
+        kprint_dec(stats.frees);
+        kprint_newline();
     }
 }
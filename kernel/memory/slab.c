@@ -0,0 +1,289 @@
+#include "slab.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "string.h"
+#include "console.h"
+
+#define BUFCTL_END 0xFFFF
+
+struct slab {
+    struct list_head list;
+    struct kmem_cache *cache;
+    void *s_mem;
+    unsigned int inuse;
+    unsigned int free;
+    unsigned int colour_off;
+    uint16_t bufctl[];
+};
+
+static struct kmem_cache cache_cache;
+static LIST_HEAD(cache_chain);
+static spinlock_t cache_chain_lock;
+
+static inline size_t slab_align(size_t value, size_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+static inline size_t slab_bytes(struct kmem_cache *cachep) {
+    return (size_t)PAGE_SIZE << cachep->order;
+}
+
+static inline struct slab *virt_to_slab(struct kmem_cache *cachep, void *objp) {
+    return (struct slab *)((uint64_t)objp & ~(uint64_t)(slab_bytes(cachep) - 1));
+}
+
+static unsigned int slab_estimate(size_t slab_size, size_t obj_size, size_t align, size_t *offset) {
+    unsigned int num = 0;
+    while (1) {
+        size_t mgmt = slab_align(sizeof(struct slab) + (num + 1) * sizeof(uint16_t), align);
+        if (mgmt + (num + 1) * obj_size > slab_size) break;
+        if (num + 1 >= BUFCTL_END) break;
+        num++;
+    }
+    *offset = slab_align(sizeof(struct slab) + num * sizeof(uint16_t), align);
+    return num;
+}
+
+static int kmem_cache_setup(struct kmem_cache *cachep, const char *name, size_t size, size_t align,
+                            unsigned long flags, void (*ctor)(void *)) {
+    memset(cachep, 0, sizeof(struct kmem_cache));
+
+    strncpy(cachep->name, name, SLAB_NAME_LEN - 1);
+    cachep->name[SLAB_NAME_LEN - 1] = 0;
+
+    if (size < sizeof(void *)) size = sizeof(void *);
+    if (align < sizeof(void *)) align = sizeof(void *);
+
+    if (flags & SLAB_HWCACHE_ALIGN) {
+        size_t ralign = SLAB_CACHE_LINE;
+        while (size <= ralign / 2) ralign /= 2;
+        if (ralign > align) align = ralign;
+    }
+
+    cachep->object_size = size;
+    cachep->align = align;
+    cachep->size = slab_align(size, align);
+    cachep->flags = flags;
+    cachep->ctor = ctor;
+
+    size_t left_over = 0;
+    for (cachep->order = 0; cachep->order <= SLAB_MAX_ORDER; cachep->order++) {
+        size_t slab_size = slab_bytes(cachep);
+        cachep->num = slab_estimate(slab_size, cachep->size, align, &cachep->obj_offset);
+        if (!cachep->num) continue;
+        left_over = slab_size - cachep->obj_offset - cachep->num * cachep->size;
+        if (left_over * 8 <= slab_size) break;
+    }
+    if (cachep->order > SLAB_MAX_ORDER) {
+        cachep->order = SLAB_MAX_ORDER;
+        cachep->num = slab_estimate(slab_bytes(cachep), cachep->size, align, &cachep->obj_offset);
+        left_over = slab_bytes(cachep) - cachep->obj_offset - cachep->num * cachep->size;
+    }
+    if (!cachep->num) return -1;
+
+    cachep->colour_off = SLAB_CACHE_LINE;
+    if (cachep->align > cachep->colour_off) cachep->colour_off = cachep->align;
+    cachep->colour = left_over / cachep->colour_off + 1;
+    cachep->colour_next = 0;
+
+    INIT_LIST_HEAD(&cachep->slabs_full);
+    INIT_LIST_HEAD(&cachep->slabs_partial);
+    INIT_LIST_HEAD(&cachep->slabs_free);
+    spinlock_init(&cachep->lock);
+
+    spinlock_acquire(&cache_chain_lock);
+    list_add_tail(&cachep->next, &cache_chain);
+    spinlock_release(&cache_chain_lock);
+    return 0;
+}
+
+void kmem_cache_init(void) {
+    spinlock_init(&cache_chain_lock);
+    kmem_cache_setup(&cache_cache, "kmem_cache", sizeof(struct kmem_cache), 0, SLAB_HWCACHE_ALIGN, 0);
+    kprint_str("Slab: Initialized. kmem_cache objects per slab: ");
+    kprint_dec(cache_cache.num);
+    kprint_newline();
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align,
+                                     unsigned long flags, void (*ctor)(void *)) {
+    struct kmem_cache *cachep = (struct kmem_cache *)kmem_cache_alloc(&cache_cache, 0);
+    if (!cachep) goto fail;
+
+    if (kmem_cache_setup(cachep, name, size, align, flags, ctor) != 0) {
+        kmem_cache_free(&cache_cache, cachep);
+        goto fail;
+    }
+    return cachep;
+
+fail:
+    kprint_str("Slab: Failed to create cache ");
+    kprint_str(name);
+    kprint_newline();
+    if (flags & SLAB_PANIC) {
+        while (1) __asm__ volatile("hlt");
+    }
+    return 0;
+}
+
+static struct slab *cache_grow(struct kmem_cache *cachep) {
+    void *phys = pmm_alloc_pages(1ULL << cachep->order);
+    if (!phys) return 0;
+
+    void *pages = phys_to_virt((uint64_t)phys);
+
+    struct slab *slabp = (struct slab *)pages;
+    slabp->cache = cachep;
+    slabp->inuse = 0;
+    slabp->free = 0;
+    slabp->colour_off = cachep->colour_next * cachep->colour_off;
+    slabp->s_mem = (uint8_t *)pages + cachep->obj_offset + slabp->colour_off;
+
+    cachep->colour_next++;
+    if (cachep->colour_next >= cachep->colour) cachep->colour_next = 0;
+
+    for (unsigned int i = 0; i < cachep->num; i++) {
+        slabp->bufctl[i] = (i + 1 < cachep->num) ? i + 1 : BUFCTL_END;
+        if (cachep->ctor) {
+            cachep->ctor((uint8_t *)slabp->s_mem + i * cachep->size);
+        }
+    }
+
+    list_add(&slabp->list, &cachep->slabs_free);
+    cachep->num_slabs++;
+    cachep->free_slabs++;
+    return slabp;
+}
+
+static void slab_destroy(struct kmem_cache *cachep, struct slab *slabp) {
+    list_del(&slabp->list);
+    cachep->num_slabs--;
+    cachep->free_slabs--;
+    pmm_free_pages((void *)virt_to_phys(slabp), 1ULL << cachep->order);
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cachep, int flags) {
+    (void)flags;
+    if (!cachep) return 0;
+
+    spinlock_acquire(&cachep->lock);
+
+    struct slab *slabp;
+    if (!list_empty(&cachep->slabs_partial)) {
+        slabp = list_entry(cachep->slabs_partial.next, struct slab, list);
+    } else {
+        if (list_empty(&cachep->slabs_free) && !cache_grow(cachep)) {
+            spinlock_release(&cachep->lock);
+            return 0;
+        }
+        slabp = list_entry(cachep->slabs_free.next, struct slab, list);
+        list_del(&slabp->list);
+        list_add(&slabp->list, &cachep->slabs_partial);
+        cachep->free_slabs--;
+    }
+
+    void *objp = (uint8_t *)slabp->s_mem + slabp->free * cachep->size;
+    slabp->free = slabp->bufctl[slabp->free];
+    slabp->inuse++;
+    cachep->active_objs++;
+
+    if (slabp->free == BUFCTL_END) {
+        list_del(&slabp->list);
+        list_add(&slabp->list, &cachep->slabs_full);
+    }
+
+    spinlock_release(&cachep->lock);
+    return objp;
+}
+
+void kmem_cache_free(struct kmem_cache *cachep, void *objp) {
+    if (!cachep || !objp) return;
+
+    struct slab *slabp = virt_to_slab(cachep, objp);
+    if (slabp->cache != cachep) {
+        kprint_str("Slab: Object ");
+        kprint_hex((uint64_t)objp);
+        kprint_str(" freed to wrong cache ");
+        kprint_str(cachep->name);
+        kprint_newline();
+        return;
+    }
+
+    spinlock_acquire(&cachep->lock);
+
+    unsigned int idx = ((uint8_t *)objp - (uint8_t *)slabp->s_mem) / cachep->size;
+    int was_full = (slabp->free == BUFCTL_END);
+
+    slabp->bufctl[idx] = slabp->free;
+    slabp->free = idx;
+    slabp->inuse--;
+    cachep->active_objs--;
+
+    if (slabp->inuse == 0) {
+        list_del(&slabp->list);
+        list_add(&slabp->list, &cachep->slabs_free);
+        cachep->free_slabs++;
+        if (cachep->free_slabs > 1) {
+            slab_destroy(cachep, slabp);
+        }
+    } else if (was_full) {
+        list_del(&slabp->list);
+        list_add(&slabp->list, &cachep->slabs_partial);
+    }
+
+    spinlock_release(&cachep->lock);
+}
+
+int kmem_cache_shrink(struct kmem_cache *cachep) {
+    int freed = 0;
+
+    spinlock_acquire(&cachep->lock);
+    while (!list_empty(&cachep->slabs_free)) {
+        struct slab *slabp = list_entry(cachep->slabs_free.next, struct slab, list);
+        slab_destroy(cachep, slabp);
+        freed++;
+    }
+    spinlock_release(&cachep->lock);
+    return freed;
+}
+
+void kmem_cache_destroy(struct kmem_cache *cachep) {
+    if (!cachep) return;
+
+    kmem_cache_shrink(cachep);
+    if (cachep->active_objs) {
+        kprint_str("Slab: Can't destroy cache ");
+        kprint_str(cachep->name);
+        kprint_str(", objects still in use\n");
+        return;
+    }
+
+    spinlock_acquire(&cache_chain_lock);
+    list_del(&cachep->next);
+    spinlock_release(&cache_chain_lock);
+
+    kmem_cache_free(&cache_cache, cachep);
+}
+
+void kmem_cache_dump_stats(void) {
+    struct list_head *pos;
+
+    kprint_str("Slab Statistics:\n");
+    spinlock_acquire(&cache_chain_lock);
+    list_for_each(pos, &cache_chain) {
+        struct kmem_cache *cachep = list_entry(pos, struct kmem_cache, next);
+        kprint_str(cachep->name);
+        kprint_str(": Size: ");
+        kprint_dec(cachep->size);
+        kprint_str(" Active: ");
+        kprint_dec(cachep->active_objs);
+        kprint_str(" Total: ");
+        kprint_dec(cachep->num_slabs * cachep->num);
+        kprint_str(" Slabs: ");
+        kprint_dec(cachep->num_slabs);
+        kprint_str(" Order: ");
+        kprint_dec(cachep->order);
+        kprint_newline();
+    }
+    spinlock_release(&cache_chain_lock);
+}
@@ -1,117 +1,359 @@
 #include "mm/swap.h"
+#include "mm/mmap.h"
+#include "mm/rmap.h"
 #include "pmm.h"
 #include "vmm.h"
 #include "heap.h"
+#include "vmalloc.h"
 #include "console.h"
 #include "string.h"
+#include "spinlock.h"
+#include "process.h"
 #include "drivers/blockdev.h"
 
-#define MAX_SWAP_DEVICES 4
-#define SWAP_PAGE_SIZE 4096
+#define SWP_USED 0x1
+#define SWP_WRITEOK 0x2
 
-typedef struct {
-    int id;
-    int active;
-    uint8_t *storage;
-    size_t size;  
-    uint8_t *bitmap;  
-} swap_device_t;
+#define SWAP_MAP_MAX 0xFE
+#define SWAP_MAP_BAD 0xFF
 
-static swap_device_t swap_devices[MAX_SWAP_DEVICES];
+#define SWAP_SECTORS_PER_PAGE (PAGE_SIZE / 512)
+
+struct swap_info_struct {
+    int flags;
+    struct gendisk *bdev;
+    uint8_t *swap_map;
+    uint64_t max;
+    uint64_t pages;
+    uint64_t inuse_pages;
+    uint64_t lowest_bit;
+    uint64_t highest_bit;
+    uint64_t cluster_next;
+    uint64_t cluster_nr;
+};
+
+struct swap_iocb {
+    volatile int pending;
+    volatile int error;
+};
+
+static struct swap_info_struct swap_info[MAX_SWAPFILES];
+static spinlock_t swap_lock;
 
 void swap_init() {
-    swap_devices[0].id = 0;
-    swap_devices[0].active = 1;
-    swap_devices[0].size = 1024;  
-    
-    swap_devices[0].storage = (uint8_t*)kmalloc(swap_devices[0].size * SWAP_PAGE_SIZE);
-    swap_devices[0].bitmap = (uint8_t*)kmalloc(swap_devices[0].size);  
-    
-    if (!swap_devices[0].storage || !swap_devices[0].bitmap) {
-        kprint_str("Swap: Failed to allocate mock storage\n");
-        return;
-    }
-    
-    memset(swap_devices[0].bitmap, 0, swap_devices[0].size);
-    kprint_str("Swap: Initialized Swap Device 0 (4MB)\n");
-}
-
-static int find_free_swap_slot(int dev_id, uint64_t *offset) {
-    swap_device_t *dev = &swap_devices[dev_id];
-    for (size_t i = 0; i < dev->size; i++) {
-        if (dev->bitmap[i] == 0) {
-            dev->bitmap[i] = 1;
-            *offset = i;
-            return 0;
+    spinlock_init(&swap_lock);
+    memset(swap_info, 0, sizeof(swap_info));
+    kprint_str("Swap: Off until a disk is added with swapon\n");
+}
+
+int swapon(const char *name) {
+    struct gendisk *disk = get_gendisk(name);
+    if (!disk || !disk->queue) return -1;
+
+    uint64_t max = disk->capacity / SWAP_SECTORS_PER_PAGE;
+    if (max < 2) return -1;
+
+    uint8_t *map = (uint8_t*)vzalloc(max);
+    if (!map) return -1;
+    map[0] = SWAP_MAP_BAD;
+
+    spinlock_acquire(&swap_lock);
+    int type = -1;
+    for (int i = 0; i < MAX_SWAPFILES; i++) {
+        if (swap_info[i].bdev == disk) {
+            type = -1;
+            break;
+        }
+        if (type < 0 && !(swap_info[i].flags & SWP_USED)) type = i;
+    }
+    if (type < 0) {
+        spinlock_release(&swap_lock);
+        vfree(map);
+        return -1;
+    }
+
+    struct swap_info_struct *si = &swap_info[type];
+    si->bdev = disk;
+    si->swap_map = map;
+    si->max = max;
+    si->pages = max - 1;
+    si->inuse_pages = 0;
+    si->lowest_bit = 1;
+    si->highest_bit = max - 1;
+    si->cluster_next = 1;
+    si->cluster_nr = 0;
+    si->flags = SWP_USED | SWP_WRITEOK;
+    spinlock_release(&swap_lock);
+
+    kprint_str("Swap: Adding ");
+    kprint_dec(si->pages * 4);
+    kprint_str("KB swap on ");
+    kprint_str(name);
+    kprint_newline();
+    return type;
+}
+
+static uint64_t scan_swap_map(struct swap_info_struct *si) {
+    if (!(si->flags & SWP_WRITEOK) || si->inuse_pages >= si->pages) return 0;
+
+    if (!si->cluster_nr) {
+        uint64_t run = 0;
+        si->cluster_nr = SWAPFILE_CLUSTER;
+        si->cluster_next = si->lowest_bit;
+        for (uint64_t offset = si->lowest_bit; offset <= si->highest_bit; offset++) {
+            run = si->swap_map[offset] ? 0 : run + 1;
+            if (run == SWAPFILE_CLUSTER) {
+                si->cluster_next = offset + 1 - SWAPFILE_CLUSTER;
+                break;
+            }
+        }
+    }
+    si->cluster_nr--;
+
+    uint64_t offset = si->cluster_next;
+    if (offset < si->lowest_bit || offset > si->highest_bit) offset = si->lowest_bit;
+    while (si->swap_map[offset]) {
+        if (++offset > si->highest_bit) offset = si->lowest_bit;
+    }
+
+    si->swap_map[offset] = 1;
+    si->cluster_next = offset + 1;
+    si->inuse_pages++;
+    if (offset == si->lowest_bit) si->lowest_bit++;
+    if (offset == si->highest_bit) si->highest_bit--;
+    if (si->inuse_pages == si->pages) {
+        si->lowest_bit = si->max;
+        si->highest_bit = 0;
+    }
+    return offset;
+}
+
+int get_swap_pages(int nr, swap_entry_t *entries) {
+    int got = 0;
+
+    spinlock_acquire(&swap_lock);
+    for (int type = 0; type < MAX_SWAPFILES && !got; type++) {
+        struct swap_info_struct *si = &swap_info[type];
+        while (got < nr) {
+            uint64_t offset = scan_swap_map(si);
+            if (!offset) break;
+            entries[got].device_id = type;
+            entries[got].offset = offset;
+            got++;
+        }
+    }
+    spinlock_release(&swap_lock);
+    return got;
+}
+
+static struct swap_info_struct *swap_info_get(swap_entry_t entry) {
+    if (entry.device_id >= MAX_SWAPFILES) return 0;
+    struct swap_info_struct *si = &swap_info[entry.device_id];
+    if (!(si->flags & SWP_USED) || !entry.offset || entry.offset >= si->max) return 0;
+    return si;
+}
+
+void swap_duplicate(swap_entry_t entry) {
+    spinlock_acquire(&swap_lock);
+    struct swap_info_struct *si = swap_info_get(entry);
+    if (si && si->swap_map[entry.offset] && si->swap_map[entry.offset] < SWAP_MAP_MAX) {
+        si->swap_map[entry.offset]++;
+    }
+    spinlock_release(&swap_lock);
+}
+
+void swap_free(swap_entry_t entry) {
+    spinlock_acquire(&swap_lock);
+    struct swap_info_struct *si = swap_info_get(entry);
+    if (si && si->swap_map[entry.offset] && si->swap_map[entry.offset] < SWAP_MAP_MAX) {
+        if (--si->swap_map[entry.offset] == 0) {
+            if (entry.offset < si->lowest_bit) si->lowest_bit = entry.offset;
+            if (entry.offset > si->highest_bit) si->highest_bit = entry.offset;
+            si->inuse_pages--;
+        }
+    }
+    spinlock_release(&swap_lock);
+}
+
+int swap_count(swap_entry_t entry) {
+    spinlock_acquire(&swap_lock);
+    struct swap_info_struct *si = swap_info_get(entry);
+    int count = si ? si->swap_map[entry.offset] : 0;
+    spinlock_release(&swap_lock);
+    return count;
+}
+
+static void end_swap_bio(struct bio *bio) {
+    struct swap_iocb *iocb = (struct swap_iocb*)bio->private_data;
+
+    if (!(bio->flags & BIO_UPTODATE)) iocb->error = 1;
+    iocb->pending--;
+
+    kfree(bio->io_vec);
+    bio_put(bio);
+}
+
+static int swap_submit(int rw, swap_entry_t entry, uint64_t *frames, int nr, struct swap_iocb *iocb) {
+    struct swap_info_struct *si = swap_info_get(entry);
+    if (!si) return -1;
+
+    struct bio *bio = bio_alloc();
+    if (!bio) return -1;
+
+    struct bio_vec *vec = (struct bio_vec*)kmalloc(sizeof(struct bio_vec) * nr);
+    if (!vec) {
+        bio_put(bio);
+        return -1;
+    }
+
+    for (int i = 0; i < nr; i++) {
+        vec[i].page = phys_to_virt(frames[i]);
+        vec[i].len = PAGE_SIZE;
+        vec[i].offset = 0;
+    }
+
+    bio->sector = entry.offset * SWAP_SECTORS_PER_PAGE;
+    bio->size = nr * PAGE_SIZE;
+    bio->disk = si->bdev;
+    bio->io_vec = vec;
+    bio->vc_cnt = nr;
+    bio->idx = 0;
+    bio->rw = rw;
+    bio->private_data = iocb;
+    bio->end_io = end_swap_bio;
+
+    iocb->pending++;
+    submit_bio(bio);
+    return 0;
+}
+
+static int swap_wait(struct swap_iocb *iocb) {
+    while (iocb->pending) process_yield();
+    return iocb->error ? -1 : 0;
+}
+
+int swap_writepages(uint64_t *frames, swap_entry_t *entries, int nr) {
+    struct swap_iocb iocb = { 0, 0 };
+    int i = 0;
+
+    while (i < nr) {
+        int run = 1;
+        while (i + run < nr && entries[i + run].device_id == entries[i].device_id &&
+               entries[i + run].offset == entries[i].offset + run) {
+            run++;
         }
+
+        if (swap_submit(WRITE, entries[i], &frames[i], run, &iocb) != 0) iocb.error = 1;
+        i += run;
     }
-    return -1;  
+
+    return swap_wait(&iocb);
+}
+
+int swap_readpages(swap_entry_t entry, uint64_t *frames, int nr) {
+    struct swap_iocb iocb = { 0, 0 };
+
+    if (swap_submit(READ, entry, frames, nr, &iocb) != 0) return -1;
+    return swap_wait(&iocb);
 }
 
 int swap_out(uint64_t phys_addr, swap_entry_t *entry) {
-    int dev_id = 0;
-    if (!swap_devices[dev_id].active) return -1;
-    
-    uint64_t offset;
-    if (find_free_swap_slot(dev_id, &offset) != 0) {
+    uint64_t frame = phys_addr & ~(uint64_t)(PAGE_SIZE - 1);
+
+    if (get_swap_pages(1, entry) != 1) {
         kprint_str("Swap: Device full\n");
         return -1;
     }
-    
-    void *src = (void*)(phys_addr & 0xFFFFFFFFFFFFF000);  
-    void *dst = swap_devices[dev_id].storage + (offset * SWAP_PAGE_SIZE);
-    
-    memcpy(dst, src, SWAP_PAGE_SIZE);
-    
-    entry->device_id = dev_id;
-    entry->offset = offset;
-    
+
+    if (swap_writepages(&frame, entry, 1) != 0) {
+        swap_free(*entry);
+        return -1;
+    }
     return 0;
 }
 
 int swap_in(swap_entry_t entry, uint64_t *phys_addr) {
-    if (entry.device_id >= MAX_SWAP_DEVICES || !swap_devices[entry.device_id].active) {
+    if (!swap_info_get(entry)) return -1;
+
+    void *new_page = pmm_alloc_page();
+    if (!new_page) return -1;
+
+    uint64_t frame = (uint64_t)new_page;
+    if (swap_readpages(entry, &frame, 1) != 0) {
+        pmm_free_page(new_page);
         return -1;
     }
-    
-    swap_device_t *dev = &swap_devices[entry.device_id];
-    if (entry.offset >= dev->size) return -1;
-    
-    void *new_page = pmm_alloc_page();
-    if (!new_page) return -1;  
-    
-    void *src = dev->storage + (entry.offset * SWAP_PAGE_SIZE);
-    memcpy(new_page, src, SWAP_PAGE_SIZE);
-    
-    dev->bitmap[entry.offset] = 0;
-    
-    *phys_addr = (uint64_t)new_page;
+
+    swap_free(entry);
+    *phys_addr = frame;
     return 0;
 }
 
+static int swap_pte_follows(uint64_t addr, swap_entry_t entry, uint64_t base) {
+    uint64_t pte = vmm_get_pte(addr);
+    if ((pte & PTE_PRESENT) || !(pte & PTE_SWAPPED)) return 0;
+
+    swap_entry_t e = pte_to_swp_entry(pte);
+    return e.device_id == entry.device_id && (int64_t)(e.offset - entry.offset) == (int64_t)(addr - base) / PAGE_SIZE;
+}
+
 int handle_swap_fault(uint64_t vaddr) {
     uint64_t pte = vmm_get_pte(vaddr);
-    
+
     if ((pte & PTE_PRESENT) || !(pte & PTE_SWAPPED)) {
-        return -1;  
-    }
-    
-    swap_entry_t entry;
-    entry.device_id = (pte >> 1) & 0xFF;  
-    entry.offset = (pte >> 12);           
-    
-    kprint_str("Swap: Handling page fault at "); kprint_hex(vaddr);
-    kprint_str(" (Dev: "); kprint_dec(entry.device_id);
-    kprint_str(", Off: "); kprint_dec(entry.offset);
-    kprint_str(")\n");
-    
-    uint64_t phys_addr;
-    if (swap_in(entry, &phys_addr) != 0) {
+        return -1;
+    }
+
+    vaddr &= ~(uint64_t)(PAGE_SIZE - 1);
+    swap_entry_t entry = pte_to_swp_entry(pte);
+    uint64_t flags = PTE_PRESENT | PTE_WRITABLE | PTE_USER;
+
+    uint64_t lo = vaddr & ~(uint64_t)(SWAP_BATCH * PAGE_SIZE - 1);
+    uint64_t hi = lo + SWAP_BATCH * PAGE_SIZE;
+
+    struct mm_struct *mm = current_process ? current_process->active_mm : 0;
+    struct vm_area_struct *vma = mm ? find_vma(mm, vaddr) : 0;
+    if (vma && (vma->vm_start > vaddr || anon_vma_prepare(vma) != 0)) vma = 0;
+    if (vma) {
+        if (!(vma->vm_flags & VM_WRITE)) flags &= ~(uint64_t)PTE_WRITABLE;
+        if (!(vma->vm_flags & (VM_READ | VM_WRITE | VM_EXEC))) flags &= ~(uint64_t)PTE_USER;
+        if (vma->vm_start > lo) lo = vma->vm_start;
+        if (vma->vm_end < hi) hi = vma->vm_end;
+    } else {
+        lo = vaddr;
+        hi = vaddr + PAGE_SIZE;
+    }
+
+    uint64_t start = vaddr;
+    uint64_t end = vaddr + PAGE_SIZE;
+    while (start > lo && swap_pte_follows(start - PAGE_SIZE, entry, vaddr)) start -= PAGE_SIZE;
+    while (end < hi && swap_pte_follows(end, entry, vaddr)) end += PAGE_SIZE;
+
+    uint64_t frames[SWAP_BATCH];
+    int nr = (end - start) / PAGE_SIZE;
+    for (int i = 0; i < nr; i++) {
+        void *frame = pmm_alloc_page();
+        if (!frame) {
+            nr = i;
+            break;
+        }
+        frames[i] = (uint64_t)frame;
+    }
+
+    swap_entry_t first = pte_to_swp_entry(vmm_get_pte(start));
+    if (start + (uint64_t)nr * PAGE_SIZE <= vaddr || swap_readpages(first, frames, nr) != 0) {
+        for (int i = 0; i < nr; i++) pmm_free_page((void*)frames[i]);
         kprint_str("Swap: Failed to swap in!\n");
         return -1;
     }
 
-    vmm_map_page(vaddr, phys_addr, PTE_PRESENT | PTE_WRITABLE | PTE_USER);
-    
+    for (int i = 0; i < nr; i++) {
+        uint64_t addr = start + (uint64_t)i * PAGE_SIZE;
+        swap_entry_t e = pte_to_swp_entry(vmm_get_pte(addr));
+        vmm_map_page(addr, frames[i], flags);
+        if (vma) page_add_anon_rmap(phys_to_page(frames[i]), vma, addr);
+        swap_free(e);
+    }
+
     return 0;
 }
@@ -0,0 +1,329 @@
+#include "vmalloc.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "heap.h"
+#include "slab.h"
+#include "spinlock.h"
+#include "console.h"
+
+static struct kmem_cache* vmap_area_cachep;
+static struct rb_root free_vmap_root = RB_ROOT;
+static struct rb_root busy_vmap_root = RB_ROOT;
+static LIST_HEAD(purge_vmap_list);
+static spinlock_t vmap_lock;
+static uint64_t lazy_nr_pages = 0;
+static uint64_t vmap_nr_purges = 0;
+static uint64_t vmap_busy_pages = 0;
+
+static void vmap_insert(struct rb_root* root, struct vmap_area* va) {
+    struct rb_node** link = &root->rb_node;
+    struct rb_node* parent = 0;
+
+    while (*link) {
+        struct vmap_area* tmp = rb_entry(*link, struct vmap_area, rb_node);
+        parent = *link;
+        if (va->va_start < tmp->va_start) {
+            link = &parent->rb_left;
+        } else {
+            link = &parent->rb_right;
+        }
+    }
+
+    rb_link_node(&va->rb_node, parent, link);
+    rb_insert_color(&va->rb_node, root);
+}
+
+static struct vmap_area* find_vmap_area(uint64_t addr) {
+    struct rb_node* node = busy_vmap_root.rb_node;
+
+    while (node) {
+        struct vmap_area* va = rb_entry(node, struct vmap_area, rb_node);
+        if (addr < va->va_start) {
+            node = node->rb_left;
+        } else if (addr >= va->va_end) {
+            node = node->rb_right;
+        } else {
+            return va;
+        }
+    }
+    return 0;
+}
+
+static struct vmap_area* vmap_alloc_node() {
+    struct vmap_area* va = (struct vmap_area*)kmem_cache_alloc(vmap_area_cachep, 0);
+    if (!va) return 0;
+    va->va_start = 0;
+    va->va_end = 0;
+    va->flags = 0;
+    va->pages = 0;
+    va->nr_pages = 0;
+    INIT_LIST_HEAD(&va->purge_list);
+    return va;
+}
+
+static void vmap_free_range(uint64_t start, uint64_t end) {
+    struct rb_node* node = free_vmap_root.rb_node;
+    struct vmap_area* prev = 0;
+    struct vmap_area* next = 0;
+
+    while (node) {
+        struct vmap_area* va = rb_entry(node, struct vmap_area, rb_node);
+        if (start < va->va_start) {
+            next = va;
+            node = node->rb_left;
+        } else {
+            prev = va;
+            node = node->rb_right;
+        }
+    }
+
+    if (prev && prev->va_end == start) {
+        prev->va_end = end;
+        if (next && next->va_start == end) {
+            prev->va_end = next->va_end;
+            rb_erase(&next->rb_node, &free_vmap_root);
+            kmem_cache_free(vmap_area_cachep, next);
+        }
+        return;
+    }
+    if (next && next->va_start == end) {
+        next->va_start = start;
+        return;
+    }
+
+    struct vmap_area* va = vmap_alloc_node();
+    if (!va) {
+        kprint_str("VMALLOC: Leaking range ");
+        kprint_hex(start);
+        kprint_newline();
+        return;
+    }
+    va->va_start = start;
+    va->va_end = end;
+    vmap_insert(&free_vmap_root, va);
+}
+
+static uint64_t vmap_carve(uint64_t size, uint64_t align) {
+    for (struct rb_node* node = rb_first(&free_vmap_root); node; node = rb_next(node)) {
+        struct vmap_area* va = rb_entry(node, struct vmap_area, rb_node);
+        uint64_t start = (va->va_start + align - 1) & ~(align - 1);
+        if (start < va->va_start || start + size > va->va_end) continue;
+
+        uint64_t end = start + size;
+        if (start == va->va_start && end == va->va_end) {
+            rb_erase(&va->rb_node, &free_vmap_root);
+            kmem_cache_free(vmap_area_cachep, va);
+        } else if (start == va->va_start) {
+            va->va_start = end;
+        } else if (end == va->va_end) {
+            va->va_end = start;
+        } else {
+            struct vmap_area* tail = vmap_alloc_node();
+            if (!tail) return 0;
+            tail->va_start = end;
+            tail->va_end = va->va_end;
+            va->va_end = start;
+            vmap_insert(&free_vmap_root, tail);
+        }
+        return start;
+    }
+    return 0;
+}
+
+static void vmap_purge_locked() {
+    if (list_empty(&purge_vmap_list)) return;
+
+    struct mmu_gather tlb;
+    tlb_gather_init(&tlb);
+    tlb.full_flush = 1;
+    tlb.kernel = 1;
+    tlb_flush_mmu(&tlb);
+
+    while (!list_empty(&purge_vmap_list)) {
+        struct vmap_area* va = list_entry(purge_vmap_list.next, struct vmap_area, purge_list);
+        list_del(&va->purge_list);
+        vmap_free_range(va->va_start, va->va_end);
+        kmem_cache_free(vmap_area_cachep, va);
+    }
+    lazy_nr_pages = 0;
+    vmap_nr_purges++;
+}
+
+void vmap_purge_lazy() {
+    spinlock_acquire(&vmap_lock);
+    vmap_purge_locked();
+    spinlock_release(&vmap_lock);
+}
+
+static struct vmap_area* alloc_vmap_area(uint64_t size, uint64_t align, uint64_t flags) {
+    struct vmap_area* va = vmap_alloc_node();
+    if (!va) return 0;
+
+    spinlock_acquire(&vmap_lock);
+    uint64_t start = vmap_carve(size, align);
+    if (!start) {
+        vmap_purge_locked();
+        start = vmap_carve(size, align);
+    }
+    if (start) {
+        va->va_start = start;
+        va->va_end = start + size;
+        va->flags = flags;
+        vmap_insert(&busy_vmap_root, va);
+        vmap_busy_pages += size / PAGE_SIZE;
+    }
+    spinlock_release(&vmap_lock);
+
+    if (!start) {
+        kmem_cache_free(vmap_area_cachep, va);
+        return 0;
+    }
+    return va;
+}
+
+static struct vmap_area* remove_vmap_area(uint64_t addr) {
+    spinlock_acquire(&vmap_lock);
+    struct vmap_area* va = find_vmap_area(addr);
+    if (va) {
+        rb_erase(&va->rb_node, &busy_vmap_root);
+        vmap_busy_pages -= (va->va_end - va->va_start) / PAGE_SIZE;
+    }
+    spinlock_release(&vmap_lock);
+    return va;
+}
+
+static void free_vmap_area_lazy(struct vmap_area* va) {
+    struct mmu_gather tlb;
+    tlb_gather_init(&tlb);
+    vmm_zap_range(&tlb, va->va_start, va->va_end - va->va_start, 0);
+
+    spinlock_acquire(&vmap_lock);
+    list_add_tail(&va->purge_list, &purge_vmap_list);
+    lazy_nr_pages += (va->va_end - va->va_start) / PAGE_SIZE;
+    if (lazy_nr_pages > VMAP_LAZY_MAX_PAGES) vmap_purge_locked();
+    spinlock_release(&vmap_lock);
+}
+
+static void vmap_release_pages(uint64_t* pages, uint64_t nr_pages) {
+    for (uint64_t i = 0; i < nr_pages; i++) pmm_free_page((void*)pages[i]);
+    if (pages) kfree(pages);
+}
+
+static void* __vmalloc(size_t size, int gfp_mask) {
+    if (!size) return 0;
+
+    uint64_t nr_pages = PAGE_ALIGN(size) / PAGE_SIZE;
+    uint64_t* pages;
+    struct vmap_area* va = alloc_vmap_area((nr_pages + 1) * PAGE_SIZE, PAGE_SIZE, VM_ALLOC);
+    if (!va) return 0;
+
+    va->pages = (uint64_t*)kmalloc(nr_pages * sizeof(uint64_t));
+    if (!va->pages) goto fail;
+
+    for (; va->nr_pages < nr_pages; va->nr_pages++) {
+        void* frame = pmm_alloc_page_gfp(gfp_mask);
+        if (!frame) goto fail;
+        va->pages[va->nr_pages] = (uint64_t)frame;
+        vmm_map_page(va->va_start + va->nr_pages * PAGE_SIZE, (uint64_t)frame, PTE_PRESENT | PTE_WRITABLE);
+    }
+    return (void*)va->va_start;
+
+fail:
+    pages = va->pages;
+    nr_pages = va->nr_pages;
+    remove_vmap_area(va->va_start);
+    free_vmap_area_lazy(va);
+    vmap_release_pages(pages, nr_pages);
+    return 0;
+}
+
+void* vmalloc(size_t size) {
+    return __vmalloc(size, GFP_KERNEL);
+}
+
+void* vzalloc(size_t size) {
+    return __vmalloc(size, __GFP_ZERO);
+}
+
+void vfree(void* addr) {
+    if (!addr) return;
+
+    struct vmap_area* va = remove_vmap_area((uint64_t)addr);
+    if (!va || !(va->flags & VM_ALLOC) || va->va_start != (uint64_t)addr) {
+        kprint_str("VMALLOC: Bad vfree ");
+        kprint_hex((uint64_t)addr);
+        kprint_newline();
+        return;
+    }
+
+    uint64_t* pages = va->pages;
+    uint64_t nr_pages = va->nr_pages;
+    free_vmap_area_lazy(va);
+    vmap_release_pages(pages, nr_pages);
+}
+
+static void* __ioremap(uint64_t phys_addr, uint64_t size, uint64_t cache) {
+    uint64_t offset = phys_addr & 0xFFF;
+    uint64_t base_phys = phys_addr & ~0xFFFULL;
+    uint64_t pages = (size + offset + 0xFFF) / 0x1000;
+    uint64_t align = PAGE_SIZE;
+    uint64_t skew = 0;
+
+    if (pages * 0x1000 >= HUGE_PAGE_SIZE_2M) {
+        align = HUGE_PAGE_SIZE_2M;
+        skew = base_phys & (HUGE_PAGE_SIZE_2M - 1);
+    }
+
+    struct vmap_area* va = alloc_vmap_area(skew + (pages + 1) * 0x1000, align, VM_IOREMAP);
+    if (!va) return 0;
+
+    uint64_t virt_addr = va->va_start + skew;
+    vmm_map_range(virt_addr, base_phys, pages * 0x1000, PTE_PRESENT | PTE_WRITABLE | cache);
+
+    return (void*)(virt_addr + offset);
+}
+
+void* ioremap(uint64_t phys_addr, uint64_t size) {
+    return __ioremap(phys_addr, size, PTE_CACHE_UC_MINUS);
+}
+
+void* ioremap_uc(uint64_t phys_addr, uint64_t size) {
+    return __ioremap(phys_addr, size, PTE_CACHE_UC);
+}
+
+void* ioremap_wc(uint64_t phys_addr, uint64_t size) {
+    return __ioremap(phys_addr, size, vmm_pat_enabled() ? PTE_CACHE_WC : PTE_CACHE_UC_MINUS);
+}
+
+void iounmap(void* virt_addr) {
+    struct vmap_area* va = remove_vmap_area((uint64_t)virt_addr);
+    if (!va || !(va->flags & VM_IOREMAP)) {
+        kprint_str("VMALLOC: Bad iounmap ");
+        kprint_hex((uint64_t)virt_addr);
+        kprint_newline();
+        return;
+    }
+    free_vmap_area_lazy(va);
+}
+
+void vmalloc_init() {
+    spinlock_init(&vmap_lock);
+    vmap_area_cachep = kmem_cache_create("vmap_area", sizeof(struct vmap_area), 0, SLAB_PANIC, 0);
+    vmap_free_range(VMALLOC_START, VMALLOC_END);
+
+    kprint_str("VMALLOC: Area ");
+    kprint_hex(VMALLOC_START);
+    kprint_str(" - ");
+    kprint_hex(VMALLOC_END);
+    kprint_newline();
+}
+
+void vmalloc_dump_stats() {
+    kprint_str("VMALLOC: busy ");
+    kprint_dec(vmap_busy_pages);
+    kprint_str(" pages lazy ");
+    kprint_dec(lazy_nr_pages);
+    kprint_str(" pages purges ");
+    kprint_dec(vmap_nr_purges);
+    kprint_newline();
+}
@@ -2,85 +2,565 @@
 #include "pmm.h"
 #include "string.h"
 #include "console.h"
+#include "slab.h"
+#include "spinlock.h"
+#include "mm/mmap.h"
+#include "mm/swap.h"
+#include "mm/page.h"
+#include "mm/huge_memory.h"
+#include "mm/rmap.h"
 
  
 #define PTE_PRESENT 1
 #define PTE_WRITABLE 2
 #define PTE_USER 4
+#define PTE_HUGE 0x80
 #define PTE_NO_EXEC 0x8000000000000000
+#define PTE_HUGE_PAT 0x1000
+#define PTE_ADDR_MASK 0xFFFFFFFFFF000
+#define PTE_ADDR_MASK_2M 0xFFFFFFFE00000
+#define PTE_ADDR_MASK_1G 0xFFFFFC0000000
+
+#define MSR_IA32_PAT 0x277
+#define PAT_VALUE 0x0007040600070106ULL
 
 static uint64_t* current_pml4;
+static uint64_t direct_map_end = 0;
+static int vmm_gbpages = 0;
+
+struct mm_struct init_mm;
+static struct kmem_cache* mm_cachep;
+static uint8_t kernel_slots[512];
+static int pcid_enabled = 0;
+static int pat_enabled = 0;
+static uint16_t pcid_next = 1;
+static uint64_t pcid_generation = 1;
+static int kernel_tlb_stale = 0;
+static struct mm_struct* swap_hand_mm;
+static uint64_t swap_hand_addr;
+
+static int vmm_has_gbpages() {
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0x80000000));
+    if (eax < 0x80000001) return 0;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0x80000001));
+    return (edx >> 26) & 1;
+}
+
+void vmm_init_direct_map(uint64_t phys_end, uint64_t (*alloc_table)()) {
+    uint64_t cr3;
+    asm volatile("mov %%cr3, %0" : "=r"(cr3));
+    uint64_t* pml4 = (uint64_t*)(cr3 & 0xFFFFFFFFFF000);
+
+    int gbpages = vmm_has_gbpages();
+    vmm_gbpages = gbpages;
+    uint64_t step = gbpages ? 0x40000000 : 0x200000;
+
+    if (phys_end > DIRECT_MAP_MAX) phys_end = DIRECT_MAP_MAX;
+    phys_end = (phys_end + step - 1) & ~(step - 1);
+
+    for (uint64_t phys = 0; phys < phys_end; phys += step) {
+        uint64_t virt = PAGE_OFFSET + phys;
+        uint64_t pml4_index = (virt >> 39) & 0x1FF;
+        uint64_t pdp_index = (virt >> 30) & 0x1FF;
+        uint64_t pd_index = (virt >> 21) & 0x1FF;
+
+        if (!(pml4[pml4_index] & PTE_PRESENT)) {
+            uint64_t table = alloc_table();
+            if (!table) break;
+            pml4[pml4_index] = table | PTE_PRESENT | PTE_WRITABLE;
+        }
+        uint64_t* pdp = (uint64_t*)(pml4[pml4_index] & 0xFFFFFFFFFF000);
+
+        if (gbpages) {
+            pdp[pdp_index] = phys | PTE_PRESENT | PTE_WRITABLE | PTE_HUGE;
+            direct_map_end = phys + step;
+            continue;
+        }
 
-static void* phys_to_virt(uint64_t phys) {
-    return (void*)phys;  
+        if (!(pdp[pdp_index] & PTE_PRESENT)) {
+            uint64_t table = alloc_table();
+            if (!table) break;
+            pdp[pdp_index] = table | PTE_PRESENT | PTE_WRITABLE;
+        }
+        uint64_t* pd = (uint64_t*)(pdp[pdp_index] & 0xFFFFFFFFFF000);
+
+        pd[pd_index] = phys | PTE_PRESENT | PTE_WRITABLE | PTE_HUGE;
+        direct_map_end = phys + step;
+    }
+
+    asm volatile("mov %0, %%cr3" :: "r"(cr3) : "memory");
+
+    kprint_str("VMM: Direct map ");
+    kprint_hex(PAGE_OFFSET);
+    kprint_str(" - ");
+    kprint_hex(PAGE_OFFSET + direct_map_end);
+    kprint_str(gbpages ? " (1GB pages)\n" : " (2MB pages)\n");
+}
+
+static void vmm_setup_pat() {
+    uint64_t flags = local_irq_save();
+    uint64_t cr3;
+
+    asm volatile("wbinvd" ::: "memory");
+    asm volatile("wrmsr" :: "c"(MSR_IA32_PAT), "a"((uint32_t)PAT_VALUE), "d"((uint32_t)(PAT_VALUE >> 32)) : "memory");
+    asm volatile("wbinvd" ::: "memory");
+    asm volatile("mov %%cr3, %0" : "=r"(cr3));
+    asm volatile("mov %0, %%cr3" :: "r"(cr3) : "memory");
+
+    local_irq_restore(flags);
+    pat_enabled = 1;
+}
+
+int vmm_pat_enabled() {
+    return pat_enabled;
 }
 
 void vmm_init() {
     uint64_t cr3;
     asm volatile("mov %%cr3, %0" : "=r"(cr3));
-    current_pml4 = (uint64_t*)phys_to_virt(cr3);
+    current_pml4 = (uint64_t*)phys_to_virt(cr3 & 0xFFFFFFFFFF000);
+
+    init_mm.pgd = current_pml4;
+    init_mm.pgd_phys = cr3 & 0xFFFFFFFFFF000;
+    init_mm.pcid = 0;
+    init_mm.pcid_gen = 0;
+    init_mm.count = 1;
+    mm_init_vmas(&init_mm);
+    init_mm.next = 0;
+    init_mm.prev = 0;
+
+    for (int i = 0; i < 512; i++) {
+        kernel_slots[i] = (i >= 256) || (current_pml4[i] & PTE_PRESENT);
+    }
+
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1), "c"(0));
+    if ((ecx & (1 << 17)) && !(cr3 & 0xFFF)) {
+        uint64_t cr4;
+        asm volatile("mov %%cr4, %0" : "=r"(cr4));
+        asm volatile("mov %0, %%cr4" :: "r"(cr4 | (1 << 17)) : "memory");
+        pcid_enabled = 1;
+    }
+
+    if (edx & (1 << 16)) vmm_setup_pat();
+
+    uint64_t cr0;
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    asm volatile("mov %0, %%cr0" :: "r"(cr0 | (1 << 16)) : "memory");
     
     kprint_str("VMM: Initialized. CR3=");
     kprint_hex(cr3);
+    kprint_str(pcid_enabled ? " PCID on" : " PCID off");
+    kprint_str(pat_enabled ? " PAT WC" : " PAT off");
     kprint_newline();
 }
 
+static inline int vmm_is_kernel_addr(uint64_t virt) {
+    return kernel_slots[(virt >> 39) & 0x1FF];
+}
+
+static void vmm_kernel_tlb_changed() {
+    if (pcid_enabled) kernel_tlb_stale = 1;
+}
+
+static void vmm_flush_page(uint64_t virt) {
+    asm volatile("invlpg (%0)" :: "r"(virt) : "memory");
+    if (vmm_is_kernel_addr(virt)) vmm_kernel_tlb_changed();
+}
+
+void tlb_gather_init(struct mmu_gather* tlb) {
+    tlb->nr_addrs = 0;
+    tlb->nr_pages = 0;
+    tlb->full_flush = 0;
+    tlb->kernel = 0;
+}
+
+void tlb_gather_page(struct mmu_gather* tlb, uint64_t virt) {
+    if (vmm_is_kernel_addr(virt)) tlb->kernel = 1;
+    if (tlb->full_flush) return;
+    if (tlb->nr_addrs >= MMU_GATHER_BATCH) {
+        tlb->full_flush = 1;
+        return;
+    }
+    tlb->addrs[tlb->nr_addrs++] = virt;
+}
+
+void tlb_flush_mmu(struct mmu_gather* tlb) {
+    if (tlb->full_flush) {
+        uint64_t cr3;
+        asm volatile("mov %%cr3, %0" : "=r"(cr3));
+        asm volatile("mov %0, %%cr3" :: "r"(cr3) : "memory");
+    } else {
+        for (uint64_t i = 0; i < tlb->nr_addrs; i++) {
+            asm volatile("invlpg (%0)" :: "r"(tlb->addrs[i]) : "memory");
+        }
+    }
+    if (tlb->kernel) vmm_kernel_tlb_changed();
+    tlb->nr_addrs = 0;
+    tlb->full_flush = 0;
+    tlb->kernel = 0;
+
+    for (uint64_t i = 0; i < tlb->nr_pages; i++) {
+        if (pmm_page_unref((void*)tlb->pages[i])) pmm_free_page((void*)tlb->pages[i]);
+    }
+    tlb->nr_pages = 0;
+}
+
+void tlb_remove_page(struct mmu_gather* tlb, uint64_t phys) {
+    if (tlb->nr_pages >= MMU_GATHER_PAGES) tlb_flush_mmu(tlb);
+    tlb->pages[tlb->nr_pages++] = phys;
+}
+
+void tlb_finish(struct mmu_gather* tlb) {
+    if (tlb->nr_addrs || tlb->nr_pages || tlb->full_flush || tlb->kernel) tlb_flush_mmu(tlb);
+}
+
+static void vmm_free_table(struct mmu_gather* tlb, uint64_t entry, int level) {
+    uint64_t* table = (uint64_t*)phys_to_virt(entry & PTE_ADDR_MASK);
+
+    if (level > 1) {
+        for (int i = 0; i < 512; i++) {
+            if ((table[i] & PTE_PRESENT) && !(table[i] & PTE_HUGE)) {
+                vmm_free_table(tlb, table[i], level - 1);
+            }
+        }
+    }
+    tlb->full_flush = 1;
+    tlb_remove_page(tlb, entry & PTE_ADDR_MASK);
+}
+
+static inline int vmm_huge_is_split(uint64_t entry) {
+    return (entry & PTE_USER) && pmm_get_order((void*)(entry & PTE_ADDR_MASK_2M)) != HPAGE_PMD_ORDER;
+}
+
+static int vmm_split_huge(uint64_t* entry, uint64_t size) {
+    uint64_t table_phys = (uint64_t)pmm_alloc_page();
+    if (!table_phys) return -1;
+
+    uint64_t* table = (uint64_t*)phys_to_virt(table_phys);
+    uint64_t flags = *entry & (0xFFF | PTE_NO_EXEC);
+    uint64_t pat = *entry & PTE_HUGE_PAT;
+
+    if (size == HUGE_PAGE_SIZE_1G) {
+        uint64_t base = *entry & PTE_ADDR_MASK_1G;
+        for (int i = 0; i < 512; i++) {
+            table[i] = (base + i * HUGE_PAGE_SIZE_2M) | flags | pat;
+        }
+    } else {
+        uint64_t base = *entry & PTE_ADDR_MASK_2M;
+        if ((flags & PTE_USER) && pmm_get_order((void*)base) == HPAGE_PMD_ORDER) {
+            pmm_split_pages((void*)base);
+            thp_count_split();
+        }
+        flags &= ~(uint64_t)PTE_HUGE;
+        if (pat) flags |= PTE_HUGE;
+        for (int i = 0; i < 512; i++) {
+            table[i] = (base + i * PAGE_SIZE) | flags;
+        }
+    }
+
+    *entry = table_phys | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
+    return 0;
+}
+
+static uint64_t* vmm_next_level(uint64_t* entry, uint64_t size, int create) {
+    if (!(*entry & PTE_PRESENT)) {
+        if (!create) return 0;
+        uint64_t table_phys = (uint64_t)pmm_alloc_page_gfp(__GFP_ZERO);
+        if (!table_phys) return 0;
+        *entry = table_phys | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
+    } else if (*entry & PTE_HUGE) {
+        if (vmm_split_huge(entry, size) != 0) return 0;
+    }
+    return (uint64_t*)phys_to_virt(*entry & PTE_ADDR_MASK);
+}
+
+static void vmm_sync_kernel_slot(uint64_t index) {
+    kernel_slots[index] = 1;
+    for (struct mm_struct* mm = init_mm.next; mm; mm = mm->next) {
+        mm->pgd[index] = init_mm.pgd[index];
+    }
+}
+
+static uint64_t* vmm_pml4_next(uint64_t virt, int create) {
+    uint64_t index = (virt >> 39) & 0x1FF;
+
+    if (create && !(current_pml4[index] & PTE_PRESENT) &&
+        (current_pml4 == init_mm.pgd || index >= 256)) {
+        uint64_t* pdp = vmm_next_level(&init_mm.pgd[index], 0, 1);
+        if (!pdp) return 0;
+        vmm_sync_kernel_slot(index);
+        return pdp;
+    }
+    return vmm_next_level(&current_pml4[index], 0, create);
+}
+
 void vmm_map_page(uint64_t virt, uint64_t phys, uint64_t flags) {
-    uint64_t pml4_index = (virt >> 39) & 0x1FF;
     uint64_t pdp_index = (virt >> 30) & 0x1FF;
     uint64_t pd_index = (virt >> 21) & 0x1FF;
     uint64_t pt_index = (virt >> 12) & 0x1FF;
     
-    uint64_t* pml4 = current_pml4;
-    
-    if (!(pml4[pml4_index] & PTE_PRESENT)) {
-        uint64_t* pdp = pmm_alloc_page();
-        memset(pdp, 0, PAGE_SIZE);
-        pml4[pml4_index] = (uint64_t)pdp | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
-    }
+    uint64_t* pdp = vmm_pml4_next(virt, 1);
+    if (!pdp) return;
+    uint64_t* pd = vmm_next_level(&pdp[pdp_index], HUGE_PAGE_SIZE_1G, 1);
+    if (!pd) return;
+    uint64_t* pt = vmm_next_level(&pd[pd_index], HUGE_PAGE_SIZE_2M, 1);
+    if (!pt) return;
     
-    uint64_t* pdp = (uint64_t*)phys_to_virt(pml4[pml4_index] & 0xFFFFFFFFFF000);
+    uint64_t old = pt[pt_index];
+    pt[pt_index] = phys | flags;
     
-    if (!(pdp[pdp_index] & PTE_PRESENT)) {
-        uint64_t* pd = pmm_alloc_page();
-        memset(pd, 0, PAGE_SIZE);
-        pdp[pdp_index] = (uint64_t)pd | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
+    if (old & PTE_PRESENT) vmm_flush_page(virt);
+}
+
+static int vmm_set_huge(struct mmu_gather* tlb, uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags) {
+    uint64_t pdp_index = (virt >> 30) & 0x1FF;
+    uint64_t pd_index = (virt >> 21) & 0x1FF;
+
+    uint64_t* pdp = vmm_pml4_next(virt, 1);
+    if (!pdp) return -1;
+
+    uint64_t* entry;
+    int level;
+    if (size == HUGE_PAGE_SIZE_1G) {
+        entry = &pdp[pdp_index];
+        level = 2;
+    } else {
+        uint64_t* pd = vmm_next_level(&pdp[pdp_index], HUGE_PAGE_SIZE_1G, 1);
+        if (!pd) return -1;
+        entry = &pd[pd_index];
+        level = 1;
     }
 
-    uint64_t* pd = (uint64_t*)phys_to_virt(pdp[pdp_index] & 0xFFFFFFFFFF000);
-    
-    if (!(pd[pd_index] & PTE_PRESENT)) {
-        uint64_t* pt = pmm_alloc_page();
-        memset(pt, 0, PAGE_SIZE);
-        pd[pd_index] = (uint64_t)pt | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
+    uint64_t old = *entry;
+    *entry = phys | flags | PTE_HUGE;
+
+    if (old & PTE_PRESENT) {
+        tlb_gather_page(tlb, virt);
+        if (!(old & PTE_HUGE)) vmm_free_table(tlb, old, level);
     }
-    
-    uint64_t* pt = (uint64_t*)phys_to_virt(pd[pd_index] & 0xFFFFFFFFFF000);
-    
-    pt[pt_index] = phys | flags;
-    
-    asm volatile("invlpg (%0)" :: "r"(virt) : "memory");
+    return 0;
+}
+
+static int vmm_huge_fits(uint64_t virt, uint64_t phys, uint64_t left, uint64_t size) {
+    if (size == HUGE_PAGE_SIZE_1G && !vmm_gbpages) return 0;
+    return left >= size && !((virt | phys) & (size - 1));
+}
+
+int vmm_map_huge(uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags) {
+    struct mmu_gather tlb;
+
+    if (size != HUGE_PAGE_SIZE_2M && size != HUGE_PAGE_SIZE_1G) return -1;
+    if (!vmm_huge_fits(virt, phys, size, size)) return -1;
+
+    tlb_gather_init(&tlb);
+    int ret = vmm_set_huge(&tlb, virt, phys, size, flags);
+    tlb_finish(&tlb);
+    return ret;
+}
+
+void vmm_map_range(uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags) {
+    struct mmu_gather tlb;
+    uint64_t end = virt + size;
+
+    tlb_gather_init(&tlb);
+
+    while (virt < end) {
+        uint64_t left = end - virt;
+
+        if (vmm_huge_fits(virt, phys, left, HUGE_PAGE_SIZE_1G) &&
+            vmm_set_huge(&tlb, virt, phys, HUGE_PAGE_SIZE_1G, flags) == 0) {
+            virt += HUGE_PAGE_SIZE_1G;
+            phys += HUGE_PAGE_SIZE_1G;
+            continue;
+        }
+        if (vmm_huge_fits(virt, phys, left, HUGE_PAGE_SIZE_2M) &&
+            vmm_set_huge(&tlb, virt, phys, HUGE_PAGE_SIZE_2M, flags) == 0) {
+            virt += HUGE_PAGE_SIZE_2M;
+            phys += HUGE_PAGE_SIZE_2M;
+            continue;
+        }
+
+        uint64_t* pdp = vmm_pml4_next(virt, 1);
+        if (!pdp) break;
+        uint64_t* pd = vmm_next_level(&pdp[(virt >> 30) & 0x1FF], HUGE_PAGE_SIZE_1G, 1);
+        if (!pd) break;
+        uint64_t* pt = vmm_next_level(&pd[(virt >> 21) & 0x1FF], HUGE_PAGE_SIZE_2M, 1);
+        if (!pt) break;
+
+        for (uint64_t i = (virt >> 12) & 0x1FF; i < 512 && virt < end; i++) {
+            if (pt[i] & PTE_PRESENT) tlb_gather_page(&tlb, virt);
+            pt[i] = phys | flags;
+            virt += PAGE_SIZE;
+            phys += PAGE_SIZE;
+        }
+    }
+
+    tlb_finish(&tlb);
+}
+
+int vmm_zap_range(struct mmu_gather* tlb, uint64_t virt, uint64_t size, int free_frames) {
+    uint64_t start = virt;
+    uint64_t end = virt + size;
+    int ret = 0;
+
+    while (virt >= start && virt < end) {
+        uint64_t* pdpe;
+        uint64_t* pde;
+        uint64_t* pdp = vmm_pml4_next(virt, 0);
+        if (!pdp) {
+            virt = (virt + (1ULL << 39)) & ~((1ULL << 39) - 1);
+            continue;
+        }
+
+        pdpe = &pdp[(virt >> 30) & 0x1FF];
+        if (!(*pdpe & PTE_PRESENT)) {
+            virt = (virt + HUGE_PAGE_SIZE_1G) & ~(HUGE_PAGE_SIZE_1G - 1);
+            continue;
+        }
+        if ((*pdpe & PTE_HUGE) && !(virt & (HUGE_PAGE_SIZE_1G - 1)) && end - virt >= HUGE_PAGE_SIZE_1G) {
+            *pdpe = 0;
+            tlb_gather_page(tlb, virt);
+            virt += HUGE_PAGE_SIZE_1G;
+            continue;
+        }
+        uint64_t* pd = vmm_next_level(pdpe, HUGE_PAGE_SIZE_1G, 0);
+        if (!pd) {
+            ret = -ENOMEM;
+            break;
+        }
+
+        pde = &pd[(virt >> 21) & 0x1FF];
+        if (!(*pde & PTE_PRESENT)) {
+            virt = (virt + HUGE_PAGE_SIZE_2M) & ~(HUGE_PAGE_SIZE_2M - 1);
+            continue;
+        }
+        if ((*pde & PTE_HUGE) && !(virt & (HUGE_PAGE_SIZE_2M - 1)) && end - virt >= HUGE_PAGE_SIZE_2M) {
+            uint64_t old = *pde;
+            uint64_t block = old & PTE_ADDR_MASK_2M;
+            *pde = 0;
+            tlb_gather_page(tlb, virt);
+            if (free_frames && pmm_get_order((void*)block) == HPAGE_PMD_ORDER) {
+                tlb_flush_mmu(tlb);
+                if (pmm_page_unref((void*)block)) pmm_free_pages((void*)block, HPAGE_PMD_NR);
+            } else if (free_frames && vmm_huge_is_split(old)) {
+                for (uint64_t i = 0; i < HPAGE_PMD_NR; i++) tlb_remove_page(tlb, block + i * PAGE_SIZE);
+            }
+            virt += HUGE_PAGE_SIZE_2M;
+            continue;
+        }
+        uint64_t* pt = vmm_next_level(pde, HUGE_PAGE_SIZE_2M, 0);
+        if (!pt) {
+            ret = -ENOMEM;
+            break;
+        }
+
+        for (uint64_t i = (virt >> 12) & 0x1FF; i < 512 && virt < end; i++) {
+            if (pt[i] & PTE_PRESENT) {
+                uint64_t frame = pt[i] & PTE_ADDR_MASK;
+                pt[i] = 0;
+                tlb_gather_page(tlb, virt);
+                if (free_frames) tlb_remove_page(tlb, frame);
+            } else if (free_frames && (pt[i] & PTE_SWAPPED)) {
+                swap_free(pte_to_swp_entry(pt[i]));
+                pt[i] = 0;
+            }
+            virt += PAGE_SIZE;
+        }
+    }
+    return ret;
+}
+
+int vmm_protect_range(uint64_t virt, uint64_t size, uint64_t set, uint64_t clear) {
+    struct mmu_gather tlb;
+    uint64_t start = virt;
+    uint64_t end = virt + size;
+    int ret = 0;
+
+    tlb_gather_init(&tlb);
+
+    while (virt >= start && virt < end) {
+        uint64_t* pdp = vmm_pml4_next(virt, 0);
+        if (!pdp) {
+            virt = (virt + (1ULL << 39)) & ~((1ULL << 39) - 1);
+            continue;
+        }
+
+        uint64_t* pdpe = &pdp[(virt >> 30) & 0x1FF];
+        if (!(*pdpe & PTE_PRESENT)) {
+            virt = (virt + HUGE_PAGE_SIZE_1G) & ~(HUGE_PAGE_SIZE_1G - 1);
+            continue;
+        }
+        uint64_t* pd = vmm_next_level(pdpe, HUGE_PAGE_SIZE_1G, 0);
+        if (!pd) {
+            ret = -ENOMEM;
+            break;
+        }
+
+        uint64_t* pde = &pd[(virt >> 21) & 0x1FF];
+        if (!(*pde & PTE_PRESENT)) {
+            virt = (virt + HUGE_PAGE_SIZE_2M) & ~(HUGE_PAGE_SIZE_2M - 1);
+            continue;
+        }
+        if ((*pde & PTE_HUGE) && !(virt & (HUGE_PAGE_SIZE_2M - 1)) && end - virt >= HUGE_PAGE_SIZE_2M) {
+            *pde = (*pde | set) & ~clear;
+            tlb_gather_page(&tlb, virt);
+            virt += HUGE_PAGE_SIZE_2M;
+            continue;
+        }
+        uint64_t* pt = vmm_next_level(pde, HUGE_PAGE_SIZE_2M, 0);
+        if (!pt) {
+            ret = -ENOMEM;
+            break;
+        }
+
+        for (uint64_t i = (virt >> 12) & 0x1FF; i < 512 && virt < end; i++) {
+            if (pt[i] & PTE_PRESENT) {
+                pt[i] = (pt[i] | set) & ~clear;
+                tlb_gather_page(&tlb, virt);
+            }
+            virt += PAGE_SIZE;
+        }
+    }
+
+    tlb_finish(&tlb);
+    return ret;
+}
+
+int vmm_user_range(uint64_t virt, uint64_t size) {
+    uint64_t end = virt + size;
+    if (!size || end < virt || end > 0x800000000000ULL) return 0;
+
+    for (uint64_t slot = virt >> 39; slot <= ((end - 1) >> 39); slot++) {
+        if (kernel_slots[slot]) return 0;
+    }
+    return 1;
+}
+
+int vmm_unmap_range(uint64_t virt, uint64_t size) {
+    struct mmu_gather tlb;
+
+    tlb_gather_init(&tlb);
+    int ret = vmm_zap_range(&tlb, virt, size, 0);
+    tlb_finish(&tlb);
+    return ret;
 }
 
 void vmm_unmap_page(uint64_t virt) {
-    uint64_t pml4_index = (virt >> 39) & 0x1FF;
     uint64_t pdp_index = (virt >> 30) & 0x1FF;
     uint64_t pd_index = (virt >> 21) & 0x1FF;
     uint64_t pt_index = (virt >> 12) & 0x1FF;
     
-    uint64_t* pml4 = current_pml4;
-    
-    if (!(pml4[pml4_index] & PTE_PRESENT)) return;
-    uint64_t* pdp = (uint64_t*)phys_to_virt(pml4[pml4_index] & 0xFFFFFFFFFF000);
-    
-    if (!(pdp[pdp_index] & PTE_PRESENT)) return;
-    uint64_t* pd = (uint64_t*)phys_to_virt(pdp[pdp_index] & 0xFFFFFFFFFF000);
-    
-    if (!(pd[pd_index] & PTE_PRESENT)) return;
-    uint64_t* pt = (uint64_t*)phys_to_virt(pd[pd_index] & 0xFFFFFFFFFF000);
+    uint64_t* pdp = vmm_pml4_next(virt, 0);
+    if (!pdp) return;
+    uint64_t* pd = vmm_next_level(&pdp[pdp_index], HUGE_PAGE_SIZE_1G, 0);
+    if (!pd) return;
+    uint64_t* pt = vmm_next_level(&pd[pd_index], HUGE_PAGE_SIZE_2M, 0);
+    if (!pt) return;
     
     pt[pt_index] = 0;
-    asm volatile("invlpg (%0)" :: "r"(virt) : "memory");
+    vmm_flush_page(virt);
 }
 
 uint64_t vmm_get_phys(uint64_t virt) {
@@ -92,17 +572,19 @@ uint64_t vmm_get_phys(uint64_t virt) {
     uint64_t* pml4 = current_pml4;
     
     if (!(pml4[pml4_index] & PTE_PRESENT)) return 0;
-    uint64_t* pdp = (uint64_t*)phys_to_virt(pml4[pml4_index] & 0xFFFFFFFFFF000);
+    uint64_t* pdp = (uint64_t*)phys_to_virt(pml4[pml4_index] & PTE_ADDR_MASK);
     
     if (!(pdp[pdp_index] & PTE_PRESENT)) return 0;
-    uint64_t* pd = (uint64_t*)phys_to_virt(pdp[pdp_index] & 0xFFFFFFFFFF000);
+    if (pdp[pdp_index] & PTE_HUGE) return (pdp[pdp_index] & PTE_ADDR_MASK_1G) | (virt & (HUGE_PAGE_SIZE_1G - 1));
+    uint64_t* pd = (uint64_t*)phys_to_virt(pdp[pdp_index] & PTE_ADDR_MASK);
     
     if (!(pd[pd_index] & PTE_PRESENT)) return 0;
-    uint64_t* pt = (uint64_t*)phys_to_virt(pd[pd_index] & 0xFFFFFFFFFF000);
+    if (pd[pd_index] & PTE_HUGE) return (pd[pd_index] & PTE_ADDR_MASK_2M) | (virt & (HUGE_PAGE_SIZE_2M - 1));
+    uint64_t* pt = (uint64_t*)phys_to_virt(pd[pd_index] & PTE_ADDR_MASK);
     
     if (!(pt[pt_index] & PTE_PRESENT)) return 0;
     
-    return (pt[pt_index] & 0xFFFFFFFFFF000) | (virt & 0xFFF);
+    return (pt[pt_index] & PTE_ADDR_MASK) | (virt & 0xFFF);
 }
 
 uint64_t vmm_get_pte(uint64_t virt) {
@@ -117,79 +599,575 @@ uint64_t vmm_get_pte(uint64_t virt) {
     uint64_t* pdp = (uint64_t*)phys_to_virt(pml4[pml4_index] & 0xFFFFFFFFFF000);
     
     if (!(pdp[pdp_index] & PTE_PRESENT)) return 0;
+    if (pdp[pdp_index] & PTE_HUGE) return pdp[pdp_index];
     uint64_t* pd = (uint64_t*)phys_to_virt(pdp[pdp_index] & 0xFFFFFFFFFF000);
     
     if (!(pd[pd_index] & PTE_PRESENT)) return 0;
+    if (pd[pd_index] & PTE_HUGE) return pd[pd_index];
     uint64_t* pt = (uint64_t*)phys_to_virt(pd[pd_index] & 0xFFFFFFFFFF000);
     
     return pt[pt_index];
 }
 
+int vmm_pmd_none(uint64_t virt) {
+    uint64_t pml4e = current_pml4[(virt >> 39) & 0x1FF];
+    if (!(pml4e & PTE_PRESENT)) return 1;
+
+    uint64_t pdpe = ((uint64_t*)phys_to_virt(pml4e & PTE_ADDR_MASK))[(virt >> 30) & 0x1FF];
+    if (!(pdpe & PTE_PRESENT)) return 1;
+    if (pdpe & PTE_HUGE) return 0;
+
+    return !((uint64_t*)phys_to_virt(pdpe & PTE_ADDR_MASK))[(virt >> 21) & 0x1FF];
+}
+
+static uint64_t* vmm_pgd_leaf(uint64_t* pgd, uint64_t virt, uint64_t* size) {
+    uint64_t* pml4e = &pgd[(virt >> 39) & 0x1FF];
+    if (!(*pml4e & PTE_PRESENT)) return 0;
+
+    uint64_t* pdpe = (uint64_t*)phys_to_virt(*pml4e & PTE_ADDR_MASK) + ((virt >> 30) & 0x1FF);
+    if (!(*pdpe & PTE_PRESENT)) return 0;
+    if (*pdpe & PTE_HUGE) {
+        *size = HUGE_PAGE_SIZE_1G;
+        return pdpe;
+    }
+
+    uint64_t* pde = (uint64_t*)phys_to_virt(*pdpe & PTE_ADDR_MASK) + ((virt >> 21) & 0x1FF);
+    if (!(*pde & PTE_PRESENT)) return 0;
+    if (*pde & PTE_HUGE) {
+        *size = HUGE_PAGE_SIZE_2M;
+        return pde;
+    }
+
+    uint64_t* pte = (uint64_t*)phys_to_virt(*pde & PTE_ADDR_MASK) + ((virt >> 12) & 0x1FF);
+    if (!(*pte & PTE_PRESENT)) return 0;
+    *size = PAGE_SIZE;
+    return pte;
+}
+
+static uint64_t* vmm_leaf_entry(uint64_t virt, uint64_t* size) {
+    return vmm_pgd_leaf(current_pml4, virt, size);
+}
+
+uint64_t* vmm_mm_leaf(struct mm_struct* mm, uint64_t virt, uint64_t* size) {
+    return vmm_pgd_leaf(mm->pgd, virt, size);
+}
+
+int vmm_handle_cow_fault(uint64_t virt, uint64_t err_code) {
+    if ((err_code & 3) != 3 || vmm_is_kernel_addr(virt)) return -1;
+
+retry:;
+    uint64_t size = 0;
+    uint64_t* entry = vmm_leaf_entry(virt, &size);
+    if (!entry || !(*entry & PTE_COW) || size == HUGE_PAGE_SIZE_1G) return -1;
+
+    if (size == HUGE_PAGE_SIZE_2M && vmm_huge_is_split(*entry)) {
+        if (vmm_split_huge(entry, size) != 0) return -1;
+        vmm_flush_page(virt & ~(size - 1));
+        goto retry;
+    }
+
+    uint64_t mask = (size == PAGE_SIZE) ? PTE_ADDR_MASK : PTE_ADDR_MASK_2M;
+    uint64_t old = *entry & mask;
+    uint64_t flags = ((*entry & ~mask) | PTE_WRITABLE) & ~(uint64_t)PTE_COW;
+
+    if (pmm_page_count((void*)old) == 1) {
+        *entry = old | flags;
+    } else {
+        void* copy = (size == PAGE_SIZE) ? pmm_alloc_page() : pmm_alloc_pages(HPAGE_PMD_NR);
+        if (!copy && size == HUGE_PAGE_SIZE_2M && vmm_split_huge(entry, size) == 0) {
+            vmm_flush_page(virt & ~(size - 1));
+            goto retry;
+        }
+        if (!copy) return -1;
+        memcpy(phys_to_virt((uint64_t)copy), phys_to_virt(old), size);
+        *entry = (uint64_t)copy | flags;
+
+        if (pmm_page_unref((void*)old)) {
+            if (size == PAGE_SIZE) pmm_free_page((void*)old);
+            else pmm_free_pages((void*)old, HPAGE_PMD_NR);
+        }
+    }
+
+    vmm_flush_page(virt & ~(size - 1));
+    return 0;
+}
+
 void vmm_dump_stats() {
     kprint_str("VMM Stats (CR3): ");
     kprint_hex((uint64_t)current_pml4);
     kprint_newline();
 }
 
-void vmm_free_user_space() {
-     
-    for (int i = 0; i < 256; i++) {
-        if (current_pml4[i] & PTE_PRESENT) {
-            uint64_t* pdp = (uint64_t*)phys_to_virt(current_pml4[i] & 0xFFFFFFFFFF000);
-            for (int j = 0; j < 512; j++) {
-                if (pdp[j] & PTE_PRESENT) {
-                    uint64_t* pd = (uint64_t*)phys_to_virt(pdp[j] & 0xFFFFFFFFFF000);
-                     
-                    for (int k = 0; k < 512; k++) {
-                        if (pd[k] & PTE_PRESENT) {
-                            if (pd[k] & 0x80) {  
-                                pmm_free_page((void*)phys_to_virt(pd[k] & 0xFFFFFFFFFF000));
-                            } else {
-                                uint64_t* pt = (uint64_t*)phys_to_virt(pd[k] & 0xFFFFFFFFFF000);
-                                for (int l = 0; l < 512; l++) {
-                                    if (pt[l] & PTE_PRESENT) {
-                                        pmm_free_page((void*)phys_to_virt(pt[l] & 0xFFFFFFFFFF000));
-                                    }
-                                }
-                                pmm_free_page(pt);
-                            }
-                        }
-                    }
-                    pmm_free_page(pd);
-                }
+void vmm_free_pgtables(struct mmu_gather* tlb, uint64_t start, uint64_t end) {
+    for (uint64_t i = start >> 39; i <= ((end - 1) >> 39) && i < 256; i++) {
+        if (kernel_slots[i] || !(current_pml4[i] & PTE_PRESENT)) continue;
+
+        vmm_free_table(tlb, current_pml4[i], 3);
+        current_pml4[i] = 0;
+    }
+}
+
+void mm_cache_init() {
+    mm_cachep = kmem_cache_create("mm_struct", sizeof(struct mm_struct), 0, SLAB_PANIC, 0);
+}
+
+struct mm_struct* mm_alloc() {
+    struct mm_struct* mm = (struct mm_struct*)kmem_cache_alloc(mm_cachep, 0);
+    if (!mm) return 0;
+
+    uint64_t pgd_phys = (uint64_t)pmm_alloc_page();
+    if (!pgd_phys) {
+        kmem_cache_free(mm_cachep, mm);
+        return 0;
+    }
+
+    mm->pgd = (uint64_t*)phys_to_virt(pgd_phys);
+    mm->pgd_phys = pgd_phys;
+    mm->pcid = 0;
+    mm->pcid_gen = 0;
+    mm->count = 1;
+    mm_init_vmas(mm);
+
+    uint64_t flags = local_irq_save();
+    for (int i = 0; i < 512; i++) {
+        mm->pgd[i] = kernel_slots[i] ? init_mm.pgd[i] : 0;
+    }
+    mm->prev = &init_mm;
+    mm->next = init_mm.next;
+    if (init_mm.next) init_mm.next->prev = mm;
+    init_mm.next = mm;
+    local_irq_restore(flags);
+
+    return mm;
+}
+
+static uint64_t vmm_share_entry(uint64_t* entry, uint64_t mask, int cow) {
+    uint64_t e = *entry;
+    if (cow && (e & PTE_WRITABLE)) {
+        e = (e & ~(uint64_t)PTE_WRITABLE) | PTE_COW;
+        *entry = e;
+    }
+    pmm_page_ref((void*)(e & mask));
+    return e;
+}
+
+static int vmm_copy_range(struct mm_struct* dst, struct mm_struct* src, uint64_t start, uint64_t end, int cow) {
+    uint64_t virt = start;
+
+    while (virt >= start && virt < end) {
+        uint64_t pml4e = src->pgd[(virt >> 39) & 0x1FF];
+        if (!(pml4e & PTE_PRESENT)) {
+            virt = (virt + (1ULL << 39)) & ~((1ULL << 39) - 1);
+            continue;
+        }
+
+        uint64_t* spdpe = (uint64_t*)phys_to_virt(pml4e & PTE_ADDR_MASK) + ((virt >> 30) & 0x1FF);
+        if (!(*spdpe & PTE_PRESENT)) {
+            virt = (virt + HUGE_PAGE_SIZE_1G) & ~(HUGE_PAGE_SIZE_1G - 1);
+            continue;
+        }
+
+        uint64_t* pdp = vmm_next_level(&dst->pgd[(virt >> 39) & 0x1FF], 0, 1);
+        if (!pdp) return -1;
+
+        if (*spdpe & PTE_HUGE) {
+            pdp[(virt >> 30) & 0x1FF] = *spdpe;
+            virt = (virt + HUGE_PAGE_SIZE_1G) & ~(HUGE_PAGE_SIZE_1G - 1);
+            continue;
+        }
+
+        uint64_t* spde = (uint64_t*)phys_to_virt(*spdpe & PTE_ADDR_MASK) + ((virt >> 21) & 0x1FF);
+        if (!(*spde & PTE_PRESENT)) {
+            virt = (virt + HUGE_PAGE_SIZE_2M) & ~(HUGE_PAGE_SIZE_2M - 1);
+            continue;
+        }
+
+        uint64_t* pd = vmm_next_level(&pdp[(virt >> 30) & 0x1FF], HUGE_PAGE_SIZE_1G, 1);
+        if (!pd) return -1;
+
+        if ((*spde & PTE_HUGE) && vmm_huge_is_split(*spde) && vmm_split_huge(spde, HUGE_PAGE_SIZE_2M) != 0) {
+            return -1;
+        }
+        if (*spde & PTE_HUGE) {
+            pd[(virt >> 21) & 0x1FF] = vmm_share_entry(spde, PTE_ADDR_MASK_2M, cow);
+            virt = (virt + HUGE_PAGE_SIZE_2M) & ~(HUGE_PAGE_SIZE_2M - 1);
+            continue;
+        }
+
+        uint64_t* spt = (uint64_t*)phys_to_virt(*spde & PTE_ADDR_MASK);
+        uint64_t* pt = vmm_next_level(&pd[(virt >> 21) & 0x1FF], HUGE_PAGE_SIZE_2M, 1);
+        if (!pt) return -1;
+
+        for (uint64_t i = (virt >> 12) & 0x1FF; i < 512 && virt < end; i++) {
+            if (spt[i] & PTE_PRESENT) {
+                pt[i] = vmm_share_entry(&spt[i], PTE_ADDR_MASK, cow);
+            } else if (spt[i]) {
+                if (spt[i] & PTE_SWAPPED) swap_duplicate(pte_to_swp_entry(spt[i]));
+                pt[i] = spt[i];
             }
-            pmm_free_page(pdp);
-            current_pml4[i] = 0;
+            virt += PAGE_SIZE;
         }
     }
-     
-    uint64_t cr3;
-    asm volatile("mov %%cr3, %0" : "=r"(cr3));
-    asm volatile("mov %0, %%cr3" :: "r"(cr3));
+    return 0;
 }
 
-int vmm_swap_out_victim() {
-    return -1;  
+static void vmm_flush_mm(struct mm_struct* mm) {
+    if (mm->pgd == current_pml4) {
+        uint64_t cr3;
+        asm volatile("mov %%cr3, %0" : "=r"(cr3));
+        asm volatile("mov %0, %%cr3" :: "r"(cr3) : "memory");
+    } else {
+        mm->pcid_gen = 0;
+    }
 }
 
- 
-static uint64_t mmio_virt_base = 0xFFFF800000000000;
+void vmm_flush_mm_page(struct mm_struct* mm, uint64_t virt) {
+    if (mm->pgd == current_pml4) vmm_flush_page(virt);
+    else mm->pcid_gen = 0;
+}
 
-void *ioremap(uint64_t phys_addr, uint64_t size) {
-    uint64_t offset = phys_addr & 0xFFF;
-    uint64_t base_phys = phys_addr & ~0xFFF;
-    uint64_t pages = (size + offset + 0xFFF) / 0x1000;
-    
-    uint64_t virt_addr = mmio_virt_base;
-    mmio_virt_base += pages * 0x1000;
-    
-    for (uint64_t i = 0; i < pages; i++) {
-        vmm_map_page(virt_addr + i * 0x1000, base_phys + i * 0x1000, PTE_PRESENT | PTE_WRITABLE);
+struct mm_struct* mm_dup(struct mm_struct* oldmm) {
+    struct mm_struct* mm = mm_alloc();
+    if (!mm || !oldmm) return mm;
+
+    if (dup_mmap(mm, oldmm) != 0) goto fail;
+
+    for (struct vm_area_struct* vma = mm->mmap; vma; vma = vma->vm_next) {
+        if (vmm_copy_range(mm, oldmm, vma->vm_start, vma->vm_end, !(vma->vm_flags & VM_SHARED)) != 0) {
+            goto fail;
+        }
     }
-    
-    return (void*)(virt_addr + offset);
+    vmm_flush_mm(oldmm);
+    return mm;
+
+fail:
+    vmm_flush_mm(oldmm);
+    mm_put(mm);
+    return 0;
+}
+
+void mm_get(struct mm_struct* mm) {
+    if (mm && mm != &init_mm) mm->count++;
+}
+
+void mm_put(struct mm_struct* mm) {
+    if (!mm || mm == &init_mm) return;
+    if (--mm->count > 0) return;
+
+    uint64_t flags = local_irq_save();
+    uint64_t* saved = current_pml4;
+    current_pml4 = mm->pgd;
+    exit_mmap(mm);
+    current_pml4 = saved;
+
+    if (swap_hand_mm == mm) {
+        swap_hand_mm = mm->next;
+        swap_hand_addr = 0;
+    }
+    khugepaged_exit(mm);
+
+    mm->prev->next = mm->next;
+    if (mm->next) mm->next->prev = mm->prev;
+    local_irq_restore(flags);
+
+    pmm_free_page((void*)mm->pgd_phys);
+    kmem_cache_free(mm_cachep, mm);
 }
 
-void iounmap(void *virt_addr) {
-    (void)virt_addr;
+void switch_mm(struct mm_struct* prev, struct mm_struct* next) {
+    uint64_t cr3 = next->pgd_phys;
+
+    if (prev == next) return;
+
+    if (pcid_enabled) {
+        if (kernel_tlb_stale) {
+            kernel_tlb_stale = 0;
+            if (prev && prev->pcid_gen == pcid_generation) prev->pcid_gen++;
+            pcid_generation++;
+        }
+        if (next->pcid_gen != pcid_generation) {
+            if (pcid_next >= PCID_MAX) {
+                pcid_generation++;
+                pcid_next = 1;
+            }
+            next->pcid = pcid_next++;
+            next->pcid_gen = pcid_generation;
+            cr3 |= next->pcid;
+        } else {
+            cr3 |= next->pcid | CR3_NOFLUSH;
+        }
+    }
+
+    current_pml4 = next->pgd;
+    asm volatile("mov %0, %%cr3" :: "r"(cr3) : "memory");
+}
+
+#define VMM_BENCH_BASE 0x8000000000ULL
+#define VMM_BENCH_ITERS 64
+
+static inline uint64_t vmm_rdtsc() {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+void vmm_fork_bench() {
+    static const uint64_t rss_pages[] = { 16, 256, 4096, 16384 };
+    uint64_t base_cycles = 0;
+
+    if (current_pml4 != init_mm.pgd) return;
+    kprint_str("VMM: fork bench, mm_dup copies and write-protects every PTE, cost is O(RSS)\n");
+
+    for (int s = 0; s < 4; s++) {
+        struct mm_struct* mm = mm_alloc();
+        if (!mm) return;
+        switch_mm(&init_mm, mm);
+        mmap_region(mm, VMM_BENCH_BASE, rss_pages[s] * PAGE_SIZE, VM_READ | VM_WRITE, 0, 0);
+
+        uint64_t mapped = 0;
+        for (; mapped < rss_pages[s]; mapped++) {
+            void* frame = pmm_alloc_page();
+            if (!frame) break;
+            vmm_map_page(VMM_BENCH_BASE + mapped * PAGE_SIZE, (uint64_t)frame, PTE_PRESENT | PTE_WRITABLE | PTE_USER);
+        }
+
+        uint64_t start = vmm_rdtsc();
+        int iters = 0;
+        for (; iters < VMM_BENCH_ITERS; iters++) {
+            struct mm_struct* child = mm_dup(mm);
+            if (!child) break;
+            mm_put(child);
+        }
+        uint64_t cycles = iters ? (vmm_rdtsc() - start) / iters : 0;
+
+        switch_mm(mm, &init_mm);
+        mm_put(mm);
+
+        kprint_str("VMM: fork+exit RSS ");
+        kprint_dec(mapped * 4);
+        kprint_str(" KB: ");
+        kprint_dec(cycles);
+        kprint_str(" cycles, ");
+        kprint_dec(mapped ? cycles / mapped : 0);
+        kprint_str(" per page, x");
+        if (!base_cycles) base_cycles = cycles;
+        kprint_dec(base_cycles ? cycles / base_cycles : 0);
+        kprint_str(" vs 64 KB\n");
+    }
+}
+
+static uint64_t* vmm_scan_pte(uint64_t* pgd, uint64_t virt, uint64_t* next) {
+    uint64_t pml4e = pgd[(virt >> 39) & 0x1FF];
+    if (!(pml4e & PTE_PRESENT)) {
+        *next = (virt + (1ULL << 39)) & ~((1ULL << 39) - 1);
+        return 0;
+    }
+
+    uint64_t pdpe = ((uint64_t*)phys_to_virt(pml4e & PTE_ADDR_MASK))[(virt >> 30) & 0x1FF];
+    if (!(pdpe & PTE_PRESENT) || (pdpe & PTE_HUGE)) {
+        *next = (virt + HUGE_PAGE_SIZE_1G) & ~(HUGE_PAGE_SIZE_1G - 1);
+        return 0;
+    }
+
+    uint64_t pde = ((uint64_t*)phys_to_virt(pdpe & PTE_ADDR_MASK))[(virt >> 21) & 0x1FF];
+    if (!(pde & PTE_PRESENT) || (pde & PTE_HUGE)) {
+        *next = (virt + HUGE_PAGE_SIZE_2M) & ~(HUGE_PAGE_SIZE_2M - 1);
+        return 0;
+    }
+
+    *next = virt + PAGE_SIZE;
+    return (uint64_t*)phys_to_virt(pde & PTE_ADDR_MASK) + ((virt >> 12) & 0x1FF);
+}
+
+static void vmm_swap_unpin(uint64_t frame) {
+    if (pmm_page_unref((void*)frame)) pmm_free_page((void*)frame);
+}
+
+static int vmm_swap_batch(struct mm_struct* mm, uint64_t* addrs, uint64_t* old, uint64_t* frames, int nr) {
+    swap_entry_t entries[SWAP_BATCH];
+
+    int got = get_swap_pages(nr, entries);
+    if (got > 0 && swap_writepages(frames, entries, got) != 0) {
+        for (int i = 0; i < got; i++) swap_free(entries[i]);
+        got = 0;
+    }
+
+    int swapped = 0;
+    uint64_t flags = local_irq_save();
+    for (int i = 0; i < got; i++) {
+        uint64_t next;
+        uint64_t* pte = vmm_scan_pte(mm->pgd, addrs[i], &next);
+        if (!pte || *pte != old[i]) {
+            swap_free(entries[i]);
+            continue;
+        }
+
+        *pte = swp_entry_to_pte(entries[i]);
+        pmm_page_unref((void*)frames[i]);
+        swapped++;
+    }
+    if (swapped) vmm_flush_mm(mm);
+    for (int i = 0; i < nr; i++) vmm_swap_unpin(frames[i]);
+    local_irq_restore(flags);
+
+    return got > 0 ? swapped : -1;
+}
+
+static int vmm_swap_shared(struct page* page) {
+    uint64_t frame = page_to_phys(page);
+    swap_entry_t entry;
+
+    if (get_swap_pages(1, &entry) != 1) {
+        vmm_swap_unpin(frame);
+        return -1;
+    }
+    if (swap_writepages(&frame, &entry, 1) != 0) {
+        swap_free(entry);
+        vmm_swap_unpin(frame);
+        return -1;
+    }
+
+    uint64_t flags = local_irq_save();
+    int unmapped = 0;
+    if (pmm_page_count((void*)frame) > 1 && PageAnon(page) && !page_referenced(page)) {
+        unmapped = try_to_unmap(page, swp_entry_to_pte(entry)) != SWAP_FAIL;
+    }
+    if (!unmapped) swap_free(entry);
+
+    int freed = pmm_page_unref((void*)frame);
+    if (freed) pmm_free_page((void*)frame);
+    local_irq_restore(flags);
+
+    return unmapped ? freed : -1;
+}
+
+int vmm_swap_out_victim() {
+    uint64_t addrs[SWAP_BATCH];
+    uint64_t old[SWAP_BATCH];
+    uint64_t frames[SWAP_BATCH];
+    struct page* shared[SWAP_BATCH];
+    int nr = 0;
+    int nr_shared = 0;
+    int wraps = 0;
+    int young = 0;
+
+    uint64_t flags = local_irq_save();
+    struct mm_struct* mm = swap_hand_mm;
+    uint64_t addr = swap_hand_addr;
+
+    while (nr + nr_shared < SWAP_BATCH) {
+        if (!mm) {
+            if (++wraps > 2 || !init_mm.next) break;
+            mm = init_mm.next;
+            addr = 0;
+        }
+
+        struct vm_area_struct* vma = find_vma(mm, addr);
+        if (!vma) {
+            if (young) vmm_flush_mm(mm);
+            young = 0;
+            if (nr || nr_shared) break;
+            mm = mm->next;
+            addr = 0;
+            continue;
+        }
+
+        if (addr < vma->vm_start) addr = vma->vm_start;
+        if (vma->vm_flags & VM_SHARED) {
+            addr = vma->vm_end;
+            continue;
+        }
+
+        while (addr < vma->vm_end && nr + nr_shared < SWAP_BATCH) {
+            uint64_t next;
+            uint64_t* pte = vmm_scan_pte(mm->pgd, addr, &next);
+
+            if (pte && (*pte & (PTE_PRESENT | PTE_USER)) == (PTE_PRESENT | PTE_USER)) {
+                uint64_t frame = *pte & PTE_ADDR_MASK;
+                struct page* page = phys_to_page(frame);
+                if (pmm_page_count((void*)frame) > 1 && PageAnon(page)) {
+                    if (!page_referenced(page)) {
+                        pmm_page_ref((void*)frame);
+                        shared[nr_shared++] = page;
+                    }
+                } else if (*pte & PTE_ACCESSED) {
+                    *pte &= ~(uint64_t)PTE_ACCESSED;
+                    young = 1;
+                } else if (pmm_page_count((void*)frame) == 1) {
+                    pmm_page_ref((void*)frame);
+                    addrs[nr] = addr;
+                    old[nr] = *pte;
+                    frames[nr++] = frame;
+                }
+            }
+            addr = next;
+        }
+    }
+
+    swap_hand_mm = mm;
+    swap_hand_addr = addr;
+
+    if (mm && young) vmm_flush_mm(mm);
+    if (nr) mm_get(mm);
+    local_irq_restore(flags);
+
+    int freed = -1;
+    if (nr) {
+        freed = vmm_swap_batch(mm, addrs, old, frames, nr);
+        mm_put(mm);
+    }
+    for (int i = 0; i < nr_shared; i++) {
+        if (vmm_swap_shared(shared[i]) > 0) freed = (freed > 0 ? freed : 0) + 1;
+    }
+    return freed;
+}
+
+int vmm_collapse_huge(struct mm_struct* mm, uint64_t haddr, uint64_t block, int max_none) {
+    uint64_t pml4e = mm->pgd[(haddr >> 39) & 0x1FF];
+    if (!(pml4e & PTE_PRESENT)) return 0;
+
+    uint64_t pdpe = ((uint64_t*)phys_to_virt(pml4e & PTE_ADDR_MASK))[(haddr >> 30) & 0x1FF];
+    if (!(pdpe & PTE_PRESENT) || (pdpe & PTE_HUGE)) return 0;
+
+    uint64_t* pde = (uint64_t*)phys_to_virt(pdpe & PTE_ADDR_MASK) + ((haddr >> 21) & 0x1FF);
+    if (!(*pde & PTE_PRESENT) || (*pde & PTE_HUGE)) return 0;
+
+    uint64_t pt_phys = *pde & PTE_ADDR_MASK;
+    uint64_t* pt = (uint64_t*)phys_to_virt(pt_phys);
+    uint64_t prot_mask = PTE_PRESENT | PTE_WRITABLE | PTE_USER | PTE_PWT | PTE_PCD | PTE_HUGE | PTE_COW | PTE_NO_EXEC;
+    uint64_t prot = 0;
+    int none = 0;
+
+    for (int i = 0; i < 512; i++) {
+        if (!pt[i]) {
+            if (++none > max_none) return 0;
+            continue;
+        }
+        if (!(pt[i] & PTE_PRESENT)) return 0;
+        if (!prot) prot = pt[i] & prot_mask;
+        if ((pt[i] & prot_mask) != prot) return 0;
+
+        uint64_t frame = pt[i] & PTE_ADDR_MASK;
+        struct page* page = phys_to_page(frame);
+        if (pmm_page_count((void*)frame) != 1 || (page->mapping && !PageAnon(page))) return 0;
+    }
+    if (prot != (prot & (PTE_PRESENT | PTE_WRITABLE | PTE_USER | PTE_NO_EXEC))) return 0;
+    if (!(prot & PTE_USER)) return 0;
+
+    for (int i = 0; i < 512; i++) {
+        void* dst = phys_to_virt(block + i * PAGE_SIZE);
+        if (pt[i]) memcpy(dst, phys_to_virt(pt[i] & PTE_ADDR_MASK), PAGE_SIZE);
+        else memset(dst, 0, PAGE_SIZE);
+    }
+
+    *pde = block | prot | PTE_HUGE;
+    vmm_flush_mm(mm);
+
+    for (int i = 0; i < 512; i++) {
+        if (!pt[i]) continue;
+        uint64_t frame = pt[i] & PTE_ADDR_MASK;
+        if (pmm_page_unref((void*)frame)) pmm_free_page((void*)frame);
+    }
+    pmm_free_page((void*)pt_phys);
+    return 1;
 }
@@ -0,0 +1,325 @@
+#include "mm/compaction.h"
+#include "mm/rmap.h"
+#include "mm/page_cache.h"
+#include "mm/vmscan.h"
+#include "mm/numa.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "string.h"
+#include "process.h"
+#include "console.h"
+
+#define COMPACT_BLOCK_WORDS ((1ULL << PMM_MAX_ORDER) / 64)
+
+struct compact_control {
+    uint64_t pfn;
+    unsigned int order;
+    uint64_t held[COMPACT_BLOCK_WORDS];
+};
+
+static struct compact_stats compact_stats;
+static struct process *kcompactd_task;
+static volatile int compacting = 0;
+static unsigned int kcompactd_order = 0;
+static uint64_t compact_cached_pfn[MAX_NUMNODES];
+static unsigned int compact_considered[MAX_NUMNODES];
+static unsigned int compact_defer_shift[MAX_NUMNODES];
+static unsigned int compact_order_failed[MAX_NUMNODES] = { [0 ... MAX_NUMNODES - 1] = PMM_MAX_ORDER + 1 };
+
+static void defer_compaction(int nid, unsigned int order) {
+    compact_considered[nid] = 0;
+    if (++compact_defer_shift[nid] > COMPACT_MAX_DEFER_SHIFT) compact_defer_shift[nid] = COMPACT_MAX_DEFER_SHIFT;
+    if (order < compact_order_failed[nid]) compact_order_failed[nid] = order;
+}
+
+static int compaction_deferred(int nid, unsigned int order) {
+    unsigned int limit = 1U << compact_defer_shift[nid];
+
+    if (order < compact_order_failed[nid]) return 0;
+    if (++compact_considered[nid] >= limit) {
+        compact_considered[nid] = limit;
+        return 0;
+    }
+    return 1;
+}
+
+static void compaction_defer_reset(int nid, unsigned int order) {
+    compact_considered[nid] = 0;
+    compact_defer_shift[nid] = 0;
+    if (order >= compact_order_failed[nid]) compact_order_failed[nid] = order + 1;
+}
+
+static int page_movable(struct page *page) {
+    if (PageLocked(page)) return 0;
+    if (PageAnon(page)) return 1;
+    return page->mapping && PageLRU(page) && page->_count == 1;
+}
+
+static void page_reset(struct page *page) {
+    page->flags = 0;
+    page->_count = 0;
+    page->_mapcount = 0;
+    page->mapping = 0;
+    page->index = 0;
+    page->private = 0;
+    INIT_LIST_HEAD(&page->lru);
+}
+
+static int migrate_page(struct page *page) {
+    if (!page_movable(page)) return -1;
+
+    uint64_t old = page_to_phys(page);
+    void *frame = pmm_alloc_page_node(pmm_page_nid((void*)old));
+    if (!frame) return -1;
+
+    struct page *newpage = phys_to_page((uint64_t)frame);
+    memcpy(phys_to_virt((uint64_t)frame), phys_to_virt(old), PAGE_SIZE);
+
+    newpage->flags = page->flags & ~(unsigned long)((1 << PG_lru) | (1 << PG_active));
+    newpage->_mapcount = page->_mapcount;
+    newpage->private = page->private;
+    INIT_LIST_HEAD(&newpage->lru);
+
+    struct address_space *mapping = page->mapping;
+    if (PageAnon(page)) {
+        newpage->_count = page->_count;
+        newpage->mapping = mapping;
+        newpage->index = page->index;
+        if (try_to_migrate(page, newpage) != SWAP_SUCCESS) goto fail;
+    } else {
+        if (migrate_page_mapping(mapping, page, newpage) != 0) goto fail;
+        if (try_to_migrate(page, newpage) != SWAP_SUCCESS) {
+            migrate_page_mapping(mapping, newpage, page);
+            goto fail;
+        }
+    }
+
+    lru_cache_replace(page, newpage);
+    page_reset(page);
+    return 0;
+
+fail:
+    page_reset(newpage);
+    pmm_free_page(frame);
+    return -1;
+}
+
+static inline void compact_hold(struct compact_control *cc, uint64_t i, uint64_t nr) {
+    for (uint64_t j = i; j < i + nr; j++) cc->held[j / 64] |= 1ULL << (j % 64);
+}
+
+static inline int compact_held(struct compact_control *cc, uint64_t i) {
+    return (cc->held[i / 64] >> (i % 64)) & 1;
+}
+
+static void compact_release(struct compact_control *cc) {
+    uint64_t nr = 1ULL << cc->order;
+
+    for (uint64_t i = 0; i < nr; ) {
+        if (!compact_held(cc, i)) {
+            i++;
+            continue;
+        }
+        uint64_t run = i;
+        while (i < nr && compact_held(cc, i)) i++;
+        pmm_free_pages((void*)((cc->pfn + run) * PAGE_SIZE), i - run);
+    }
+}
+
+static int compact_block_suitable(uint64_t pfn, unsigned int order) {
+    uint64_t nr = 1ULL << order;
+    int movable = 0;
+
+    for (uint64_t i = 0; i < nr; ) {
+        void *addr = (void*)((pfn + i) * PAGE_SIZE);
+        int free_order = pmm_buddy_order(addr);
+        if (free_order >= 0) {
+            i += 1ULL << free_order;
+            continue;
+        }
+        if (pmm_get_order(addr) != 0 || !page_movable(pfn_to_page(pfn + i))) return -1;
+        movable++;
+        i++;
+    }
+    return movable;
+}
+
+static int compact_block(struct compact_control *cc) {
+    uint64_t nr = 1ULL << cc->order;
+    memset(cc->held, 0, sizeof(cc->held));
+
+    pmm_drain_all();
+    for (uint64_t i = 0; i < nr; ) {
+        int order = pmm_isolate_free_block((void*)((cc->pfn + i) * PAGE_SIZE), cc->order);
+        if (order < 0) {
+            i++;
+            continue;
+        }
+        compact_hold(cc, i, 1ULL << order);
+        i += 1ULL << order;
+    }
+
+    for (uint64_t i = 0; i < nr; i++) {
+        if (compact_held(cc, i)) continue;
+        if (migrate_page(pfn_to_page(cc->pfn + i)) != 0) {
+            compact_stats.migrate_failed++;
+            compact_release(cc);
+            return -1;
+        }
+        compact_hold(cc, i, 1);
+        compact_stats.pages_migrated++;
+    }
+
+    pmm_free_pages((void*)(cc->pfn * PAGE_SIZE), nr);
+    return 0;
+}
+
+int compact_node(int nid, unsigned int order) {
+    if (order == 0 || order > PMM_MAX_ORDER) return COMPACT_FAIL;
+    if (__sync_lock_test_and_set(&compacting, 1)) return COMPACT_BUSY;
+
+    uint64_t start, end;
+    uint64_t nr = 1ULL << order;
+    pmm_node_span(nid, &start, &end);
+    start = (start + nr - 1) & ~(nr - 1);
+
+    struct compact_control cc;
+    cc.order = order;
+    pmm_drain_all();
+
+    uint64_t pfn = compact_cached_pfn[nid] & ~(nr - 1);
+    uint64_t blocks = end > start ? (end - start) / nr : 0;
+    int ret = COMPACT_FAIL;
+
+    for (uint64_t scanned = 0; scanned < blocks; scanned++, pfn += nr) {
+        if (pfn < start || pfn + nr > end) pfn = start;
+        compact_stats.migrate_scanned++;
+
+        int free_order = pmm_buddy_order((void*)(pfn * PAGE_SIZE));
+        if (free_order >= (int)order) {
+            ret = COMPACT_SUCCESS;
+            pfn += nr;
+            break;
+        }
+        if (compact_block_suitable(pfn, order) < 0) {
+            compact_stats.blocks_skipped++;
+            continue;
+        }
+
+        uint64_t flags = local_irq_save();
+        cc.pfn = pfn;
+        int err = compact_block(&cc);
+        local_irq_restore(flags);
+
+        if (err == 0) {
+            ret = COMPACT_SUCCESS;
+            pfn += nr;
+            break;
+        }
+    }
+
+    compact_cached_pfn[nid] = pfn;
+    __sync_lock_release(&compacting);
+    return ret;
+}
+
+int try_to_compact_pages(int nid, unsigned int order) {
+    if (order > COMPACT_DIRECT_MAX_ORDER) {
+        wakeup_kcompactd(order);
+        return 0;
+    }
+    if (nid < 0 || nid >= nr_node_ids) nid = numa_node_id();
+
+    compact_stats.compact_stall++;
+    for (int i = 0; i < nr_node_ids; i++) {
+        int n = node_fallback(nid, i);
+        if (compaction_deferred(n, order)) {
+            compact_stats.compact_deferred++;
+            continue;
+        }
+        int ret = compact_node(n, order);
+        if (ret == COMPACT_SUCCESS) {
+            compaction_defer_reset(n, order);
+            compact_stats.compact_success++;
+            return 1;
+        }
+        if (ret == COMPACT_FAIL) defer_compaction(n, order);
+    }
+
+    compact_stats.compact_fail++;
+    wakeup_kcompactd(order);
+    return 0;
+}
+
+void wakeup_kcompactd(unsigned int order) {
+    if (order > PMM_MAX_ORDER) order = PMM_MAX_ORDER;
+    if (order > kcompactd_order) kcompactd_order = order;
+}
+
+static void kcompactd_node(int nid, unsigned int order, uint64_t target) {
+    for (uint64_t i = 0; i < target; i++) {
+        if (pmm_node_free_blocks(nid, order) >= target) return;
+        if (!pmm_node_watermark_ok(nid, PMM_WMARK_HIGH)) return;
+
+        compact_stats.kcompactd_runs++;
+        if (compact_node(nid, order) != COMPACT_SUCCESS) return;
+        compaction_defer_reset(nid, order);
+    }
+}
+
+static void kcompactd(void *arg) {
+    (void)arg;
+
+    while (1) {
+        process_sleep(KCOMPACTD_SLEEP_TICKS);
+
+        unsigned int order = kcompactd_order;
+        kcompactd_order = 0;
+
+        for (int nid = 0; nid < nr_node_ids; nid++) {
+            if (order > COMPACT_PROACTIVE_ORDER) kcompactd_node(nid, order, 1);
+            kcompactd_node(nid, COMPACT_PROACTIVE_ORDER, COMPACT_PROACTIVE_BLOCKS);
+        }
+    }
+}
+
+void kcompactd_init(void) {
+    kcompactd_task = process_create_kthread(kcompactd, 0);
+    if (!kcompactd_task) {
+        kprint_str("COMPACT: Failed to start kcompactd\n");
+        return;
+    }
+    process_set_priority(kcompactd_task->pid, MLFQ_LEVELS - 1);
+
+    kprint_str("COMPACT: kcompactd started, keeping ");
+    kprint_dec(COMPACT_PROACTIVE_BLOCKS);
+    kprint_str(" order-");
+    kprint_dec(COMPACT_PROACTIVE_ORDER);
+    kprint_str(" blocks per node\n");
+}
+
+void compaction_get_stats(struct compact_stats *stats) {
+    if (stats) *stats = compact_stats;
+}
+
+void compaction_dump_stats(void) {
+    kprint_str("COMPACT: stall ");
+    kprint_dec(compact_stats.compact_stall);
+    kprint_str(" success ");
+    kprint_dec(compact_stats.compact_success);
+    kprint_str(" fail ");
+    kprint_dec(compact_stats.compact_fail);
+    kprint_str(" deferred ");
+    kprint_dec(compact_stats.compact_deferred);
+    kprint_str(" scanned ");
+    kprint_dec(compact_stats.migrate_scanned);
+    kprint_str(" skipped ");
+    kprint_dec(compact_stats.blocks_skipped);
+    kprint_str(" migrated ");
+    kprint_dec(compact_stats.pages_migrated);
+    kprint_str(" failed ");
+    kprint_dec(compact_stats.migrate_failed);
+    kprint_str(" kcompactd ");
+    kprint_dec(compact_stats.kcompactd_runs);
+    kprint_newline();
+}
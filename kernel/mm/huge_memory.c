@@ -0,0 +1,175 @@
+#include "mm/huge_memory.h"
+#include "mm/rmap.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "string.h"
+#include "process.h"
+#include "console.h"
+
+static struct thp_stats thp_stats;
+static struct process *khugepaged_task;
+static struct mm_struct *khugepaged_scan_mm;
+static uint64_t khugepaged_scan_addr;
+static uint64_t khugepaged_hpage;
+
+static int thp_vma_suitable(struct vm_area_struct *vma, uint64_t haddr) {
+    if (vma->vm_file || (vma->vm_flags & VM_SHARED)) return 0;
+    if (!(vma->vm_flags & (VM_READ | VM_WRITE | VM_EXEC))) return 0;
+    return haddr >= vma->vm_start && haddr + HUGE_PAGE_SIZE_2M <= vma->vm_end;
+}
+
+int do_huge_anonymous_fault(struct vm_area_struct *vma, uint64_t addr, uint64_t flags) {
+    uint64_t haddr = addr & ~(HUGE_PAGE_SIZE_2M - 1);
+
+    if (!thp_vma_suitable(vma, haddr) || !vmm_pmd_none(haddr)) return -1;
+
+    void *block = pmm_watermark_ok(PMM_WMARK_LOW) ? pmm_alloc_pages(HPAGE_PMD_NR) : 0;
+    if (!block) {
+        thp_stats.fault_fallback++;
+        return -1;
+    }
+    memset(phys_to_virt((uint64_t)block), 0, HUGE_PAGE_SIZE_2M);
+
+    if (vma->vm_flags & VM_WRITE) flags |= PTE_WRITABLE;
+    if (vmm_map_huge(haddr, (uint64_t)block, HUGE_PAGE_SIZE_2M, flags) != 0) {
+        pmm_free_pages(block, HPAGE_PMD_NR);
+        thp_stats.fault_fallback++;
+        return -1;
+    }
+
+    page_add_anon_rmap(phys_to_page((uint64_t)block), vma, haddr);
+    thp_stats.fault_alloc++;
+    return 0;
+}
+
+void thp_count_split(void) {
+    thp_stats.split++;
+}
+
+void khugepaged_exit(struct mm_struct *mm) {
+    if (khugepaged_scan_mm == mm) {
+        khugepaged_scan_mm = mm->next;
+        khugepaged_scan_addr = 0;
+    }
+}
+
+static uint64_t khugepaged_scan(uint64_t pages) {
+    uint64_t progress = 0;
+    int wraps = 0;
+
+    uint64_t flags = local_irq_save();
+    struct mm_struct *mm = khugepaged_scan_mm;
+    uint64_t addr = khugepaged_scan_addr;
+
+    while (progress < pages && khugepaged_hpage) {
+        if (!mm) {
+            if (wraps++ || !init_mm.next) break;
+            mm = init_mm.next;
+            addr = 0;
+            thp_stats.full_scans++;
+        }
+
+        struct vm_area_struct *vma = find_vma(mm, addr);
+        if (!vma) {
+            mm = mm->next;
+            addr = 0;
+            continue;
+        }
+
+        if (addr < vma->vm_start) addr = vma->vm_start;
+        addr = (addr + HUGE_PAGE_SIZE_2M - 1) & ~(HUGE_PAGE_SIZE_2M - 1);
+
+        while (progress < pages && thp_vma_suitable(vma, addr)) {
+            int ret = vmm_collapse_huge(mm, addr, khugepaged_hpage, KHUGEPAGED_MAX_PTES_NONE);
+            if (ret > 0) {
+                page_add_anon_rmap(phys_to_page(khugepaged_hpage), vma, addr);
+                khugepaged_hpage = 0;
+                thp_stats.pages_collapsed++;
+            }
+            progress += HPAGE_PMD_NR;
+            addr += HUGE_PAGE_SIZE_2M;
+            if (!khugepaged_hpage) break;
+        }
+        if (!thp_vma_suitable(vma, addr)) {
+            addr = vma->vm_end;
+            progress++;
+        }
+    }
+
+    khugepaged_scan_mm = mm;
+    khugepaged_scan_addr = addr;
+    local_irq_restore(flags);
+    return progress;
+}
+
+static int khugepaged_alloc_page(void) {
+    if (khugepaged_hpage) return 1;
+    if (!pmm_watermark_ok(PMM_WMARK_HIGH)) return 0;
+
+    khugepaged_hpage = (uint64_t)pmm_alloc_pages(HPAGE_PMD_NR);
+    if (!khugepaged_hpage) {
+        thp_stats.collapse_alloc_failed++;
+        return 0;
+    }
+    thp_stats.collapse_alloc++;
+    return 1;
+}
+
+static void khugepaged(void *arg) {
+    (void)arg;
+
+    while (1) {
+        uint64_t progress = 0;
+        int ticks = KHUGEPAGED_SLEEP_TICKS;
+
+        while (progress < KHUGEPAGED_PAGES_TO_SCAN) {
+            if (!khugepaged_alloc_page()) {
+                ticks = KHUGEPAGED_ALLOC_SLEEP_TICKS;
+                break;
+            }
+            uint64_t scanned = khugepaged_scan(KHUGEPAGED_PAGES_TO_SCAN - progress);
+            if (!scanned) break;
+            progress += scanned;
+            process_yield();
+        }
+
+        process_sleep(ticks);
+    }
+}
+
+void khugepaged_init(void) {
+    khugepaged_task = process_create_kthread(khugepaged, 0);
+    if (!khugepaged_task) {
+        kprint_str("THP: Failed to start khugepaged\n");
+        return;
+    }
+    process_set_priority(khugepaged_task->pid, MLFQ_LEVELS - 1);
+
+    kprint_str("THP: khugepaged started, scan ");
+    kprint_dec(KHUGEPAGED_PAGES_TO_SCAN);
+    kprint_str(" pages every ");
+    kprint_dec(KHUGEPAGED_SLEEP_TICKS);
+    kprint_str(" ticks\n");
+}
+
+void thp_get_stats(struct thp_stats *stats) {
+    if (stats) *stats = thp_stats;
+}
+
+void thp_dump_stats(void) {
+    kprint_str("THP: fault alloc ");
+    kprint_dec(thp_stats.fault_alloc);
+    kprint_str(" fallback ");
+    kprint_dec(thp_stats.fault_fallback);
+    kprint_str(" split ");
+    kprint_dec(thp_stats.split);
+    kprint_str(" collapsed ");
+    kprint_dec(thp_stats.pages_collapsed);
+    kprint_str(" collapse alloc ");
+    kprint_dec(thp_stats.collapse_alloc);
+    kprint_str("/");
+    kprint_dec(thp_stats.collapse_alloc_failed);
+    kprint_str(" full scans ");
+    kprint_dec(thp_stats.full_scans);
+    kprint_newline();
+}
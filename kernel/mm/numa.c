@@ -0,0 +1,195 @@
+#include "mm/numa.h"
+#include "acpi.h"
+#include "console.h"
+
+int nr_node_ids = 1;
+int numa_nr_memblks = 0;
+struct numa_memblk numa_memblks[NUMA_MAX_MEMBLKS];
+
+static int pxm_to_node_map[MAX_NUMNODES];
+static uint8_t numa_distance[MAX_NUMNODES][MAX_NUMNODES];
+static int node_order[MAX_NUMNODES][MAX_NUMNODES];
+static int8_t apic_to_node[NUMA_MAX_APICS];
+static int numa_cpu_node = 0;
+
+static int pxm_to_node(uint32_t pxm) {
+    for (int nid = 0; nid < nr_node_ids; nid++) {
+        if (pxm_to_node_map[nid] == (int)pxm) return nid;
+    }
+    if (nr_node_ids >= MAX_NUMNODES) return NUMA_NO_NODE;
+    pxm_to_node_map[nr_node_ids] = (int)pxm;
+    return nr_node_ids++;
+}
+
+static int node_to_pxm(int nid) {
+    return pxm_to_node_map[nid];
+}
+
+static void numa_add_memblk(uint64_t start, uint64_t end, int nid) {
+    if (start >= end || numa_nr_memblks >= NUMA_MAX_MEMBLKS) return;
+    numa_memblks[numa_nr_memblks].start = start;
+    numa_memblks[numa_nr_memblks].end = end;
+    numa_memblks[numa_nr_memblks].nid = nid;
+    numa_nr_memblks++;
+}
+
+static void numa_set_cpu(uint32_t apic_id, uint32_t pxm) {
+    int nid = pxm_to_node(pxm);
+    if (nid != NUMA_NO_NODE && apic_id < NUMA_MAX_APICS) apic_to_node[apic_id] = (int8_t)nid;
+}
+
+static int numa_parse_srat() {
+    struct acpi_table_srat* srat = (struct acpi_table_srat*)acpi_find_table("SRAT");
+    if (!srat) return -1;
+
+    uint8_t* p = (uint8_t*)srat + sizeof(struct acpi_table_srat);
+    uint8_t* end = (uint8_t*)srat + srat->header.length;
+
+    nr_node_ids = 0;
+    while (p + sizeof(struct acpi_subtable_header) <= end) {
+        struct acpi_subtable_header* sub = (struct acpi_subtable_header*)p;
+        if (sub->length < sizeof(struct acpi_subtable_header) || p + sub->length > end) break;
+
+        if (sub->type == ACPI_SRAT_TYPE_CPU_AFFINITY) {
+            struct acpi_srat_cpu_affinity* cpu = (struct acpi_srat_cpu_affinity*)sub;
+            if (cpu->flags & ACPI_SRAT_CPU_ENABLED) {
+                uint32_t pxm = cpu->proximity_domain_lo;
+                if (srat->header.revision >= 2) {
+                    pxm |= ((uint32_t)cpu->proximity_domain_hi[0] << 8) |
+                           ((uint32_t)cpu->proximity_domain_hi[1] << 16) |
+                           ((uint32_t)cpu->proximity_domain_hi[2] << 24);
+                }
+                numa_set_cpu(cpu->apic_id, pxm);
+            }
+        } else if (sub->type == ACPI_SRAT_TYPE_X2APIC_CPU_AFFINITY) {
+            struct acpi_srat_x2apic_cpu_affinity* cpu = (struct acpi_srat_x2apic_cpu_affinity*)sub;
+            if (cpu->flags & ACPI_SRAT_CPU_ENABLED) numa_set_cpu(cpu->apic_id, cpu->proximity_domain);
+        } else if (sub->type == ACPI_SRAT_TYPE_MEMORY_AFFINITY) {
+            struct acpi_srat_mem_affinity* mem = (struct acpi_srat_mem_affinity*)sub;
+            if ((mem->flags & ACPI_SRAT_MEM_ENABLED) && mem->length) {
+                int nid = pxm_to_node(mem->proximity_domain);
+                if (nid != NUMA_NO_NODE) numa_add_memblk(mem->base_address, mem->base_address + mem->length, nid);
+            }
+        }
+        p += sub->length;
+    }
+
+    if (!numa_nr_memblks) {
+        nr_node_ids = 1;
+        return -1;
+    }
+    return 0;
+}
+
+static void numa_parse_slit() {
+    struct acpi_table_slit* slit = (struct acpi_table_slit*)acpi_find_table("SLIT");
+    if (!slit) return;
+
+    uint64_t count = slit->locality_count;
+    if (sizeof(struct acpi_table_slit) + count * count > slit->header.length) return;
+
+    for (int i = 0; i < nr_node_ids; i++) {
+        for (int j = 0; j < nr_node_ids; j++) {
+            uint64_t from = (uint64_t)node_to_pxm(i);
+            uint64_t to = (uint64_t)node_to_pxm(j);
+            if (from >= count || to >= count) continue;
+            numa_distance[i][j] = slit->entry[from * count + to];
+        }
+    }
+}
+
+static void numa_build_fallback() {
+    for (int nid = 0; nid < nr_node_ids; nid++) {
+        uint8_t used[MAX_NUMNODES] = { 0 };
+
+        for (int i = 0; i < nr_node_ids; i++) {
+            int best = NUMA_NO_NODE;
+            for (int n = 0; n < nr_node_ids; n++) {
+                if (used[n]) continue;
+                if (best == NUMA_NO_NODE || numa_distance[nid][n] < numa_distance[nid][best] ||
+                    (n == nid && numa_distance[nid][n] == numa_distance[nid][best])) {
+                    best = n;
+                }
+            }
+            used[best] = 1;
+            node_order[nid][i] = best;
+        }
+    }
+}
+
+static uint32_t numa_boot_apic_id() {
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1), "c"(0));
+    return ebx >> 24;
+}
+
+void numa_init(void) {
+    for (int i = 0; i < NUMA_MAX_APICS; i++) apic_to_node[i] = NUMA_NO_NODE;
+
+    if (numa_parse_srat() != 0) {
+        numa_nr_memblks = 0;
+        pxm_to_node_map[0] = 0;
+        for (int i = 0; i < NUMA_MAX_APICS; i++) apic_to_node[i] = NUMA_NO_NODE;
+    }
+
+    for (int i = 0; i < MAX_NUMNODES; i++) {
+        for (int j = 0; j < MAX_NUMNODES; j++) {
+            numa_distance[i][j] = (i == j) ? LOCAL_DISTANCE : REMOTE_DISTANCE;
+        }
+    }
+    if (numa_nr_memblks) numa_parse_slit();
+    numa_build_fallback();
+
+    uint32_t apic_id = numa_boot_apic_id();
+    numa_cpu_node = (apic_id < NUMA_MAX_APICS && apic_to_node[apic_id] != NUMA_NO_NODE) ? apic_to_node[apic_id] : 0;
+
+    numa_dump_topology();
+}
+
+int numa_node_id(void) {
+    return numa_cpu_node;
+}
+
+int node_distance(int from, int to) {
+    if (from < 0 || to < 0 || from >= nr_node_ids || to >= nr_node_ids) return REMOTE_DISTANCE;
+    return numa_distance[from][to];
+}
+
+int node_fallback(int nid, int index) {
+    if (nid < 0 || nid >= nr_node_ids) nid = numa_cpu_node;
+    return node_order[nid][index];
+}
+
+void numa_dump_topology(void) {
+    if (!numa_nr_memblks) {
+        kprint_str("NUMA: No SRAT, single node\n");
+        return;
+    }
+
+    kprint_str("NUMA: ");
+    kprint_dec(nr_node_ids);
+    kprint_str(" nodes, boot CPU on node ");
+    kprint_dec(numa_cpu_node);
+    kprint_newline();
+
+    for (int i = 0; i < numa_nr_memblks; i++) {
+        kprint_str("NUMA: Node ");
+        kprint_dec(numa_memblks[i].nid);
+        kprint_str(" [");
+        kprint_hex(numa_memblks[i].start);
+        kprint_str(" - ");
+        kprint_hex(numa_memblks[i].end);
+        kprint_str(")\n");
+    }
+
+    for (int i = 0; i < nr_node_ids; i++) {
+        kprint_str("NUMA: Distance ");
+        kprint_dec(i);
+        kprint_str(":");
+        for (int j = 0; j < nr_node_ids; j++) {
+            kprint_str(" ");
+            kprint_dec(numa_distance[i][j]);
+        }
+        kprint_newline();
+    }
+}
@@ -1,25 +1,44 @@
 #include "mm/page_cache.h"
-#include "heap.h"
 #include "string.h"
 #include "radix-tree.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "mm/vmscan.h"
 
 struct page *find_get_page(struct address_space *mapping, unsigned long offset) {
     struct page *page;
 
     if (!mapping) return 0;
 
+    rcu_read_lock();
+    while (1) {
+        page = radix_tree_lookup(&mapping->page_tree, offset);
+        if (!page) break;
+        if (!get_page_unless_zero(page)) continue;
+        if (page == radix_tree_lookup(&mapping->page_tree, offset)) break;
+        put_page(page);
+    }
+    rcu_read_unlock();
+    return page;
+}
+
+unsigned int find_get_pages_tag(struct address_space *mapping, unsigned long *index,
+                                unsigned int tag, unsigned int nr_pages, struct page **pages) {
+    if (!mapping) return 0;
+
     spinlock_acquire(&mapping->lock);
-    page = radix_tree_lookup(&mapping->page_tree, offset);
-    if (page) {
-        get_page(page);
+    unsigned int ret = radix_tree_gang_lookup_tag(&mapping->page_tree, (void **)pages, *index, nr_pages, tag);
+    for (unsigned int i = 0; i < ret; i++) {
+        get_page(pages[i]);
     }
+    if (ret) *index = pages[ret - 1]->index + 1;
     spinlock_release(&mapping->lock);
-    return page;
+    return ret;
 }
 
 int add_to_page_cache(struct page *page, struct address_space *mapping, unsigned long offset, int gfp_mask) {
-    (void)gfp_mask;
     if (!mapping || !page) return -1;
+    if (radix_tree_preload(gfp_mask) != 0) return -1;
 
     spinlock_acquire(&mapping->lock);
     int ret = radix_tree_insert(&mapping->page_tree, offset, page);
@@ -27,8 +46,11 @@ int add_to_page_cache(struct page *page, struct address_space *mapping, unsigned
         page->mapping = mapping;
         page->index = offset;
         mapping->nrpages++;
+        get_page(page);
     }
     spinlock_release(&mapping->lock);
+
+    if (ret == 0) lru_cache_add(page);
     return ret;
 }
 
@@ -36,6 +58,7 @@ void delete_from_page_cache(struct page *page) {
     struct address_space *mapping = page->mapping;
     if (!mapping) return;
 
+    lru_cache_del(page);
     spinlock_acquire(&mapping->lock);
     if (radix_tree_delete(&mapping->page_tree, page->index)) {
         mapping->nrpages--;
@@ -46,24 +69,94 @@ void delete_from_page_cache(struct page *page) {
     put_page(page);
 }
 
- 
-struct page *alloc_page(int flags) {
-    (void)flags;
-    struct page *p = (struct page *)kmalloc(sizeof(struct page));
-    if (!p) return 0;
-    memset(p, 0, sizeof(struct page));
-    p->_count = 1;
-     
-    p->virtual = kmalloc(4096); 
-    if (!p->virtual) {
-        kfree(p);
+int migrate_page_mapping(struct address_space *mapping, struct page *page, struct page *newpage) {
+    spinlock_acquire(&mapping->lock);
+    if (radix_tree_lookup(&mapping->page_tree, page->index) != page || !page_ref_freeze(page, 1)) {
+        spinlock_release(&mapping->lock);
+        return -1;
+    }
+
+    newpage->mapping = mapping;
+    newpage->index = page->index;
+    newpage->_count = 1;
+    radix_tree_replace(&mapping->page_tree, page->index, newpage);
+    spinlock_release(&mapping->lock);
+    return 0;
+}
+
+int remove_mapping(struct address_space *mapping, struct page *page) {
+    spinlock_acquire(&mapping->lock);
+    if (!page_ref_freeze(page, 1)) {
+        spinlock_release(&mapping->lock);
+        return 0;
+    }
+    if (PageDirty(page)) {
+        page->_count = 1;
+        spinlock_release(&mapping->lock);
         return 0;
     }
-    memset(p->virtual, 0, 4096);
-    return p;
+
+    if (radix_tree_delete(&mapping->page_tree, page->index)) {
+        mapping->nrpages--;
+    }
+    page->mapping = 0;
+    spinlock_release(&mapping->lock);
+    return 1;
+}
+
+void set_page_dirty(struct page *page) {
+    struct address_space *mapping = page->mapping;
+
+    if (PageDirty(page)) return;
+    SetPageDirty(page);
+    if (!mapping) return;
+
+    spinlock_acquire(&mapping->lock);
+    radix_tree_tag_set(&mapping->page_tree, page->index, PAGECACHE_TAG_DIRTY);
+    spinlock_release(&mapping->lock);
+}
+
+int write_one_page(struct page *page) {
+    struct address_space *mapping = page->mapping;
+    if (!mapping || !mapping->a_ops || !mapping->a_ops->writepage) return -1;
+
+    spinlock_acquire(&mapping->lock);
+    ClearPageDirty(page);
+    radix_tree_tag_clear(&mapping->page_tree, page->index, PAGECACHE_TAG_DIRTY);
+    radix_tree_tag_set(&mapping->page_tree, page->index, PAGECACHE_TAG_WRITEBACK);
+    spinlock_release(&mapping->lock);
+
+    int ret = mapping->a_ops->writepage(page, 0);
+
+    spinlock_acquire(&mapping->lock);
+    radix_tree_tag_clear(&mapping->page_tree, page->index, PAGECACHE_TAG_WRITEBACK);
+    if (ret != 0) {
+        SetPageDirty(page);
+        radix_tree_tag_set(&mapping->page_tree, page->index, PAGECACHE_TAG_DIRTY);
+    }
+    spinlock_release(&mapping->lock);
+    return ret;
+}
+
+ 
+struct page *alloc_page(int flags) {
+    void *phys = pmm_alloc_page_gfp(flags);
+    if (!phys) return 0;
+
+    struct page *page = phys_to_page((uint64_t)phys);
+    page->flags = 0;
+    page->_count = 1;
+    page->mapping = 0;
+    page->index = 0;
+    page->private = 0;
+    INIT_LIST_HEAD(&page->lru);
+    return page;
 }
 
 void __free_page(struct page *page) {
-    if (page->virtual) kfree(page->virtual);
-    kfree(page);
+    page->flags = 0;
+    page->_count = 0;
+    page->mapping = 0;
+    page->private = 0;
+    pmm_free_page((void*)page_to_phys(page));
 }
@@ -0,0 +1,41 @@
+#include "mm/page_zero.h"
+#include "pmm.h"
+#include "process.h"
+#include "waitqueue.h"
+#include "console.h"
+
+static struct process *kzerod_task;
+static semaphore_t kzerod_wait;
+
+static void kzerod(void *arg) {
+    (void)arg;
+
+    while (1) {
+        sem_wait(&kzerod_wait);
+        while (pmm_zero_pool_fill(PMM_ZERO_BATCH) == PMM_ZERO_BATCH) {
+            process_yield();
+        }
+    }
+}
+
+void page_zero_idle(void) {
+    if (!kzerod_task || kzerod_wait.count > 0) return;
+    if (pmm_zero_pool_count() >= PMM_ZERO_POOL_MAX) return;
+    if (!pmm_watermark_ok(PMM_WMARK_HIGH)) return;
+    sem_post(&kzerod_wait);
+}
+
+void page_zero_init(void) {
+    sem_init(&kzerod_wait, 0);
+
+    kzerod_task = process_create_kthread(kzerod, 0);
+    if (!kzerod_task) {
+        kprint_str("PAGE_ZERO: Failed to start kzerod\n");
+        return;
+    }
+    process_set_priority(kzerod_task->pid, MLFQ_LEVELS - 1);
+
+    kprint_str("PAGE_ZERO: kzerod started, pool ");
+    kprint_dec(PMM_ZERO_POOL_MAX);
+    kprint_str(" pages\n");
+}
@@ -0,0 +1,201 @@
+#include "mm/rmap.h"
+#include "mm/page_cache.h"
+#include "mm/swap.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "vfs.h"
+#include "slab.h"
+
+struct rmap_control {
+    uint64_t swp_pte;
+    uint64_t new_phys;
+    int referenced;
+    int unmapped;
+    int last;
+};
+
+static struct kmem_cache *anon_vma_cachep;
+
+void anon_vma_init(void) {
+    anon_vma_cachep = kmem_cache_create("anon_vma", sizeof(struct anon_vma), 0, SLAB_PANIC, 0);
+}
+
+int anon_vma_prepare(struct vm_area_struct *vma) {
+    if (vma->anon_vma) return 0;
+
+    struct anon_vma *anon_vma = (struct anon_vma *)kmem_cache_alloc(anon_vma_cachep, 0);
+    if (!anon_vma) return -1;
+
+    spinlock_init(&anon_vma->lock);
+    INIT_LIST_HEAD(&anon_vma->head);
+    list_add_tail(&vma->anon_vma_node, &anon_vma->head);
+    vma->anon_vma = anon_vma;
+    return 0;
+}
+
+static struct address_space *vma_mapping(struct vm_area_struct *vma) {
+    struct file *file = vma->vm_file;
+    if (!file || (file->f_op && file->f_op->mmap)) return 0;
+    return filemap_mapping(file->f_dentry->d_inode);
+}
+
+void vma_link_rmap(struct vm_area_struct *vma) {
+    INIT_LIST_HEAD(&vma->shared);
+
+    struct anon_vma *anon_vma = vma->anon_vma;
+    if (anon_vma) {
+        spinlock_acquire(&anon_vma->lock);
+        list_add_tail(&vma->anon_vma_node, &anon_vma->head);
+        spinlock_release(&anon_vma->lock);
+    }
+
+    struct address_space *mapping = vma_mapping(vma);
+    if (mapping) {
+        spinlock_acquire(&mapping->i_mmap_lock);
+        list_add_tail(&vma->shared, &mapping->i_mmap);
+        spinlock_release(&mapping->i_mmap_lock);
+    }
+}
+
+void vma_unlink_rmap(struct vm_area_struct *vma) {
+    struct anon_vma *anon_vma = vma->anon_vma;
+    if (anon_vma) {
+        spinlock_acquire(&anon_vma->lock);
+        list_del(&vma->anon_vma_node);
+        int empty = list_empty(&anon_vma->head);
+        spinlock_release(&anon_vma->lock);
+
+        if (empty) kmem_cache_free(anon_vma_cachep, anon_vma);
+        vma->anon_vma = 0;
+    }
+
+    if (!list_empty(&vma->shared)) {
+        struct address_space *mapping = vma_mapping(vma);
+        spinlock_acquire(&mapping->i_mmap_lock);
+        list_del_init(&vma->shared);
+        spinlock_release(&mapping->i_mmap_lock);
+    }
+}
+
+void page_add_anon_rmap(struct page *page, struct vm_area_struct *vma, uint64_t addr) {
+    if (!vma->anon_vma) return;
+    page->mapping = (struct address_space *)((uint64_t)vma->anon_vma | PAGE_MAPPING_ANON);
+    page->index = linear_page_index(vma, addr);
+}
+
+static uint64_t *page_check_address(struct page *page, struct vm_area_struct *vma, uint64_t *addr, uint64_t *size) {
+    if (page->index < vma->vm_pgoff) return 0;
+
+    uint64_t address = vma->vm_start + ((page->index - vma->vm_pgoff) << 12);
+    if (address < vma->vm_start || address >= vma->vm_end) return 0;
+
+    uint64_t *pte = vmm_mm_leaf(vma->vm_mm, address, size);
+    if (!pte || (*pte & PTE_ADDR_MASK & ~(*size - 1)) != page_to_phys(page)) return 0;
+
+    *addr = address;
+    return pte;
+}
+
+static void page_referenced_one(struct page *page, struct vm_area_struct *vma, struct rmap_control *rc) {
+    uint64_t addr;
+    uint64_t size;
+    uint64_t *pte = page_check_address(page, vma, &addr, &size);
+    if (!pte) return;
+
+    if (*pte & PTE_ACCESSED) {
+        *pte &= ~(uint64_t)PTE_ACCESSED;
+        vmm_flush_mm_page(vma->vm_mm, addr);
+        rc->referenced++;
+    }
+}
+
+static void try_to_unmap_one(struct page *page, struct vm_area_struct *vma, struct rmap_control *rc) {
+    uint64_t addr;
+    uint64_t size;
+    uint64_t *pte = page_check_address(page, vma, &addr, &size);
+    if (!pte || size != PAGE_SIZE) return;
+
+    uint64_t pteval = *pte;
+    if (PageAnon(page)) {
+        if (!rc->swp_pte) return;
+        *pte = rc->swp_pte;
+        if (rc->unmapped) swap_duplicate(pte_to_swp_entry(rc->swp_pte));
+    } else {
+        *pte = 0;
+        if (pteval & PTE_DIRTY) set_page_dirty(page);
+    }
+    vmm_flush_mm_page(vma->vm_mm, addr);
+
+    rc->unmapped++;
+    if (pmm_page_unref((void*)page_to_phys(page))) rc->last = 1;
+}
+
+static void page_count_one(struct page *page, struct vm_area_struct *vma, struct rmap_control *rc) {
+    uint64_t addr;
+    uint64_t size;
+    if (page_check_address(page, vma, &addr, &size) && size == PAGE_SIZE) rc->referenced++;
+}
+
+static void try_to_migrate_one(struct page *page, struct vm_area_struct *vma, struct rmap_control *rc) {
+    uint64_t addr;
+    uint64_t size;
+    uint64_t *pte = page_check_address(page, vma, &addr, &size);
+    if (!pte || size != PAGE_SIZE) return;
+
+    *pte = (*pte & ~(uint64_t)PTE_ADDR_MASK) | rc->new_phys;
+    vmm_flush_mm_page(vma->vm_mm, addr);
+    rc->unmapped++;
+}
+
+static void rmap_walk(struct page *page, void (*one)(struct page *, struct vm_area_struct *, struct rmap_control *),
+                      struct rmap_control *rc) {
+    struct list_head *pos;
+
+    if (PageAnon(page)) {
+        struct anon_vma *anon_vma = page_anon_vma(page);
+        spinlock_acquire(&anon_vma->lock);
+        list_for_each(pos, &anon_vma->head) {
+            one(page, list_entry(pos, struct vm_area_struct, anon_vma_node), rc);
+            if (rc->last) break;
+        }
+        spinlock_release(&anon_vma->lock);
+        return;
+    }
+
+    struct address_space *mapping = page->mapping;
+    if (!mapping) return;
+
+    spinlock_acquire(&mapping->i_mmap_lock);
+    list_for_each(pos, &mapping->i_mmap) {
+        one(page, list_entry(pos, struct vm_area_struct, shared), rc);
+        if (!page_mapped(page)) break;
+    }
+    spinlock_release(&mapping->i_mmap_lock);
+}
+
+int page_referenced(struct page *page) {
+    struct rmap_control rc = { 0, 0, 0, 0, 0 };
+    rmap_walk(page, page_referenced_one, &rc);
+    return rc.referenced;
+}
+
+int try_to_unmap(struct page *page, uint64_t swp_pte) {
+    struct rmap_control rc = { swp_pte, 0, 0, 0, 0 };
+    rmap_walk(page, try_to_unmap_one, &rc);
+
+    if (!rc.unmapped) return SWAP_FAIL;
+    if (PageAnon(page)) return rc.last ? SWAP_SUCCESS : SWAP_AGAIN;
+    return page_mapped(page) ? SWAP_AGAIN : SWAP_SUCCESS;
+}
+
+int try_to_migrate(struct page *page, struct page *newpage) {
+    struct rmap_control rc = { 0, page_to_phys(newpage), 0, 0, 0 };
+    int expected = PageAnon(page) ? pmm_page_count((void*)page_to_phys(page)) : page->_mapcount;
+    if (!expected) return SWAP_SUCCESS;
+
+    rmap_walk(page, page_count_one, &rc);
+    if (rc.referenced != expected) return SWAP_FAIL;
+
+    rmap_walk(page, try_to_migrate_one, &rc);
+    return SWAP_SUCCESS;
+}
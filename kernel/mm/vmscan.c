@@ -0,0 +1,233 @@
+#include "mm/vmscan.h"
+#include "mm/page_cache.h"
+#include "mm/rmap.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "vfs.h"
+#include "process.h"
+#include "waitqueue.h"
+#include "console.h"
+
+#define PAGE_KEEP 0
+#define PAGE_ACTIVATE 1
+#define PAGE_RECLAIM 2
+
+static struct zone contig_zone;
+static struct process *kswapd_task;
+static semaphore_t kswapd_wait;
+
+struct zone *page_zone(struct page *page) {
+    (void)page;
+    return &contig_zone;
+}
+
+void lru_cache_add(struct page *page) {
+    struct zone *zone = page_zone(page);
+
+    spinlock_acquire(&zone->lru_lock);
+    if (!PageLRU(page)) {
+        SetPageLRU(page);
+        ClearPageActive(page);
+        list_add(&page->lru, &zone->inactive_list);
+        zone->nr_inactive++;
+    }
+    spinlock_release(&zone->lru_lock);
+}
+
+void lru_cache_del(struct page *page) {
+    struct zone *zone = page_zone(page);
+
+    spinlock_acquire(&zone->lru_lock);
+    if (PageLRU(page)) {
+        list_del(&page->lru);
+        if (PageActive(page)) zone->nr_active--;
+        else zone->nr_inactive--;
+        ClearPageLRU(page);
+        ClearPageActive(page);
+    }
+    spinlock_release(&zone->lru_lock);
+}
+
+void lru_cache_replace(struct page *page, struct page *newpage) {
+    struct zone *zone = page_zone(page);
+
+    spinlock_acquire(&zone->lru_lock);
+    if (PageLRU(page)) {
+        list_add(&newpage->lru, &page->lru);
+        list_del(&page->lru);
+        newpage->flags |= page->flags & ((1 << PG_lru) | (1 << PG_active));
+        ClearPageLRU(page);
+        ClearPageActive(page);
+    }
+    spinlock_release(&zone->lru_lock);
+}
+
+void mark_page_accessed(struct page *page) {
+    struct zone *zone = page_zone(page);
+
+    spinlock_acquire(&zone->lru_lock);
+    if (!PageActive(page) && PageReferenced(page) && PageLRU(page)) {
+        list_del(&page->lru);
+        zone->nr_inactive--;
+        SetPageActive(page);
+        list_add(&page->lru, &zone->active_list);
+        zone->nr_active++;
+        ClearPageReferenced(page);
+    } else if (!PageReferenced(page)) {
+        SetPageReferenced(page);
+    }
+    spinlock_release(&zone->lru_lock);
+}
+
+static void shrink_active_list(struct zone *zone, uint64_t nr_to_scan) {
+    spinlock_acquire(&zone->lru_lock);
+    if (nr_to_scan > zone->nr_active) nr_to_scan = zone->nr_active;
+    while (nr_to_scan-- && !list_empty(&zone->active_list)) {
+        struct page *page = list_entry(zone->active_list.prev, struct page, lru);
+        list_del(&page->lru);
+
+        if (PageReferenced(page) || (page_mapped(page) && page_referenced(page))) {
+            ClearPageReferenced(page);
+            list_add(&page->lru, &zone->active_list);
+            continue;
+        }
+
+        ClearPageActive(page);
+        list_add(&page->lru, &zone->inactive_list);
+        zone->nr_active--;
+        zone->nr_inactive++;
+    }
+    spinlock_release(&zone->lru_lock);
+}
+
+static int page_check_reclaim(struct page *page) {
+    if (PageLocked(page)) return PAGE_KEEP;
+
+    if (PageReferenced(page)) {
+        ClearPageReferenced(page);
+        return PAGE_KEEP;
+    }
+
+    if (page_mapped(page)) {
+        if (page_referenced(page)) return PAGE_ACTIVATE;
+        if (try_to_unmap(page, 0) != SWAP_SUCCESS) return PAGE_ACTIVATE;
+    }
+    if (page->_count > 1) return PAGE_KEEP;
+
+    if (PageDirty(page) && write_one_page(page) != 0) return PAGE_ACTIVATE;
+
+    return PAGE_RECLAIM;
+}
+
+static uint64_t shrink_inactive_list(struct zone *zone, uint64_t nr_to_scan) {
+    LIST_HEAD(page_list);
+    uint64_t reclaimed = 0;
+
+    spinlock_acquire(&zone->lru_lock);
+    while (nr_to_scan-- && !list_empty(&zone->inactive_list)) {
+        struct page *page = list_entry(zone->inactive_list.prev, struct page, lru);
+        list_del(&page->lru);
+        ClearPageLRU(page);
+        zone->nr_inactive--;
+        list_add(&page->lru, &page_list);
+    }
+    spinlock_release(&zone->lru_lock);
+
+    while (!list_empty(&page_list)) {
+        struct page *page = list_entry(page_list.prev, struct page, lru);
+        list_del(&page->lru);
+        zone->pages_scanned++;
+
+        int action = page_check_reclaim(page);
+        if (action == PAGE_RECLAIM && (!page->mapping || !remove_mapping(page->mapping, page))) action = PAGE_KEEP;
+        if (action == PAGE_RECLAIM) {
+            __free_page(page);
+            reclaimed++;
+            continue;
+        }
+
+        spinlock_acquire(&zone->lru_lock);
+        SetPageLRU(page);
+        if (action == PAGE_ACTIVATE) {
+            SetPageActive(page);
+            list_add(&page->lru, &zone->active_list);
+            zone->nr_active++;
+        } else {
+            list_add(&page->lru, &zone->inactive_list);
+            zone->nr_inactive++;
+        }
+        spinlock_release(&zone->lru_lock);
+    }
+
+    zone->pages_reclaimed += reclaimed;
+    return reclaimed;
+}
+
+uint64_t shrink_zone(struct zone *zone, int priority) {
+    uint64_t nr_to_scan = (zone->nr_active + zone->nr_inactive) >> priority;
+    if (nr_to_scan < SWAP_CLUSTER_MAX) nr_to_scan = SWAP_CLUSTER_MAX;
+
+    if (zone->nr_active > zone->nr_inactive) shrink_active_list(zone, nr_to_scan);
+    return shrink_inactive_list(zone, nr_to_scan);
+}
+
+static void balance_zone(struct zone *zone) {
+    for (int priority = DEF_PRIORITY; priority >= 0; priority--) {
+        if (pmm_watermark_ok(PMM_WMARK_HIGH)) return;
+
+        uint64_t reclaimed = shrink_zone(zone, priority) + pmm_run_shrinkers();
+        if (reclaimed < SWAP_CLUSTER_MAX && !pmm_watermark_ok(PMM_WMARK_HIGH)) {
+            vmm_swap_out_victim();
+        }
+    }
+}
+
+static void kswapd(void *arg) {
+    struct zone *zone = (struct zone*)arg;
+
+    while (1) {
+        sem_wait(&kswapd_wait);
+        balance_zone(zone);
+    }
+}
+
+void wakeup_kswapd(void) {
+    if (!kswapd_task || kswapd_wait.count > 0) return;
+    sem_post(&kswapd_wait);
+}
+
+void vmscan_init(void) {
+    spinlock_init(&contig_zone.lru_lock);
+    INIT_LIST_HEAD(&contig_zone.active_list);
+    INIT_LIST_HEAD(&contig_zone.inactive_list);
+    contig_zone.nr_active = 0;
+    contig_zone.nr_inactive = 0;
+
+    sem_init(&kswapd_wait, 0);
+
+    kswapd_task = process_create_kthread(kswapd, &contig_zone);
+    if (!kswapd_task) {
+        kprint_str("VMSCAN: Failed to start kswapd\n");
+        return;
+    }
+
+    kprint_str("VMSCAN: kswapd started, watermarks min/low/high ");
+    kprint_dec(pmm_watermark(PMM_WMARK_MIN));
+    kprint_str("/");
+    kprint_dec(pmm_watermark(PMM_WMARK_LOW));
+    kprint_str("/");
+    kprint_dec(pmm_watermark(PMM_WMARK_HIGH));
+    kprint_str(" pages\n");
+}
+
+void vmscan_dump_stats(void) {
+    kprint_str("VMSCAN: active ");
+    kprint_dec(contig_zone.nr_active);
+    kprint_str(" inactive ");
+    kprint_dec(contig_zone.nr_inactive);
+    kprint_str(" scanned ");
+    kprint_dec(contig_zone.pages_scanned);
+    kprint_str(" reclaimed ");
+    kprint_dec(contig_zone.pages_reclaimed);
+    kprint_newline();
+}
@@ -0,0 +1,279 @@
+#include "mm/zsmalloc.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "slab.h"
+#include "heap.h"
+#include "vmalloc.h"
+#include "string.h"
+#include "spinlock.h"
+#include "list.h"
+
+#define ZS_OBJ_END 0xFFFF
+
+struct zspage {
+    struct list_head list;
+    uint16_t class_idx;
+    uint16_t inuse;
+    uint16_t freelist;
+    uint16_t nr_pages;
+    uint64_t pages[ZS_MAX_PAGES_PER_ZSPAGE];
+};
+
+struct zs_handle {
+    struct zspage *zspage;
+    uint64_t idx;
+};
+
+struct size_class {
+    uint32_t size;
+    uint32_t pages_per_zspage;
+    uint32_t objs_per_zspage;
+    struct list_head partial;
+    struct list_head full;
+};
+
+struct zs_pool {
+    char name[16];
+    spinlock_t lock;
+    struct size_class classes[ZS_NR_CLASSES];
+    uint64_t pages_used;
+    uint64_t zspages;
+    uint64_t objs_used;
+    uint64_t objs_allocated;
+
+    uint8_t *bounce;
+    uint8_t *map_addr;
+    uint8_t *map_next;
+    uint64_t map_size;
+    uint64_t map_in_page;
+    int map_mm;
+};
+
+static struct kmem_cache *zspage_cachep;
+static struct kmem_cache *zs_handle_cachep;
+
+static int zs_class_idx(size_t size) {
+    if (size <= ZS_MIN_ALLOC_SIZE) return 0;
+    return (int)((size - ZS_MIN_ALLOC_SIZE + ZS_SIZE_CLASS_DELTA - 1) / ZS_SIZE_CLASS_DELTA);
+}
+
+static uint32_t zs_pages_per_zspage(uint32_t size) {
+    uint32_t best = 1;
+    uint64_t best_used = 0;
+
+    for (uint32_t i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+        uint64_t bytes = (uint64_t)i * PAGE_SIZE;
+        uint64_t used = (bytes / size) * size * 100 / bytes;
+        if (used > best_used) {
+            best_used = used;
+            best = i;
+        }
+    }
+    return best;
+}
+
+static inline uint8_t *zs_obj_addr(struct zspage *zspage, uint32_t size, uint64_t idx, uint64_t *in_page) {
+    uint64_t offset = idx * size;
+    uint64_t off = offset % PAGE_SIZE;
+    *in_page = PAGE_SIZE - off;
+    return (uint8_t *)phys_to_virt(zspage->pages[offset / PAGE_SIZE]) + off;
+}
+
+static inline uint16_t *zs_obj_link(struct zspage *zspage, uint32_t size, uint64_t idx) {
+    uint64_t in_page;
+    return (uint16_t *)zs_obj_addr(zspage, size, idx, &in_page);
+}
+
+static void zspage_free(struct zs_pool *pool, struct zspage *zspage) {
+    for (int i = 0; i < zspage->nr_pages; i++) pmm_free_page((void*)zspage->pages[i]);
+    pool->pages_used -= zspage->nr_pages;
+    pool->zspages--;
+    pool->objs_allocated -= pool->classes[zspage->class_idx].objs_per_zspage;
+    kmem_cache_free(zspage_cachep, zspage);
+}
+
+static struct zspage *zspage_create(struct size_class *class, int class_idx) {
+    struct zspage *zspage = (struct zspage *)kmem_cache_alloc(zspage_cachep, 0);
+    if (!zspage) return 0;
+
+    zspage->class_idx = (uint16_t)class_idx;
+    zspage->inuse = 0;
+    zspage->nr_pages = 0;
+    for (uint32_t i = 0; i < class->pages_per_zspage; i++) {
+        void *page = pmm_alloc_page();
+        if (!page) {
+            for (int j = 0; j < zspage->nr_pages; j++) pmm_free_page((void*)zspage->pages[j]);
+            kmem_cache_free(zspage_cachep, zspage);
+            return 0;
+        }
+        zspage->pages[zspage->nr_pages++] = (uint64_t)page;
+    }
+
+    for (uint32_t i = 0; i < class->objs_per_zspage; i++) {
+        *zs_obj_link(zspage, class->size, i) = (i + 1 < class->objs_per_zspage) ? (uint16_t)(i + 1) : ZS_OBJ_END;
+    }
+    zspage->freelist = 0;
+    INIT_LIST_HEAD(&zspage->list);
+    return zspage;
+}
+
+struct zs_pool *zs_create_pool(const char *name) {
+    if (!zspage_cachep) {
+        zspage_cachep = kmem_cache_create("zspage", sizeof(struct zspage), 0, 0, 0);
+        zs_handle_cachep = kmem_cache_create("zs_handle", sizeof(struct zs_handle), 0, 0, 0);
+        if (!zspage_cachep || !zs_handle_cachep) return 0;
+    }
+
+    struct zs_pool *pool = (struct zs_pool *)vzalloc(sizeof(struct zs_pool));
+    if (!pool) return 0;
+
+    pool->bounce = (uint8_t *)kmalloc(PAGE_SIZE);
+    if (!pool->bounce) {
+        vfree(pool);
+        return 0;
+    }
+
+    strncpy(pool->name, name, sizeof(pool->name) - 1);
+    spinlock_init(&pool->lock);
+    for (int i = 0; i < ZS_NR_CLASSES; i++) {
+        struct size_class *class = &pool->classes[i];
+        class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+        class->pages_per_zspage = zs_pages_per_zspage(class->size);
+        class->objs_per_zspage = class->pages_per_zspage * PAGE_SIZE / class->size;
+        INIT_LIST_HEAD(&class->partial);
+        INIT_LIST_HEAD(&class->full);
+    }
+    return pool;
+}
+
+void zs_destroy_pool(struct zs_pool *pool) {
+    if (!pool) return;
+
+    for (int i = 0; i < ZS_NR_CLASSES; i++) {
+        struct list_head *lists[2] = { &pool->classes[i].partial, &pool->classes[i].full };
+        for (int l = 0; l < 2; l++) {
+            while (!list_empty(lists[l])) {
+                struct zspage *zspage = list_entry(lists[l]->next, struct zspage, list);
+                list_del(&zspage->list);
+                zspage_free(pool, zspage);
+            }
+        }
+    }
+    kfree(pool->bounce);
+    vfree(pool);
+}
+
+uint64_t zs_malloc(struct zs_pool *pool, size_t size) {
+    if (!pool || !size || size > ZS_MAX_ALLOC_SIZE) return 0;
+
+    struct zs_handle *handle = (struct zs_handle *)kmem_cache_alloc(zs_handle_cachep, 0);
+    if (!handle) return 0;
+
+    int class_idx = zs_class_idx(size);
+    struct size_class *class = &pool->classes[class_idx];
+
+    spinlock_acquire(&pool->lock);
+    if (list_empty(&class->partial)) {
+        spinlock_release(&pool->lock);
+        struct zspage *zspage = zspage_create(class, class_idx);
+        if (!zspage) {
+            kmem_cache_free(zs_handle_cachep, handle);
+            return 0;
+        }
+
+        spinlock_acquire(&pool->lock);
+        list_add(&zspage->list, &class->partial);
+        pool->pages_used += zspage->nr_pages;
+        pool->zspages++;
+        pool->objs_allocated += class->objs_per_zspage;
+    }
+
+    struct zspage *zspage = list_entry(class->partial.next, struct zspage, list);
+    uint16_t idx = zspage->freelist;
+    zspage->freelist = *zs_obj_link(zspage, class->size, idx);
+    if (++zspage->inuse == class->objs_per_zspage) {
+        list_del(&zspage->list);
+        list_add(&zspage->list, &class->full);
+    }
+    pool->objs_used++;
+    spinlock_release(&pool->lock);
+
+    handle->zspage = zspage;
+    handle->idx = idx;
+    return (uint64_t)handle;
+}
+
+void zs_free(struct zs_pool *pool, uint64_t handle) {
+    if (!pool || !handle) return;
+
+    struct zs_handle *h = (struct zs_handle *)handle;
+    struct zspage *zspage = h->zspage;
+    struct size_class *class = &pool->classes[zspage->class_idx];
+
+    spinlock_acquire(&pool->lock);
+    *zs_obj_link(zspage, class->size, h->idx) = zspage->freelist;
+    zspage->freelist = (uint16_t)h->idx;
+    if (zspage->inuse-- == class->objs_per_zspage) {
+        list_del(&zspage->list);
+        list_add(&zspage->list, &class->partial);
+    }
+    pool->objs_used--;
+
+    if (!zspage->inuse) {
+        list_del(&zspage->list);
+        zspage_free(pool, zspage);
+    }
+    spinlock_release(&pool->lock);
+
+    kmem_cache_free(zs_handle_cachep, h);
+}
+
+void *zs_map_object(struct zs_pool *pool, uint64_t handle, int mm) {
+    struct zs_handle *h = (struct zs_handle *)handle;
+
+    spinlock_acquire(&pool->lock);
+    struct zspage *zspage = h->zspage;
+    uint32_t size = pool->classes[zspage->class_idx].size;
+
+    uint64_t in_page;
+    uint8_t *addr = zs_obj_addr(zspage, size, h->idx, &in_page);
+    pool->map_mm = mm;
+    pool->map_next = 0;
+    if (in_page >= size) return addr;
+
+    pool->map_addr = addr;
+    pool->map_next = (uint8_t *)phys_to_virt(zspage->pages[(h->idx * size) / PAGE_SIZE + 1]);
+    pool->map_size = size;
+    pool->map_in_page = in_page;
+    if (mm == ZS_MM_RO) {
+        memcpy(pool->bounce, addr, in_page);
+        memcpy(pool->bounce + in_page, pool->map_next, size - in_page);
+    }
+    return pool->bounce;
+}
+
+void zs_unmap_object(struct zs_pool *pool, uint64_t handle) {
+    (void)handle;
+
+    if (pool->map_next && pool->map_mm == ZS_MM_WO) {
+        memcpy(pool->map_addr, pool->bounce, pool->map_in_page);
+        memcpy(pool->map_next, pool->bounce + pool->map_in_page, pool->map_size - pool->map_in_page);
+    }
+    pool->map_next = 0;
+    spinlock_release(&pool->lock);
+}
+
+uint64_t zs_get_total_pages(struct zs_pool *pool) {
+    return pool ? pool->pages_used : 0;
+}
+
+void zs_pool_stats(struct zs_pool *pool, struct zs_pool_stats *stats) {
+    if (!pool || !stats) return;
+
+    spinlock_acquire(&pool->lock);
+    stats->pages_used = pool->pages_used;
+    stats->zspages = pool->zspages;
+    stats->objs_used = pool->objs_used;
+    stats->objs_allocated = pool->objs_allocated;
+    spinlock_release(&pool->lock);
+}
@@ -20,6 +20,8 @@ void net_dev_init() {
     
     spinlock_init(&net_dev_lock);
     spinlock_init(&ptype_lock);
+
+    skb_init();
     
     kprint_str("net_dev_init: &net_devices = ");
     kprint_hex((uint64_t)&net_devices);
@@ -2,9 +2,16 @@
 #include "heap.h"
 #include "string.h"
 #include "console.h"
+#include "slab.h"
+
+static struct kmem_cache *skbuff_head_cache;
+
+void skb_init(void) {
+    skbuff_head_cache = kmem_cache_create("skbuff_head_cache", sizeof(struct sk_buff), 0, SLAB_HWCACHE_ALIGN | SLAB_PANIC, 0);
+}
 
 struct sk_buff *alloc_skb(uint32_t size) {
-    struct sk_buff *skb = (struct sk_buff *)kmalloc(sizeof(struct sk_buff));
+    struct sk_buff *skb = (struct sk_buff *)kmem_cache_alloc(skbuff_head_cache, 0);
     if (!skb) return 0;
     
     memset(skb, 0, sizeof(struct sk_buff));
@@ -13,7 +20,7 @@ struct sk_buff *alloc_skb(uint32_t size) {
      
     skb->head = (uint8_t *)kmalloc(size);
     if (!skb->head) {
-        kfree(skb);
+        kmem_cache_free(skbuff_head_cache, skb);
         return 0;
     }
     
@@ -32,7 +39,7 @@ void kfree_skb(struct sk_buff *skb) {
     if (skb->head) {
         kfree(skb->head);
     }
-    kfree(skb);
+    kmem_cache_free(skbuff_head_cache, skb);
 }
 
 uint8_t *skb_put(struct sk_buff *skb, uint32_t len) {
@@ -131,7 +131,7 @@ static int e1000_start_xmit(struct sk_buff *skb, struct net_device *dev) {
         return -1; 
     }
 
-    uint64_t phys_addr = vmm_get_phys((uint64_t)skb->data);
+    uint64_t phys_addr = virt_to_phys(skb->data);
     
     desc->addr = phys_addr;
     desc->length = skb->len;
@@ -199,14 +199,14 @@ static irqreturn_t e1000_irq_handler(int irq, void *dev_id) {
 static void e1000_setup_rx(struct e1000_adapter *adapter) {
      
     adapter->rx_descs = (struct e1000_rx_desc *)kmalloc(sizeof(struct e1000_rx_desc) * E1000_NUM_RX_DESC);
-    adapter->rx_descs_phys = vmm_get_phys((uint64_t)adapter->rx_descs);
+    adapter->rx_descs_phys = virt_to_phys(adapter->rx_descs);
     memset(adapter->rx_descs, 0, sizeof(struct e1000_rx_desc) * E1000_NUM_RX_DESC);
     
     adapter->rx_buffers = (void **)kmalloc(sizeof(void*) * E1000_NUM_RX_DESC);
     
     for (int i = 0; i < E1000_NUM_RX_DESC; i++) {
         adapter->rx_buffers[i] = kmalloc(E1000_RX_BUFFER_SIZE);
-        adapter->rx_descs[i].addr = vmm_get_phys((uint64_t)adapter->rx_buffers[i]);
+        adapter->rx_descs[i].addr = virt_to_phys(adapter->rx_buffers[i]);
         adapter->rx_descs[i].status = 0;
     }
     
@@ -224,7 +224,7 @@ static void e1000_setup_rx(struct e1000_adapter *adapter) {
 
 static void e1000_setup_tx(struct e1000_adapter *adapter) {
     adapter->tx_descs = (struct e1000_tx_desc *)kmalloc(sizeof(struct e1000_tx_desc) * E1000_NUM_TX_DESC);
-    adapter->tx_descs_phys = vmm_get_phys((uint64_t)adapter->tx_descs);
+    adapter->tx_descs_phys = virt_to_phys(adapter->tx_descs);
     memset(adapter->tx_descs, 0, sizeof(struct e1000_tx_desc) * E1000_NUM_TX_DESC);
     
     e1000_write_command(adapter, E1000_TDBAL, adapter->tx_descs_phys & 0xFFFFFFFF);
@@ -264,10 +264,9 @@ static int e1000_probe(struct pci_device *pdev) {
     adapter->netdev = netdev;
     adapter->pci_dev = pdev;
     
-    uint64_t mmio_phys = (uint64_t)pdev->bar[0] & ~0xF;
     uint64_t mmio_len = 128 * 1024;  
     
-    void *mmio_virt = ioremap(mmio_phys, mmio_len);
+    void *mmio_virt = pci_iomap(pdev, 0, mmio_len);
     if (!mmio_virt) {
         kprint_str("E1000: Failed to map MMIO\n");
         return -1;
@@ -1,6 +1,7 @@
 #include "process.h"
 #include "vfs.h"
 #include "vmm.h"
+#include "mm/mmap.h"
 #include "pmm.h"
 #include "string.h"
 #include "console.h"
@@ -45,8 +46,98 @@ struct elf_phdr {
 
 #define PT_LOAD 1
 
- 
+#define PF_X 0x1
+#define PF_W 0x2
+#define PF_R 0x4
+
+#define EXEC_STACK_PAGES 4
+
+static int exec_mmap() {
+    struct mm_struct* mm = current_process->mm;
+
+    if (mm && mm != &init_mm && mm->count == 1) {
+        exit_mmap(mm);
+        return 0;
+    }
+
+    struct mm_struct* new_mm = mm_alloc();
+    if (!new_mm) return -1;
+
+    struct mm_struct* old_mm = current_process->active_mm;
+    current_process->mm = new_mm;
+    current_process->active_mm = new_mm;
+    switch_mm(old_mm, new_mm);
+    mm_put(old_mm);
+    return 0;
+}
+
+static int elf_map_segment(struct mm_struct* mm, struct file* file, struct elf_phdr* ph) {
+    uint64_t flags = 0;
+    if (ph->p_flags & PF_R) flags |= VM_READ;
+    if (ph->p_flags & PF_W) flags |= VM_WRITE;
+    if (ph->p_flags & PF_X) flags |= VM_EXEC;
+
+    if (ph->p_memsz < ph->p_filesz) return -1;
+    if (!ph->p_memsz) return 0;
+    if ((ph->p_vaddr & 0xFFF) != (ph->p_offset & 0xFFF)) return -1;
+    if (ph->p_vaddr + ph->p_memsz < ph->p_vaddr) return -1;
+
+    uint64_t start = ph->p_vaddr & ~0xFFF;
+    uint64_t file_end = (ph->p_vaddr + ph->p_filesz + 0xFFF) & ~0xFFF;
+    uint64_t mem_end = (ph->p_vaddr + ph->p_memsz + 0xFFF) & ~0xFFF;
+    if (mem_end < start || !vmm_user_range(start, mem_end - start)) return -1;
+
+    if (ph->p_filesz) {
+        if (mmap_region(mm, start, file_end - start, flags, file, ph->p_offset >> 12) != 0) return -1;
+    } else {
+        file_end = start;
+    }
+
+    if (mem_end > file_end) {
+        if (mmap_region(mm, file_end, mem_end - file_end, flags, 0, 0) != 0) return -1;
+    }
+
+    uint64_t bss = ph->p_vaddr + ph->p_filesz;
+    if (ph->p_memsz > ph->p_filesz && (bss & 0xFFF) && ph->p_filesz) {
+        if (!(flags & VM_WRITE)) return -1;
+        uint64_t end = (bss + 0xFFF) & ~0xFFF;
+        if (end > ph->p_vaddr + ph->p_memsz) end = ph->p_vaddr + ph->p_memsz;
+        memset((void*)bss, 0, end - bss);
+    }
+    return 0;
+}
+
+static int do_exec(const char* path, int argc, char** argv);
+
 int process_exec(const char* path, const char** argv) {
+    char kpath[256];
+    strncpy(kpath, path, sizeof(kpath) - 1);
+    kpath[sizeof(kpath) - 1] = 0;
+
+    int argc = 0;
+    if (argv) {
+        while (argv[argc]) argc++;
+    }
+
+    char** kargv = (char**)kmalloc((argc + 1) * sizeof(char*));
+    if (!kargv) return -1;
+
+    int copied = 0;
+    for (; copied < argc; copied++) {
+        kargv[copied] = (char*)kmalloc(strlen(argv[copied]) + 1);
+        if (!kargv[copied]) break;
+        strcpy(kargv[copied], argv[copied]);
+    }
+    kargv[copied] = 0;
+
+    int ret = (copied == argc) ? do_exec(kpath, argc, kargv) : -1;
+
+    for (int i = 0; i < copied; i++) kfree(kargv[i]);
+    kfree(kargv);
+    return ret;
+}
+
+static int do_exec(const char* path, int argc, char** argv) {
     kprint_str("Exec: ");
     kprint_str(path);
     kprint_newline();
@@ -70,60 +161,41 @@ int process_exec(const char* path, const char** argv) {
         return -1;
     }
 
+    if (exec_mmap() != 0) {
+        vfs_close(fd);
+        return -1;
+    }
+
+    struct file *file = fget(fd);
+    struct mm_struct *mm = current_process->mm;
+
     struct elf_phdr ph;
     for (int i = 0; i < header.phnum; i++) {
         vfs_lseek(fd, header.phoff + i * header.phentsize, SEEK_SET);
         if (vfs_read(fd, (char*)&ph, sizeof(ph)) != sizeof(ph)) {
+            fput(file);
             vfs_close(fd);
             return -1;
         }
 
         if (ph.p_type == PT_LOAD) {
-             
-            uint64_t vaddr_start = ph.p_vaddr & ~0xFFF;
-            uint64_t vaddr_end = (ph.p_vaddr + ph.p_memsz + 0xFFF) & ~0xFFF;
-            
-            for (uint64_t v = vaddr_start; v < vaddr_end; v += 4096) {
-                 if (vmm_get_phys(v) == 0) {
-                     void *page = pmm_alloc_page();
-                     if (!page) {
-                         vfs_close(fd);
-                         return -1;
-                     }
-                     vmm_map_page(v, (uint64_t)page, PTE_PRESENT | PTE_WRITABLE | PTE_USER);
-                     memset((void*)v, 0, 4096);
-                 }
-            }
-            
-            vfs_lseek(fd, ph.p_offset, SEEK_SET);
-             
-            if (vfs_read(fd, (char*)ph.p_vaddr, ph.p_filesz) != (int)ph.p_filesz) {
-                 
-            }
-            
-            if (ph.p_memsz > ph.p_filesz) {
-                memset((void*)(ph.p_vaddr + ph.p_filesz), 0, ph.p_memsz - ph.p_filesz);
+            if (elf_map_segment(mm, file, &ph) != 0) {
+                kprint_str("Exec: Bad PT_LOAD segment\n");
+                fput(file);
+                vfs_close(fd);
+                return -1;
             }
         }
     }
     
+    fput(file);
     vfs_close(fd);
 
     uint64_t stack_top = 0x7FFFFFFFF000;
-    uint64_t stack_base = stack_top - 4 * 4096;  
+    uint64_t stack_base = stack_top - EXEC_STACK_PAGES * 4096;  
     
-    for (uint64_t v = stack_base; v < stack_top; v += 4096) {
-         void *page = pmm_alloc_page();
-         if (!page) return -1;
-         vmm_map_page(v, (uint64_t)page, PTE_PRESENT | PTE_WRITABLE | PTE_USER);
-         memset((void*)v, 0, 4096);
-    }
+    if (mmap_region(mm, stack_base, stack_top - stack_base, VM_READ | VM_WRITE, 0, 0) != 0) return -1;
 
-    int argc = 0;
-    if (argv) {
-        while (argv[argc]) argc++;
-    }
-    
     uint64_t sp = stack_top;
     
      
@@ -1,6 +1,8 @@
 #include "process.h"
 #include "pmm.h"
 #include "vmm.h"
+#include "mm/mmap.h"
+#include "mm/rmap.h"
 #include "heap.h"
 #include "console.h"
 #include "string.h"
@@ -13,6 +15,8 @@
 #include "namespace.h"
 #include "hrtimer.h"
 #include "list.h"
+#include "slab.h"
+#include "rcupdate.h"
 
 struct process* current_process = 0;
 struct process* process_list = 0;  
@@ -24,6 +28,8 @@ uint64_t global_ticks = 0;
  
 struct process* sleep_queue = 0;
 
+static struct kmem_cache* process_cachep;
+
  
 int mlfq_quantums[MLFQ_LEVELS] = { 2, 5, 10, 20 };  
 
@@ -51,8 +57,12 @@ void __attribute__((naked)) fork_trampoline() {
 }
 
 void process_init() {
+    mm_cache_init();
+    vma_cache_init();
+    anon_vma_init();
+    process_cachep = kmem_cache_create("process", sizeof(struct process), 0, SLAB_HWCACHE_ALIGN | SLAB_PANIC, 0);
      
-    struct process* kernel_proc = (struct process*)kmalloc(sizeof(struct process));
+    struct process* kernel_proc = (struct process*)kmem_cache_alloc(process_cachep, 0);
     
     memset(kernel_proc, 0, sizeof(struct process));
     
@@ -64,7 +74,8 @@ void process_init() {
     kernel_proc->quantum = mlfq_quantums[0];
     kernel_proc->time_slice = kernel_proc->quantum;
     
-    __asm__ volatile("mov %%cr3, %0" : "=r"(kernel_proc->cr3));
+    kernel_proc->mm = &init_mm;
+    kernel_proc->active_mm = &init_mm;
     
     kernel_proc->gid = 0;
     kernel_proc->sid = 0;
@@ -107,7 +118,7 @@ struct process* get_process_by_pid(int pid) {
 }
 
 struct process* process_create(void (*entry_point)()) {
-    struct process* proc = (struct process*)kmalloc(sizeof(struct process));
+    struct process* proc = (struct process*)kmem_cache_alloc(process_cachep, 0);
     if (!proc) return 0;
     
     memset(proc, 0, sizeof(struct process));
@@ -145,10 +156,11 @@ struct process* process_create(void (*entry_point)()) {
     void* stack_phys = pmm_alloc_page(); 
     if (!stack_phys) return 0;
      
-    uint64_t stack_top = (uint64_t)stack_phys + 4096;
+    uint64_t stack_top = (uint64_t)phys_to_virt((uint64_t)stack_phys) + 4096;
     
     proc->kernel_stack = stack_top;
-    proc->cr3 = current_process->cr3;  
+    proc->mm = 0;
+    proc->active_mm = 0;
     
     uint64_t* stack = (uint64_t*)stack_top;
     
@@ -175,7 +187,7 @@ struct process* process_create(void (*entry_point)()) {
 extern void kernel_thread_helper();
 
 struct process* process_create_kthread(void (*entry_point)(void*), void *arg) {
-    struct process* proc = (struct process*)kmalloc(sizeof(struct process));
+    struct process* proc = (struct process*)kmem_cache_alloc(process_cachep, 0);
     if (!proc) return 0;
     
     char* p = (char*)proc;
@@ -211,12 +223,10 @@ struct process* process_create_kthread(void (*entry_point)(void*), void *arg) {
     void* stack_phys = pmm_alloc_page(); 
     if (!stack_phys) return 0;
 
-    uint64_t stack_top = (uint64_t)stack_phys + 4096;
+    uint64_t stack_top = (uint64_t)phys_to_virt((uint64_t)stack_phys) + 4096;
     proc->kernel_stack = stack_top;
-    proc->cr3 = current_process ? current_process->cr3 : 0;  
-    if (!proc->cr3) {
-        __asm__ volatile("mov %%cr3, %0" : "=r"(proc->cr3));
-    }
+    proc->mm = 0;
+    proc->active_mm = 0;
     
     uint64_t* stack = (uint64_t*)stack_top;
     
@@ -249,8 +259,26 @@ struct process* process_create_kernel_thread(void (*entry)(void), const char *na
     return p;
 }
 
+static void process_switch_mm(struct process* prev, struct process* next) {
+    struct mm_struct* oldmm = prev->active_mm;
+
+    if (!next->mm) {
+        next->active_mm = oldmm;
+        mm_get(oldmm);
+    } else if (next->mm != oldmm) {
+        switch_mm(oldmm, next->mm);
+    }
+
+    if (!prev->mm) {
+        prev->active_mm = 0;
+        mm_put(oldmm);
+    }
+}
+
 void process_schedule() {
     if (!current_process) return;
+
+    rcu_check_callbacks();
     
      
     if (current_process->state == PROCESS_STATE_RUNNING) {
@@ -295,6 +323,7 @@ void process_schedule() {
         current_process->state = PROCESS_STATE_RUNNING;
         
         tss_set_stack(next->kernel_stack);
+        process_switch_mm(prev, next);
 
         switch_to_task(prev, current_process);
     } else if (next) {
@@ -368,9 +397,10 @@ void process_exit(int code) {
 
     current_process->exit_code = code;
     
-    struct process* kernel_proc = get_process_by_pid(0);
-    if (kernel_proc && current_process->cr3 != kernel_proc->cr3) {
-        vmm_free_user_space();
+    struct mm_struct* mm = current_process->mm;
+    current_process->mm = 0;
+    if (mm && mm != &init_mm && mm->count == 1) {
+        exit_mmap(mm);
     }
 
     kprint_str("Process Exiting PID: ");
@@ -408,7 +438,7 @@ void process_exit(int code) {
 }
 
 int process_fork() {
-    struct process* child = (struct process*)kmalloc(sizeof(struct process));
+    struct process* child = (struct process*)kmem_cache_alloc(process_cachep, 0);
     if (!child) return -1;
     
     memcpy(child, current_process, sizeof(struct process));
@@ -427,7 +457,15 @@ int process_fork() {
          
         return -1;
     }
-    child->kernel_stack = (uint64_t)stack_phys + 4096;
+    child->kernel_stack = (uint64_t)phys_to_virt((uint64_t)stack_phys) + 4096;
+
+    child->mm = mm_dup(current_process->mm);
+    if (!child->mm) {
+        pmm_free_page(stack_phys);
+        kmem_cache_free(process_cachep, child);
+        return -1;
+    }
+    child->active_mm = child->mm;
     
     struct interrupt_frame* parent_frame = (struct interrupt_frame*)(current_process->kernel_stack - sizeof(struct interrupt_frame));
     struct interrupt_frame* child_frame = (struct interrupt_frame*)(child->kernel_stack - sizeof(struct interrupt_frame));
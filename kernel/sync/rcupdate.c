@@ -0,0 +1,52 @@
+#include "rcupdate.h"
+#include "spinlock.h"
+#include "process.h"
+
+volatile int rcu_readers = 0;
+
+static struct rcu_head *rcu_cb_head = 0;
+static struct rcu_head **rcu_cb_tail = &rcu_cb_head;
+static spinlock_t rcu_lock;
+
+void rcu_init(void) {
+    spinlock_init(&rcu_lock);
+}
+
+void rcu_check_callbacks(void) {
+    if (rcu_readers || !rcu_cb_head) return;
+
+    spinlock_acquire(&rcu_lock);
+    if (rcu_readers) {
+        spinlock_release(&rcu_lock);
+        return;
+    }
+    struct rcu_head *list = rcu_cb_head;
+    rcu_cb_head = 0;
+    rcu_cb_tail = &rcu_cb_head;
+    spinlock_release(&rcu_lock);
+
+    while (list) {
+        struct rcu_head *next = list->next;
+        list->func(list);
+        list = next;
+    }
+}
+
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head)) {
+    head->func = func;
+    head->next = 0;
+
+    spinlock_acquire(&rcu_lock);
+    *rcu_cb_tail = head;
+    rcu_cb_tail = &head->next;
+    spinlock_release(&rcu_lock);
+
+    rcu_check_callbacks();
+}
+
+void synchronize_rcu(void) {
+    while (rcu_readers) {
+        process_yield();
+    }
+    rcu_check_callbacks();
+}
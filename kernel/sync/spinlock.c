@@ -61,6 +61,20 @@ void spinlock_acquire(spinlock_t* lock) {
     lock->owner_pid = current_pid;
 }
 
+int spinlock_try_acquire(spinlock_t* lock) {
+    uint64_t rflags = local_irq_save();
+    int current_pid = (current_process) ? current_process->pid : -2;
+
+    if (__sync_lock_test_and_set(&lock->locked, 1)) {
+        local_irq_restore(rflags);
+        return 0;
+    }
+
+    lock->rflags = rflags;
+    lock->owner_pid = current_pid;
+    return 1;
+}
+
 void spinlock_release(spinlock_t* lock) {
     uint64_t rflags = lock->rflags;
     
@@ -8,8 +8,11 @@
 #include "module.h"
 #include "seccomp.h"
 #include "io.h"
+#include "mm/mmap.h"
+#include "mm/swap.h"
 
 #define MAX_SYSCALLS 256
+#define SWAP_NAME_MAX 32
 
 typedef uint64_t (*syscall_handler_t)(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
 
@@ -105,6 +108,39 @@ static uint64_t sys_reboot_wrapper(uint64_t a1, uint64_t a2, uint64_t a3, uint64
     return 0;
 }
 
+static uint64_t sys_mmap_wrapper(uint64_t addr, uint64_t len, uint64_t prot, uint64_t flags, uint64_t fd, uint64_t offset) {
+    return sys_mmap(addr, len, prot, flags, (int)fd, offset);
+}
+
+static uint64_t sys_munmap_wrapper(uint64_t addr, uint64_t len, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    return (uint64_t)sys_munmap(addr, len);
+}
+
+static uint64_t sys_mprotect_wrapper(uint64_t addr, uint64_t len, uint64_t prot, uint64_t a4, uint64_t a5, uint64_t a6) {
+    return (uint64_t)sys_mprotect(addr, len, prot);
+}
+
+static int syscall_capable() {
+    return current_process && (!current_process->mm || !current_process->parent);
+}
+
+static int strncpy_from_user(char* dst, uint64_t src, uint64_t max) {
+    for (uint64_t i = 0; i < max; i++) {
+        if (src + i < src || src + i >= USER_SPACE_END) return -1;
+        dst[i] = ((const char*)src)[i];
+        if (!dst[i]) return (int)i;
+    }
+    return -1;
+}
+
+static uint64_t sys_swapon_wrapper(uint64_t name, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
+    char kname[SWAP_NAME_MAX];
+
+    if (!syscall_capable()) return (uint64_t)-1;
+    if (strncpy_from_user(kname, name, sizeof(kname)) <= 0) return (uint64_t)-1;
+    return (uint64_t)swapon(kname);
+}
+
 static uint64_t sys_unknown_wrapper(uint64_t n, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6) {
     kprint_str("Unknown Syscall: ");
     kprint_hex(n);
@@ -122,7 +158,7 @@ void syscall_handler(struct interrupt_frame* frame) {
     }
 
     if (syscall_num < MAX_SYSCALLS && syscall_table[syscall_num]) {
-        frame->rax = syscall_table[syscall_num](frame->rsi, frame->rdx, frame->rcx, 0, 0, 0);
+        frame->rax = syscall_table[syscall_num](frame->rsi, frame->rdx, frame->rcx, frame->r8, frame->r9, frame->r10);
     } else {
         frame->rax = sys_unknown_wrapper(syscall_num, 0, 0, 0, 0, 0);
     }
@@ -156,4 +192,8 @@ void syscall_init() {
     syscall_table[SYS_LSEEK] = sys_lseek_wrapper;
     syscall_table[SYS_KILL] = sys_kill_wrapper;
     syscall_table[SYS_REBOOT] = sys_reboot_wrapper;
+    syscall_table[SYS_MMAP] = sys_mmap_wrapper;
+    syscall_table[SYS_MUNMAP] = sys_munmap_wrapper;
+    syscall_table[SYS_MPROTECT] = sys_mprotect_wrapper;
+    syscall_table[SYS_SWAPON] = sys_swapon_wrapper;
 }
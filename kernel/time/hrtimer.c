@@ -59,6 +59,7 @@ void hrtimer_init_system(void) {
 }
 
 ktime_t ktime_get_ns(void) {
+    if (tsc_frequency < 1000000) return 0;
     uint64_t current_tsc = rdtsc();
     uint64_t diff = current_tsc - initial_tsc;
     return (diff * 1000) / (tsc_frequency / 1000000);
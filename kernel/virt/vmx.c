@@ -1,6 +1,7 @@
 #include "virt/vmx.h"
 #include "console.h"
 #include "pmm.h"
+#include "vmm.h"
 #include "string.h"
 #include "gdt.h"
 
@@ -141,10 +142,10 @@ int vmx_init(void) {
     uint64_t vmx_basic = read_msr(MSR_IA32_VMX_BASIC);
     uint32_t revision_id = (uint32_t)vmx_basic;
     
-    vmxon_region = pmm_alloc_page();  
-    if (!vmxon_region) return -1;
+    vmxon_phys = (uint64_t)pmm_alloc_page();  
+    if (!vmxon_phys) return -1;
     
-    vmxon_phys = (uint64_t)vmxon_region; 
+    vmxon_region = phys_to_virt(vmxon_phys); 
     
     *(uint32_t*)vmxon_region = revision_id;
     
@@ -299,36 +300,39 @@ static void vmx_setup_controls() {
 
 static void vmx_setup_ept() {
 
-    uint64_t *pml4 = (uint64_t*)pmm_alloc_page();
-    uint64_t *pdpt = (uint64_t*)pmm_alloc_page();
-    uint64_t *pd   = (uint64_t*)pmm_alloc_page();
+    uint64_t pml4_phys = (uint64_t)pmm_alloc_page();
+    uint64_t pdpt_phys = (uint64_t)pmm_alloc_page();
+    uint64_t pd_phys   = (uint64_t)pmm_alloc_page();
+
+    uint64_t *pml4 = (uint64_t*)phys_to_virt(pml4_phys);
+    uint64_t *pdpt = (uint64_t*)phys_to_virt(pdpt_phys);
+    uint64_t *pd   = (uint64_t*)phys_to_virt(pd_phys);
 
     memset(pml4, 0, 4096);
     memset(pdpt, 0, 4096);
     memset(pd, 0, 4096);
     
-    pml4[0] = (uint64_t)pdpt | 0x7;  
-    pdpt[0] = (uint64_t)pd | 0x7;
+    pml4[0] = pdpt_phys | 0x7;  
+    pdpt[0] = pd_phys | 0x7;
 
     for (int i = 0; i < 512; i++) {
         pd[i] = (uint64_t)(i * 0x200000) | 0x37;  
         pd[i] = (uint64_t)(i * 0x200000) | 0xB7;
     }
 
-    uint64_t eptp = (uint64_t)pml4 | (6 | (3 << 3));
+    uint64_t eptp = pml4_phys | (6 | (3 << 3));
     __vmwrite(EPT_POINTER, eptp);
     __vmwrite(EPT_POINTER_HIGH, eptp >> 32);
 }
 
 int vmx_create_vm(void) {
-    void *vmcs_region = pmm_alloc_page();
-    if (!vmcs_region) return -1;
+    uint64_t phys = (uint64_t)pmm_alloc_page();
+    if (!phys) return -1;
+    void *vmcs_region = phys_to_virt(phys);
     
     uint64_t vmx_basic = read_msr(MSR_IA32_VMX_BASIC);
     *(uint32_t*)vmcs_region = (uint32_t)vmx_basic;
     
-    uint64_t phys = (uint64_t)vmcs_region;
-    
     __vmclear(phys);
     __vmptrld(phys);
     